@@ -0,0 +1,56 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+
+#include "ecp5.h"
+
+int ecp5_arena_init(struct ecp5_arena *arena)
+{
+	arena->buf = kmalloc(ECP5_ARENA_SIZE, GFP_KERNEL);
+	if (!arena->buf)
+		return (-ENOMEM);
+
+	arena->size = ECP5_ARENA_SIZE;
+	arena->grown = 0;
+
+	return (0);
+}
+
+void ecp5_arena_free(struct ecp5_arena *arena)
+{
+	kfree(arena->buf);
+	arena->buf = NULL;
+	arena->size = 0;
+}
+
+/*
+ * Return the arena with at least size bytes.  An arena too small is
+ * replaced by a larger one and kept for later runs; if that fails the
+ * old one stays and NULL is returned.  The contents are not kept.
+ *
+ * Called by SSPIEm_open() before a run touches the device, never while
+ * it goes on.
+ */
+unsigned char *ecp5_arena_get(struct ecp5_arena *arena, size_t size)
+{
+	unsigned char *buf;
+
+	if (size <= arena->size)
+		return (arena->buf);
+
+	buf = kmalloc(size, GFP_KERNEL);
+	if (!buf)
+	{
+		pr_err("ECP5: can't grow the session arena to %zu bytes\n",
+				size);
+		return (NULL);
+	}
+
+	kfree(arena->buf);
+	arena->buf = buf;
+	arena->size = size;
+	arena->grown++;
+	pr_debug("ECP5: session arena grown to %zu bytes\n", size);
+
+	return (arena->buf);
+}
@@ -0,0 +1,194 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/spi/spi.h>
+
+#include "ecp5.h"
+#include "ecp5_sspi.h"
+#include "lattice/hardware.h"
+#include "lattice/debug.h"
+
+/*
+ * SPI clocks tried by the calibration and stepped down to by the
+ * fallback, fastest first.  The controller rounds down to the closest
+ * rate its divider gives.
+ */
+static const u32 ecp5_clock_rates[] = {
+	60000000,
+	50000000,
+	40000000,
+	30000000,
+	24000000,
+	20000000,
+	15000000,
+	10000000,
+	5000000,
+	1000000,
+};
+
+/* IDCODE reads per rate, all of them must match */
+#define ECP5_CLOCK_READS	64
+
+/* the low 12 bits of every Lattice IDCODE, JEDEC manufacturer 0x21 */
+#define ECP5_IDCODE_LATTICE	0x043
+
+static u32 ecp5_clock_idcode(const unsigned char *idcode)
+{
+	return ((idcode[0] << 24) | (idcode[1] << 16) |
+			(idcode[2] << 8) | idcode[3]);
+}
+
+int ecp5_clock_set(struct ecp5 *ecp5_info, u32 spi_hz)
+{
+	struct spi_device *spi = ecp5_info->spi;
+	u32 old_hz = spi->max_speed_hz;
+	int ret;
+
+	if (spi_hz == 0 || spi_hz > ECP5_CLOCK_MAX_HZ)
+		return (-EINVAL);
+
+	spi->max_speed_hz = spi_hz;
+	ret = spi_setup(spi);
+	if (ret < 0)
+	{
+		spi->max_speed_hz = old_hz;
+		spi_setup(spi);
+	}
+
+	return (ret);
+}
+
+/*
+ * Read IDCODE ECP5_CLOCK_READS times at spi_hz.  Returns 1 if every read
+ * gives idcode, or the first one read if idcode is 0.
+ */
+static int ecp5_clock_check(struct ecp5 *ecp5_info, u32 spi_hz, u32 *idcode)
+{
+	unsigned char idcodes[4 * ECP5_CLOCK_READS];
+	u32 value;
+	int i;
+
+	if (ecp5_clock_set(ecp5_info, spi_hz) < 0)
+		return (0);
+
+	if (!SPI_readIdcodes(idcodes, ECP5_CLOCK_READS))
+		return (0);
+
+	if (!*idcode)
+		*idcode = ecp5_clock_idcode(idcodes);
+
+	for (i = 0; i < ECP5_CLOCK_READS; ++i)
+	{
+		value = ecp5_clock_idcode(idcodes + 4 * i);
+		if (value != *idcode)
+		{
+			pr_debug("ECP5: clock: IDCODE %08x instead of %08x at %u Hz\n",
+					value, *idcode, spi_hz);
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+/*
+ * Find the fastest SPI clock at which IDCODE reads back reliably.  The
+ * reference IDCODE is read at the slowest rate and must look like a
+ * Lattice one.  IDCODE can be read without resetting the device, a
+ * configured FPGA only answers with SLAVE_SPI_PORT=ENABLE though.
+ *
+ * Called with the engine held.  Returns the clock set or a
+ * negative errno, the clock is left as it was on failure.
+ */
+int ecp5_clock_calibrate(struct ecp5 *ecp5_info)
+{
+	struct spi_device *old_spi = current_programming_ecp5;
+	u32 old_hz = ecp5_info->spi->max_speed_hz;
+	u32 idcode = 0;
+	int i;
+
+	current_programming_ecp5 = ecp5_info->spi;
+
+	if (!ecp5_clock_check(ecp5_info,
+				ecp5_clock_rates[ARRAY_SIZE(ecp5_clock_rates) - 1],
+				&idcode) ||
+			(idcode & 0xFFF) != ECP5_IDCODE_LATTICE)
+	{
+		pr_err("ECP5: clock: no device answers IDCODE (read %08x)\n",
+				idcode);
+		ecp5_clock_set(ecp5_info, old_hz);
+		current_programming_ecp5 = old_spi;
+		return (-ENODEV);
+	}
+
+	/* the slowest rate is checked again, the clock must end up set */
+	for (i = 0; i < ARRAY_SIZE(ecp5_clock_rates); ++i)
+		if (ecp5_clock_check(ecp5_info, ecp5_clock_rates[i], &idcode))
+			break;
+
+	if (i == ARRAY_SIZE(ecp5_clock_rates))
+	{
+		pr_err("ECP5: clock: IDCODE reads are unreliable at every clock\n");
+		ecp5_clock_set(ecp5_info, old_hz);
+		current_programming_ecp5 = old_spi;
+		return (-EIO);
+	}
+
+	current_programming_ecp5 = old_spi;
+
+	pr_info("ECP5: clock: IDCODE %08x, SPI clock set to %u Hz\n",
+			idcode, ecp5_clock_rates[i]);
+
+	return (ecp5_clock_rates[i]);
+}
+
+/*
+ * A run starts at the clock of the device, ecp5_clock_retry() may step
+ * it down.
+ */
+void ecp5_clock_start(struct ecp5 *ecp5_info)
+{
+	ecp5_info->clock_start_hz = ecp5_info->spi->max_speed_hz;
+	ecp5_info->clock_retries = 0;
+}
+
+/*
+ * Called after each attempt of a run with its result.  A verification
+ * or IDCODE failure may come from a clock too fast for the board, so up
+ * to ECP5_CLOCK_RETRIES times the clock is stepped down to the next
+ * lower rate and 1 is returned to run again.  A run that then succeeds
+ * keeps the lower clock; one that still fails gets its clock back.
+ */
+int ecp5_clock_retry(struct ecp5 *ecp5_info, int result)
+{
+	u32 spi_hz = ecp5_info->spi->max_speed_hz;
+	int i;
+
+	if ((result == ERROR_VERIFICATION || result == ERROR_IDCODE) &&
+			ecp5_info->clock_retries < ECP5_CLOCK_RETRIES)
+	{
+		for (i = 0; i < ARRAY_SIZE(ecp5_clock_rates); ++i)
+		{
+			if (ecp5_clock_rates[i] >= spi_hz)
+				continue;
+			if (ecp5_clock_set(ecp5_info, ecp5_clock_rates[i]) < 0)
+				break;
+
+			ecp5_info->clock_retries++;
+			atomic_inc(&ecp5_info->progress.retries);
+			pr_warn("ECP5: programming failed with code %d at %u Hz, retrying at %u Hz\n",
+					result, spi_hz, ecp5_clock_rates[i]);
+			return (1);
+		}
+	}
+
+	if (!ecp5_info->clock_retries)
+		return (0);
+
+	if (result == ECP5_RESULT_OK)
+		pr_info("ECP5: SPI clock lowered to %u Hz\n", spi_hz);
+	else
+		ecp5_clock_set(ecp5_info, ecp5_info->clock_start_hz);
+
+	return (0);
+}
@@ -0,0 +1,60 @@
+#include <linux/debugfs.h>
+#include <linux/err.h>
+
+#include "ecp5.h"
+
+int ecp5_debugfs_init(struct ecp5 *ecp5_info)
+{
+	char name[32];
+	struct dentry *dir;
+
+	snprintf(name, sizeof(name), "ecp5-spi%d.%d",
+			ecp5_info->spi->master->bus_num,
+			ecp5_info->spi->chip_select);
+
+	dir = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(dir))
+	{
+		/* debugfs is optional, programming works without it */
+		ecp5_info->debugfs_dir = NULL;
+		return (0);
+	}
+	ecp5_info->debugfs_dir = dir;
+
+	debugfs_create_file("progress", 0444, dir, ecp5_info,
+			&ecp5_progress_fops);
+	debugfs_create_file("tx_cache", 0444, dir, ecp5_info,
+			&ecp5_txcache_fops);
+
+	ecp5_info->profile = ecp5_profile_alloc();
+	if (ecp5_info->profile)
+	{
+		debugfs_create_u32("profile_enable", 0644, dir,
+				&ecp5_info->profile->enabled);
+		debugfs_create_file("profile", 0444, dir, ecp5_info,
+				&ecp5_profile_fops);
+	}
+
+	ecp5_info->record = ecp5_record_alloc();
+	if (ecp5_info->record)
+	{
+		debugfs_create_u32("record_enable", 0644, dir,
+				&ecp5_info->record->enabled);
+		debugfs_create_file("record", 0444, dir, ecp5_info,
+				&ecp5_record_fops);
+	}
+
+	return (0);
+}
+
+void ecp5_debugfs_exit(struct ecp5 *ecp5_info)
+{
+	debugfs_remove_recursive(ecp5_info->debugfs_dir);
+	ecp5_info->debugfs_dir = NULL;
+
+	ecp5_profile_free(ecp5_info->profile);
+	ecp5_info->profile = NULL;
+
+	ecp5_record_free(ecp5_info->record);
+	ecp5_info->record = NULL;
+}
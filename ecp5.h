@@ -0,0 +1,506 @@
+#ifndef _ECP5_H_
+#define _ECP5_H_
+
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/kref.h>
+#include <linux/miscdevice.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/fs.h>
+
+#include <linux/spi/spi.h>
+
+#include "ecp5_sspi.h"
+
+/* bits in ecp5->flags */
+#define ECP5_PROGRAMMING	0
+#define ECP5_REMOVED		1	/* no new runs, remove waits for nr_runs */
+
+/*
+ * Live programming progress.
+ *
+ * Counters are written only by the programming job through the
+ * ecp5_progress_*() hooks called from lattice/hardware.c, and read
+ * without locking by the debugfs "progress" file.  They are kept after
+ * the run ends, until the next run starts.
+ */
+struct ecp5_progress
+{
+	atomic_long_t tx_bytes;		/* bytes sent to the FPGA */
+	atomic_long_t rx_bytes;		/* bytes read back from the FPGA */
+	atomic_long_t verified_bytes;	/* data bytes read back and compared */
+	atomic_t data_set;		/* ID of the data set being streamed */
+	atomic_long_t rate;		/* bytes/s over the last window */
+	atomic_t running;
+	atomic_t skipped;		/* ensure found the image running */
+	atomic_t cached;		/* replayed from the transaction cache */
+	atomic_t retries;		/* runs repeated at a lower SPI clock */
+
+	ktime_t start;
+	ktime_t finish;
+
+	/* image sizes of the current run */
+	int algo_size;
+	int data_size;
+
+	/* throughput window, written by the writer only, see progress.c */
+	unsigned long window_start;
+	long window_bytes;
+
+	/* bytes moved by the last complete run, used for the ETA */
+	long expected_bytes;
+	int expected_algo_size;
+	int expected_data_size;
+};
+
+/*
+ * Per-opcode execution profile of the last programming run, see
+ * profile.c.  Collected only if "profile_enable" in debugfs was set
+ * when the run started.  Written by the programming job and read
+ * without locking by the debugfs "profile" file.
+ */
+#define ECP5_PROFILE_PROCESS	0	/* opcodes run by SSPIEm_process() */
+#define ECP5_PROFILE_TRANS	1	/* opcodes run by proc_TRANS() */
+#define ECP5_PROFILE_LEVELS	2
+
+struct ecp5_profile_op
+{
+	u32 count;
+	u64 ns;				/* includes nested opcodes */
+};
+
+struct ecp5_profile_set
+{
+	u32 frames;
+	u64 tx_bytes;
+	u64 rx_bytes;
+};
+
+struct ecp5_profile
+{
+	u32 enabled;
+	int active;
+
+	ktime_t start;
+	ktime_t finish;
+
+	struct ecp5_profile_op ops[ECP5_PROFILE_LEVELS][256];
+	u64 loop_iterations;
+	u64 repeat_iterations;
+	struct ecp5_profile_set sets[256];
+};
+
+/*
+ * Ring buffer of the SPI transfers, chip select changes and delays of
+ * the last programming run, see record.c.  Recording is enabled by
+ * "record_enable" in debugfs; the buffer is allocated on the first run
+ * that records and kept.  Once full the oldest records are dropped.
+ */
+#define ECP5_RECORD_SIZE	(4 << 20)
+
+struct ecp5_record
+{
+	u32 enabled;
+
+	/*
+	 * lock serialises the "record" open against the start and the
+	 * finish of a run, records are added only while active is set
+	 */
+	struct mutex lock;
+	int active;
+	ktime_t start;
+
+	unsigned char *buf;		/* ECP5_RECORD_SIZE bytes */
+	size_t head;			/* next byte written */
+	size_t tail;			/* oldest record */
+	size_t used;
+	u32 records;
+	u32 dropped;
+};
+
+/*
+ * Transaction cache, see txcache.c.  With "tx_cache" set in sysfs the
+ * first successful run of an image renders what went over the wire:
+ * transfers, chip select changes, waits and the read back data the
+ * algorithm compares.  Later runs of the same image replay the
+ * rendering instead of running the lattice engine.  Images are looked
+ * up by CRC32 and size, then compared with the copies the entry keeps,
+ * so a CRC collision can't replay another bitstream.
+ */
+#define ECP5_TXCACHE_ENTRIES	2
+#define ECP5_TXCACHE_CHUNK	(64 << 10)	/* kmalloc()ed, DMA capable */
+#define ECP5_TXCACHE_MAX	(32 << 20)	/* rendering of one image */
+#define ECP5_TXCACHE_DEPTH	8		/* nested LOOPs */
+
+/* rendered operations */
+#define ECP5_TXOP_RESET		0	/* SPI_init() */
+#define ECP5_TXOP_CS		1	/* arg is 1 to select, 0 to deselect */
+#define ECP5_TXOP_TX		2	/* len bytes to send */
+#define ECP5_TXOP_RX		3	/* len bytes expected, then len mask bytes */
+#define ECP5_TXOP_WAIT		4	/* arg ms */
+#define ECP5_TXOP_LOOP		5	/* up to arg passes until ECP5_TXOP_ENDLOOP */
+#define ECP5_TXOP_ENDLOOP	6
+
+/* ECP5_TXOP_RX flags */
+#define ECP5_TXOP_VERIFY	(1 << 0)	/* read back of a data set */
+
+struct ecp5_txcache_op;
+
+struct ecp5_txcache_chunk
+{
+	struct ecp5_txcache_chunk *next;
+	size_t used;
+	unsigned char data[0];
+};
+
+struct ecp5_txcache_key
+{
+	u32 algo_crc;
+	u32 data_crc;
+	int algo_size;
+	int data_size;
+};
+
+struct ecp5_txcache_entry
+{
+	struct ecp5_txcache_key key;
+	unsigned char *algo;		/* copies of the rendered images */
+	unsigned char *data;
+	struct ecp5_txcache_chunk *chunks;	/* NULL if the entry is free */
+	size_t size;
+	u32 max_op;			/* largest TX or RX op, in bytes */
+	u32 replays;
+	u32 last_used;
+};
+
+struct ecp5_txcache_mark
+{
+	struct ecp5_txcache_chunk *chunk;
+	size_t used;
+};
+
+struct ecp5_txcache
+{
+	int enabled;
+
+	/*
+	 * lock protects the entries, the programming job holds it from
+	 * ecp5_txcache_run() to ecp5_txcache_finish()
+	 */
+	struct mutex lock;
+	struct ecp5_txcache_entry entries[ECP5_TXCACHE_ENTRIES];
+	struct ecp5_txcache_entry *replaying;
+	u32 clock;			/* for last_used */
+
+	/* rendering of the running job */
+	int rendering;
+	int overflow;
+	struct ecp5_txcache_entry render;
+	struct ecp5_txcache_chunk *tail;
+	struct ecp5_txcache_op *last;	/* op a TX may be appended to */
+	struct ecp5_txcache_mark loops[ECP5_TXCACHE_DEPTH];
+	int depth;
+
+	u32 hits;
+	u32 misses;
+	u32 dropped;			/* entries whose replay failed */
+};
+
+/*
+ * Outcome of the last dry run, see the "dry_run" sysfs attribute
+ */
+struct ecp5_dry_run
+{
+	int result;
+	u32 spi_hz;			/* 0 if there was no dry run yet */
+	u64 tx_bits;
+	u64 rx_bits;
+	u64 wait_ms;
+	u32 transactions;
+	u32 transfers;
+	u64 estimate_us;		/* bus time at spi_hz plus wait_ms */
+};
+
+/*
+ * Programming jobs, see sched.c.  Each device queues its jobs, and its
+ * runs take turns by priority: a recovery run goes before bulk ones.
+ * Runs of all devices then take turns on the one lattice engine.
+ */
+#define ECP5_PRIO_BULK		0
+#define ECP5_PRIO_RECOVERY	1
+#define ECP5_JOBS_MAX		8	/* queued per device */
+
+struct ecp5_job
+{
+	int slot;			/* slot index or ECP5_SLOT_STAGING */
+	int prio;
+};
+
+/*
+ * Image slot, keeps a validated algo/data pair resident so it can be
+ * programmed again without uploading it.
+ */
+#define ECP5_NR_SLOTS		4
+#define ECP5_SLOT_STAGING	-1	/* job programs algo_mem/data_mem */
+
+struct ecp5_slot
+{
+	char name[ECP5_SLOT_NAME_LEN];	/* empty string if the slot is free */
+	unsigned char *algo_mem;
+	int algo_size;
+	unsigned char *data_mem;
+	int data_size;
+};
+
+/*
+ * Session arena, see arena.c.  Every scratch buffer of a run comes from
+ * it: the register and transfer buffers of lattice/hardware.c and the
+ * buffers SSPIEm_open() lays out for the algorithm.  It is kmalloc()ed,
+ * so DMA capable, at probe and kept; a run needing more grows it before
+ * it resets the FPGA, so nothing is allocated while programming.
+ */
+#define ECP5_ARENA_SIZE		(64 << 10)
+
+struct ecp5_arena
+{
+	unsigned char *buf;
+	size_t size;
+	u32 grown;			/* times a run needed more */
+};
+
+/*
+ * FPGA configuration pins, see pins.c.  Requested at probe and held until
+ * remove, lattice/hardware.c drives them during runs.
+ */
+#define ECP5_PIN_CFG0		0	/* SPI mux and FPGA slave SPI mode */
+#define ECP5_PIN_CFG1		1
+#define ECP5_PIN_DONE		2
+#define ECP5_PIN_INITN		3
+#define ECP5_PIN_PROGRAMN	4
+#define ECP5_PIN_CS		5	/* chip select, driven by hand */
+#define ECP5_NR_PINS		6
+
+/* platform data of the SPI device, from the board file */
+struct ecp5_platform_data
+{
+	int gpios[ECP5_NR_PINS];	/* indexed by ECP5_PIN_* */
+};
+
+/* bus_lock values */
+#define ECP5_BUS_LOCK_OFF	0
+#define ECP5_BUS_LOCK_TRANS	1	/* from STARTTRAN to ENDTRAN */
+#define ECP5_BUS_LOCK_RUN	2	/* from SPI_init() to SPI_final() */
+
+/* SPI clock, see clock.c */
+#define ECP5_CLOCK_MAX_HZ	60000000
+#define ECP5_CLOCK_RETRIES	2	/* runs repeated at a lower clock */
+
+struct ecp5
+{
+	/* held by probe until remove and by every open file */
+	struct kref ref;
+	struct spi_device *spi;
+	int programming_result;
+	int pins[ECP5_NR_PINS];		/* GPIOs, indexed by ECP5_PIN_* */
+
+	/*
+	 * lock protects algo_mem/data_mem against reallocation while a
+	 * programming job is queued or running (ECP5_PROGRAMMING set)
+	 */
+	struct mutex lock;
+	unsigned long flags;
+	struct workqueue_struct *program_wq;
+	char program_wq_name[24];	/* the workqueue keeps the pointer */
+	struct work_struct program_work;
+	struct ecp5_job jobs[ECP5_JOBS_MAX];	/* protected by lock */
+	int nr_jobs;
+	int nr_runs;			/* queued and running, protected by lock */
+	int failed_result;		/* first failed run, until "program" is read */
+
+	/* runs of the device waiting for their turn, see sched.c */
+	spinlock_t turn_lock;
+	struct list_head turn_waiters;	/* highest priority first */
+	int turn_busy;
+	wait_queue_head_t runs_done;	/* woken when nr_runs drops to 0 */
+
+	struct ecp5_slot slots[ECP5_NR_SLOTS];
+
+	/* skip programming if the FPGA already runs the image, see ensure.c */
+	int ensure;
+	int has_expected_usercode;
+	u32 expected_usercode;
+
+	/* poll the status register instead of WAITing, see lattice/hardware.c */
+	int adaptive_wait;
+
+	/* keep the SPI bus to the run, ECP5_BUS_LOCK_*, see lattice/hardware.c */
+	int bus_lock;
+
+	/* move long transfers as 32 bit SPI words, see lattice/hardware.c */
+	int bulk_words;
+	int has_bulk_words;		/* the controller does 32 bit words */
+
+	/* SPI clock fallback of the current run, see clock.c */
+	u32 clock_start_hz;
+	int clock_retries;
+
+	struct ecp5_dry_run dry_run;	/* protected by lock */
+
+	struct ecp5_txcache txcache;
+
+	struct ecp5_arena arena;	/* used with the engine held */
+
+	struct ecp5_progress progress;
+	struct ecp5_profile *profile;	/* NULL without debugfs */
+	struct ecp5_record *record;	/* NULL without debugfs */
+	struct dentry *debugfs_dir;
+
+	/* ioctl interface, see ecp5_sspi.h */
+	struct miscdevice ctl_char_device;
+
+	int algo_size;
+	unsigned char *algo_mem;
+	struct mutex algo_lock;
+	struct miscdevice algo_char_device;
+
+	int data_size;
+	unsigned char *data_mem;
+	struct mutex data_lock;
+	struct miscdevice data_char_device;
+};
+
+/* device being programmed, set by the programming job */
+extern struct spi_device *current_programming_ecp5;
+
+static inline struct ecp5 *current_ecp5(void)
+{
+	return (spi_get_drvdata(current_programming_ecp5));
+}
+
+/*
+ * main.c
+ */
+int ecp5_validate_images(unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size);
+int ecp5_dry_run_images(struct ecp5 *ecp5_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size,
+		u32 spi_hz, struct ecp5_dry_run *out);
+
+/*
+ * slots.c, callers hold ecp5->lock
+ */
+int ecp5_slot_parse_name(char *name, const char *buf, size_t count);
+struct ecp5_slot *ecp5_slot_find(struct ecp5 *ecp5_info, const char *name);
+int ecp5_slot_save(struct ecp5 *ecp5_info, const char *name);
+int ecp5_slot_delete(struct ecp5 *ecp5_info, const char *name);
+ssize_t ecp5_slots_show(struct ecp5 *ecp5_info, char *buf);
+void ecp5_slots_free(struct ecp5 *ecp5_info);
+
+/*
+ * ensure.c
+ */
+int ecp5_ensure_check(struct ecp5 *ecp5_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size);
+
+/*
+ * pins.c
+ */
+int ecp5_pins_request(struct ecp5 *ecp5_info,
+		const struct ecp5_platform_data *pdata);
+void ecp5_pins_free(struct ecp5 *ecp5_info);
+
+/*
+ * sched.c
+ */
+void ecp5_engine_get(void);
+void ecp5_engine_put(void);
+void ecp5_turn_init(struct ecp5 *ecp5_info);
+void ecp5_turn_get(struct ecp5 *ecp5_info, int prio);
+void ecp5_turn_put(struct ecp5 *ecp5_info);
+int ecp5_job_queue(struct ecp5 *ecp5_info, int slot, int prio);
+int ecp5_job_next(struct ecp5 *ecp5_info, struct ecp5_job *job);
+
+/*
+ * clock.c, callers hold the engine, see ecp5_engine_get()
+ */
+int ecp5_clock_set(struct ecp5 *ecp5_info, u32 spi_hz);
+int ecp5_clock_calibrate(struct ecp5 *ecp5_info);
+void ecp5_clock_start(struct ecp5 *ecp5_info);
+int ecp5_clock_retry(struct ecp5 *ecp5_info, int result);
+
+/*
+ * arena.c
+ */
+int ecp5_arena_init(struct ecp5_arena *arena);
+void ecp5_arena_free(struct ecp5_arena *arena);
+unsigned char *ecp5_arena_get(struct ecp5_arena *arena, size_t size);
+
+/*
+ * progress.c
+ */
+void ecp5_progress_start(struct ecp5 *ecp5_info, int algo_size, int data_size);
+void ecp5_progress_finish(struct ecp5 *ecp5_info, int result);
+void ecp5_progress_tx(struct ecp5_progress *progress, int n_bytes);
+void ecp5_progress_rx(struct ecp5_progress *progress, int n_bytes);
+void ecp5_progress_verified(struct ecp5_progress *progress, int n_bytes);
+void ecp5_progress_data_set(struct ecp5_progress *progress, int data_set);
+
+/*
+ * profile.c
+ */
+struct ecp5_profile *ecp5_profile_alloc(void);
+void ecp5_profile_free(struct ecp5_profile *profile);
+void ecp5_profile_start(struct ecp5 *ecp5_info);
+void ecp5_profile_finish(struct ecp5 *ecp5_info);
+u64 ecp5_profile_now(struct ecp5_profile *profile);
+void ecp5_profile_op(struct ecp5_profile *profile, int level,
+		unsigned char opcode, u64 start);
+void ecp5_profile_iterations(struct ecp5_profile *profile,
+		unsigned char opcode, unsigned int iterations);
+void ecp5_profile_data(struct ecp5_profile *profile, unsigned char data_set,
+		int tx_bytes, int rx_bytes);
+
+/*
+ * record.c
+ */
+struct ecp5_record *ecp5_record_alloc(void);
+void ecp5_record_free(struct ecp5_record *record);
+void ecp5_record_start(struct ecp5 *ecp5_info);
+void ecp5_record_finish(struct ecp5 *ecp5_info);
+void ecp5_record_add(struct ecp5_record *record, u32 type,
+		const void *data, u32 len);
+
+/*
+ * txcache.c
+ */
+void ecp5_txcache_init(struct ecp5 *ecp5_info);
+void ecp5_txcache_free(struct ecp5 *ecp5_info);
+int ecp5_txcache_run(struct ecp5 *ecp5_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size);
+void ecp5_txcache_finish(struct ecp5 *ecp5_info, int result);
+void ecp5_txcache_add(struct ecp5_txcache *cache, u8 type,
+		const void *data, u32 len, s32 arg);
+void ecp5_txcache_expect(struct ecp5_txcache *cache, int index,
+		unsigned char expected, unsigned char mask, int error, int verify);
+void ecp5_txcache_loop(struct ecp5_txcache *cache, int event,
+		unsigned int count);
+
+/*
+ * debugfs.c, files live in /sys/kernel/debug/ecp5-spiB.C/
+ */
+int ecp5_debugfs_init(struct ecp5 *ecp5_info);
+void ecp5_debugfs_exit(struct ecp5 *ecp5_info);
+
+extern const struct file_operations ecp5_progress_fops;
+extern const struct file_operations ecp5_profile_fops;
+extern const struct file_operations ecp5_record_fops;
+extern const struct file_operations ecp5_txcache_fops;
+
+#endif
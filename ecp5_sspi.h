@@ -0,0 +1,121 @@
+#ifndef _ECP5_SSPI_H_
+#define _ECP5_SSPI_H_
+
+/*
+ * Userspace interface of the ecp5_sspi driver.
+ *
+ * Besides the algo/data misc devices and sysfs attributes every probed
+ * FPGA gets a control device, /dev/ecp5-spiB.C, that programs images
+ * straight from user memory with a single ioctl:
+ *
+ *	struct ecp5_program_req req = {
+ *		.algo_ptr = (uintptr_t)algo, .algo_size = algo_len,
+ *		.data_ptr = (uintptr_t)data, .data_size = data_len,
+ *	};
+ *	ioctl(fd, ECP5_IOC_PROGRAM, &req);
+ *
+ * The buffers are pinned for the duration of the call and are not copied.
+ * The ioctl blocks until programming ends; it returns 0 when the engine
+ * ran, whatever the outcome, and the outcome is reported in req.out.
+ * Jobs queued or running on the device don't make it fail: the run
+ * waits its turn on the device, ECP5_PROGRAM_RECOVERY ahead of bulk
+ * runs.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* out.result on success, anything else is a lattice/debug.h error code */
+#define ECP5_RESULT_OK		2
+
+/* request flags */
+#define ECP5_PROGRAM_ENSURE	(1 << 0)	/* skip if the image already runs */
+#define ECP5_PROGRAM_RECOVERY	(1 << 1)	/* go before bulk runs of the device */
+
+/* result flags */
+#define ECP5_RESULT_SKIPPED	(1 << 0)	/* ensure found the image running */
+#define ECP5_RESULT_CACHED	(1 << 1)	/* replayed from the transaction cache */
+#define ECP5_RESULT_SLOWED	(1 << 2)	/* repeated at a lower SPI clock */
+
+struct ecp5_program_result
+{
+	__s32 result;
+	__u32 last_data_set;
+	__u64 elapsed_ns;
+	__u64 tx_bytes;
+	__u64 rx_bytes;
+	__u64 verified_bytes;
+	__u32 flags;
+	__u32 spi_hz;		/* SPI clock the run ended at */
+};
+
+struct ecp5_program_req
+{
+	/* in */
+	__u64 algo_ptr;
+	__u64 data_ptr;
+	__u32 algo_size;
+	__u32 data_size;
+	__u32 flags;		/* ECP5_PROGRAM_* */
+	__u32 reserved;
+
+	/* out */
+	struct ecp5_program_result out;
+};
+
+/*
+ * Image slots keep validated images resident in the driver, see the
+ * slot_save/program_slot sysfs attributes.  ECP5_IOC_PROGRAM_SLOT
+ * programs the slot with the given name and blocks like ECP5_IOC_PROGRAM.
+ */
+#define ECP5_SLOT_NAME_LEN	16
+
+struct ecp5_slot_req
+{
+	/* in */
+	char name[ECP5_SLOT_NAME_LEN];
+	__u32 flags;		/* ECP5_PROGRAM_* */
+	__u32 reserved;
+
+	/* out */
+	struct ecp5_program_result out;
+};
+
+/*
+ * SPI session record, read from /sys/kernel/debug/ecp5-spiB.C/record
+ * after a run with record_enable set.  The file is a struct
+ * ecp5_record_header followed by the records, oldest first; every
+ * record is a struct ecp5_record_entry, followed by len bytes of data for
+ * ECP5_REC_TX and ECP5_REC_RX.  Entries are packed, in host byte order.
+ * If the session did not fit, the oldest records were dropped and the
+ * file starts in the middle of it.
+ */
+#define ECP5_RECORD_MAGIC	0x52355045	/* "EP5R" */
+#define ECP5_RECORD_VERSION	1
+
+#define ECP5_REC_RESET		0	/* SPI_init reset sequence ran */
+#define ECP5_REC_CS		1	/* len is 1 for select, 0 for deselect */
+#define ECP5_REC_TX		2	/* len bytes sent */
+#define ECP5_REC_RX		3	/* len bytes received */
+#define ECP5_REC_WAIT		4	/* len is the delay in ms */
+
+struct ecp5_record_header
+{
+	__u32 magic;
+	__u32 version;
+	__u32 records;
+	__u32 dropped;		/* records lost to the ring wrapping */
+};
+
+struct ecp5_record_entry
+{
+	__u64 ns;		/* since the start of the run */
+	__u32 type;		/* ECP5_REC_* */
+	__u32 len;
+};
+
+#define ECP5_IOC_MAGIC		'E'
+#define ECP5_IOC_PROGRAM	_IOWR(ECP5_IOC_MAGIC, 1, struct ecp5_program_req)
+#define ECP5_IOC_PROGRAM_SLOT	_IOWR(ECP5_IOC_MAGIC, 2, struct ecp5_slot_req)
+
+#endif
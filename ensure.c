@@ -0,0 +1,154 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "ecp5.h"
+#include "lattice/SSPIEm.h"
+#include "lattice/hardware.h"
+#include "lattice/opcode.h"
+
+/* ECP5 sysCONFIG commands and status register bits */
+#define ECP5_READ_ID		0xE0
+#define ECP5_USERCODE		0xC0
+#define ECP5_STATUS_DONE	(1 << 8)
+#define ECP5_STATUS_BUSY	(1 << 12)
+#define ECP5_STATUS_FAIL	(1 << 13)
+
+struct ecp5_expected
+{
+	unsigned char command;		/* first byte of the last TRANSOUT */
+
+	int has_idcode;
+	unsigned char idcode[4];
+	unsigned char idcode_mask[4];
+
+	int has_usercode;
+	unsigned char usercode[4];
+	unsigned char usercode_mask[4];
+};
+
+/*
+ * SSPIEm_scan() callback: the algorithm checks IDCODE and USERCODE by
+ * sending the read command as ALGODATA and comparing a 32 bit TRANSIN
+ * against ALGODATA, remember what it expects.
+ */
+static void ecp5_ensure_scan(void *context, unsigned char opcode,
+		unsigned int bits, unsigned char type,
+		unsigned char *buffer, unsigned char *mask)
+{
+	struct ecp5_expected *expected = context;
+	unsigned char *value = NULL, *value_mask = NULL;
+
+	if (opcode == TRANSOUT)
+	{
+		if (type == ALGODATA && bits >= 8)
+			expected->command = buffer[0];
+		else
+			expected->command = 0;
+		return;
+	}
+
+	if (type != ALGODATA || bits != 32)
+		return;
+
+	if (expected->command == ECP5_READ_ID && !expected->has_idcode)
+	{
+		value = expected->idcode;
+		value_mask = expected->idcode_mask;
+		expected->has_idcode = 1;
+	}
+	else if (expected->command == ECP5_USERCODE && !expected->has_usercode)
+	{
+		value = expected->usercode;
+		value_mask = expected->usercode_mask;
+		expected->has_usercode = 1;
+	}
+	else
+		return;
+
+	memcpy(value, buffer, 4);
+	if (mask)
+		memcpy(value_mask, mask, 4);
+	else
+		memset(value_mask, 0xFF, 4);
+}
+
+static int ecp5_ensure_match(const unsigned char *read,
+		const unsigned char *value, const unsigned char *mask)
+{
+	int i;
+
+	for (i = 0; i < 4; ++i)
+		if ((read[i] ^ value[i]) & mask[i])
+			return (0);
+
+	return (1);
+}
+
+/*
+ * Check whether the FPGA already runs the given image: IDCODE and
+ * USERCODE match what the image expects and configuration is DONE.
+ * The expected USERCODE comes from the algorithm or, when the algorithm
+ * does not check it, from the expected_usercode attribute.  Without an
+ * expected USERCODE the image can't be told apart and 0 is returned.
+ *
+ * Called with the engine held.  Returns 1 if programming may be
+ * skipped.
+ */
+int ecp5_ensure_check(struct ecp5 *ecp5_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size)
+{
+	struct ecp5_expected expected;
+	unsigned char idcode[4], usercode[4], status_bytes[4];
+	unsigned int status;
+	int done;
+	int ret;
+
+	memset(&expected, 0, sizeof(expected));
+	ret = SSPIEm_scanImages(algo, algo_size, data, data_size,
+			ecp5_ensure_scan, &expected);
+	if (ret != PROC_OVER)
+	{
+		pr_debug("ECP5: ensure: algorithm scan failed with code %d\n", ret);
+		return (0);
+	}
+
+	if (!expected.has_usercode && ecp5_info->has_expected_usercode)
+	{
+		expected.usercode[0] = ecp5_info->expected_usercode >> 24;
+		expected.usercode[1] = ecp5_info->expected_usercode >> 16;
+		expected.usercode[2] = ecp5_info->expected_usercode >> 8;
+		expected.usercode[3] = ecp5_info->expected_usercode;
+		memset(expected.usercode_mask, 0xFF, 4);
+		expected.has_usercode = 1;
+	}
+
+	if (!expected.has_idcode || !expected.has_usercode)
+	{
+		pr_info("ECP5: ensure: image does not define %s, programming\n",
+				expected.has_idcode ? "USERCODE" : "IDCODE");
+		return (0);
+	}
+
+	if (!SPI_readDeviceState(idcode, usercode, status_bytes, &done))
+		return (0);
+
+	status = (status_bytes[0] << 24) | (status_bytes[1] << 16) |
+			(status_bytes[2] << 8) | status_bytes[3];
+
+	pr_debug("ECP5: ensure: IDCODE %02x%02x%02x%02x USERCODE %02x%02x%02x%02x status %08x DONE %d\n",
+			idcode[0], idcode[1], idcode[2], idcode[3],
+			usercode[0], usercode[1], usercode[2], usercode[3],
+			status, done);
+
+	if (!done || !(status & ECP5_STATUS_DONE) ||
+			(status & (ECP5_STATUS_BUSY | ECP5_STATUS_FAIL)))
+		return (0);
+
+	if (!ecp5_ensure_match(idcode, expected.idcode, expected.idcode_mask) ||
+			!ecp5_ensure_match(usercode, expected.usercode,
+				expected.usercode_mask))
+		return (0);
+
+	return (1);
+}
@@ -0,0 +1,7 @@
+#ifndef _HOST_BOARD_MX6_ECP5COM_H
+#define _HOST_BOARD_MX6_ECP5COM_H
+
+/* i.MX6 GPIO numbering, as in arch/arm/plat-mxc/include/mach/gpio.h */
+#define IMX_GPIO_NR(bank, nr)	(((bank) - 1) * 32 + (nr))
+
+#endif
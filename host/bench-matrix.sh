@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Run sspi-bench against the ECP5 model over a fixed set of synthetic
+# images, one line per shape.  Each shape stresses one path of the
+# engine; compare the columns between driver versions.
+#
+#   host/bench-matrix.sh [runs] [extra sspi-bench options]
+
+set -e
+
+HOST=$(dirname "$0")
+RUNS=${1:-5}
+[ $# -gt 0 ] && shift
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+make -s -C "$HOST" sspi-bench sspi-gen
+
+printf "%-14s %10s %10s %10s %10s %s\n" \
+	shape process_ms engine_MBs model_ms violations result
+
+while read -r name args; do
+	case "$name" in ''|\#*) continue ;; esac
+
+	"$HOST/sspi-gen" $args "$TMP/a" "$TMP/d" >/dev/null
+	"$HOST/sspi-bench" -m -n "$RUNS" "$@" "$TMP/a" "$TMP/d" >"$TMP/out" || true
+
+	printf "%-14s %10s %10s %10s %10s %s\n" "$name" \
+		"$(awk '/^process:/ { print $2 }' "$TMP/out")" \
+		"$(awk '/^engine throughput:/ { print $3 }' "$TMP/out")" \
+		"$(awk '/^model time:/ { print $3 }' "$TMP/out")" \
+		"$(awk '/^model violations:/ { print $3 }' "$TMP/out")" \
+		"$(awk '/^result:/ { print $2 }' "$TMP/out")"
+done <<SHAPES
+# name		sspi-gen options
+baseline	-f 1024 -b 4096
+unrolled	-f 256 -b 4096 -l 0
+nested		-f 1 -b 4096 -l 8,L,8,16
+deep		-f 1 -b 4096 -l 4,L,4,L,4,L,2,2
+small-frames	-f 8192 -b 512
+unaligned	-f 1024 -b 4093
+rle-50		-f 1024 -b 4096 -r 50
+rle-95		-f 1024 -b 4096 -r 95
+two-sets	-f 256 -b 4096 -s 2
+many-sets	-f 256 -b 4096 -s 16 -F 2048
+verify-25	-f 1024 -b 4096 -v 25
+verify-100	-f 1024 -b 4096 -v 100
+SHAPES
@@ -0,0 +1,390 @@
+/*
+ * sspi-bench - run the lattice engine on the host against the mock SPI
+ * backend and report where the time goes.
+ *
+ * usage: sspi-bench [-n runs] [-c spi_hz] [-f fill] [-t trace] [-s] [-v]
+ *                   [-m] [-o name=value] [-P] [-R record] [-D] [-a] [-C]
+ *                   [-8] [-K] [-L bus_lock]
+ *                   algo_file [data_file]
+ *
+ *	-n	number of programming runs, default 1
+ *	-c	SPI clock for the bus time estimate, default 30000000
+ *	-m	answer like an ECP5, see ecp5_model.h
+ *	-o	set an ECP5 model parameter, e.g. -o erase_us=2000
+ *	-P	print the opcode profile of the last run, as in debugfs
+ *	-R	write the SPI record of the last run, see sspi-replay
+ *	-D	dry run: only predict bus volume and programming time at -c
+ *	-a	adaptive WAITs: poll the status after erase and program
+ *	-C	transaction cache: the first run renders, the others replay
+ *	-8	move everything as 8 bit SPI words, not bulk data as 32 bit
+ *	-K	calibrate the SPI clock first, runs start at the clock found
+ *	-L	hold the SPI bus: 1 per transaction, 2 per run, see bus_lock
+ *	-f	byte the mock answers SPI reads with, default 0xff
+ *	-t	write the SPI/GPIO/delay trace of the last run to a file
+ *	-s	really sleep on delays instead of only accounting them
+ *	-v	print engine messages
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+
+#include "lattice/SSPIEm.h"
+#include "lattice/core.h"
+#include "mock.h"
+#include "ecp5_model.h"
+#include "driver.h"
+
+static unsigned char *load_file(const char *name, unsigned int *size)
+{
+	FILE *f = fopen(name, "rb");
+	unsigned char *buf;
+	long len;
+
+	if (!f)
+	{
+		perror(name);
+		exit(1);
+	}
+
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	buf = malloc(len > 0 ? len : 1);
+	if (!buf || fread(buf, 1, len, f) != (size_t)len)
+	{
+		fprintf(stderr, "%s: can't read\n", name);
+		exit(1);
+	}
+	fclose(f);
+
+	*size = len;
+	return buf;
+}
+
+static int dry_run_report(unsigned char *algo, unsigned int algo_size,
+		unsigned char *data, unsigned int data_size, unsigned long spi_hz)
+{
+	SSPIEm_dryrunStats stats;
+	ktime_t start = ktime_get();
+	int result;
+	double bus_s;
+
+	result = SSPIEm_dryrun(algo, algo_size, data, data_size, &stats);
+	bus_s = (double)(stats.txBits + stats.rxBits) / spi_hz;
+
+	printf("result:            %d\n", result);
+	printf("dry run:           %.3f ms\n", (ktime_get() - start) / 1e6);
+	printf("tx:                %llu bits\n", stats.txBits);
+	printf("rx:                %llu bits\n", stats.rxBits);
+	printf("transactions:      %u\n", stats.transactions);
+	printf("transfers:         %u\n", stats.transfers);
+	printf("waits:             %llu ms\n", stats.waitMs);
+	printf("bus time:          %.3f ms at %lu Hz\n", bus_s * 1e3, spi_hz);
+	printf("estimate:          %.3f ms\n", bus_s * 1e3 + stats.waitMs);
+
+	return result == PROC_OVER ? 0 : 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: sspi-bench [-n runs] [-c spi_hz] [-f fill] "
+			"[-t trace] [-s] [-v] [-m] [-o name=value] [-P] [-R record] [-D] "
+			"[-a] [-C] [-8] [-K] [-L bus_lock] "
+			"algo_file [data_file]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char *algo, *data = NULL;
+	unsigned int algo_size, data_size = 0;
+	struct ecp5_model_config config;
+	struct ecp5_model *model = NULL;
+	int use_model = 0;
+	int show_profile = 0;
+	const char *record_name = NULL;
+	int dry_run = 0;
+	int adaptive_wait = 0;
+	int tx_cache = 0;
+	int bulk_words = 1;
+	int calibrate = 0;
+	int bus_lock = ECP5_BUS_LOCK_OFF;
+	int retries = 0;
+	const char *trace_name = NULL;
+	FILE *trace = NULL;
+	int runs = 1;
+	int result = 0;
+	s64 init_ns = 0, process_ns = 0, backend_ns = 0;
+	u64 tx = 0, rx = 0, delay_us = 0, tx_calls = 0, rx_calls = 0;
+	u64 spi_words = 0, messages = 0, bus_locks = 0;
+	double engine_s, bus_s;
+	int opt;
+	int i;
+
+	ecp5_model_defaults(&config);
+
+	while ((opt = getopt(argc, argv, "n:c:f:t:svmo:PR:DaC8KL:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'c':
+			config.spi_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			mock_fill = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			trace_name = optarg;
+			break;
+		case 's':
+			mock_real_sleep = 1;
+			break;
+		case 'v':
+			host_verbose++;
+			break;
+		case 'm':
+			use_model = 1;
+			break;
+		case 'P':
+			show_profile = 1;
+			break;
+		case 'a':
+			adaptive_wait = 1;
+			break;
+		case 'C':
+			tx_cache = 1;
+			break;
+		case '8':
+			bulk_words = 0;
+			break;
+		case 'K':
+			calibrate = 1;
+			break;
+		case 'L':
+			bus_lock = atoi(optarg);
+			if (bus_lock < ECP5_BUS_LOCK_OFF || bus_lock > ECP5_BUS_LOCK_RUN)
+				usage();
+			break;
+		case 'D':
+			dry_run = 1;
+			break;
+		case 'R':
+			record_name = optarg;
+			break;
+		case 'o':
+			if (ecp5_model_set(&config, optarg))
+			{
+				fprintf(stderr, "bad model parameter %s\n", optarg);
+				return 2;
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc || runs < 1 || config.spi_hz == 0)
+		usage();
+
+	algo = load_file(argv[optind], &algo_size);
+	if (optind + 1 < argc)
+		data = load_file(argv[optind + 1], &data_size);
+
+	host_driver_init();
+	host_ecp5.adaptive_wait = adaptive_wait;
+	host_ecp5.txcache.enabled = tx_cache;
+	host_ecp5.bulk_words = bulk_words;
+	host_ecp5.bus_lock = bus_lock;
+	host_ecp5.spi->max_speed_hz = config.spi_hz;
+	if (dry_run)
+		return dry_run_report(algo, algo_size, data, data_size,
+				config.spi_hz);
+	if (show_profile && host_ecp5.profile)
+		host_ecp5.profile->enabled = 1;
+	if (record_name && host_ecp5.record)
+		host_ecp5.record->enabled = 1;
+
+	if (use_model)
+	{
+		model = ecp5_model_create(&config);
+		if (!model)
+		{
+			fprintf(stderr, "can't create the ECP5 model\n");
+			return 1;
+		}
+		mock_set_backend(ecp5_model_backend(model));
+	}
+
+	if (calibrate && ecp5_clock_calibrate(&host_ecp5) < 0)
+	{
+		fprintf(stderr, "SPI clock calibration failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < runs; i++)
+	{
+		ktime_t t0, t1, t2;
+
+		if (trace_name && i == runs - 1)
+		{
+			trace = fopen(trace_name, "w");
+			if (!trace)
+			{
+				perror(trace_name);
+				return 1;
+			}
+			mock_trace(trace);
+		}
+
+		mock_reset_stats();
+		if (model)
+			ecp5_model_reset(model);
+		memset(&host_ecp5.progress, 0, sizeof(host_ecp5.progress));
+
+		ecp5_profile_start(&host_ecp5);
+		ecp5_record_start(&host_ecp5);
+		ecp5_clock_start(&host_ecp5);
+		do
+		{
+			if (!SSPIEm_preset(algo, algo_size, data, data_size))
+			{
+				fprintf(stderr, "SSPIEm_preset failed\n");
+				return 1;
+			}
+
+			t0 = ktime_get();
+			result = ecp5_txcache_run(&host_ecp5, algo, algo_size,
+					data, data_size);
+			if (result)
+			{
+				/* replayed, counts as processing */
+				t1 = t0;
+			}
+			else
+			{
+				t0 = ktime_get();
+				result = SSPIEm_init(0xFFFFFFFF);
+				t1 = ktime_get();
+				if (result > 0)
+					result = SSPIEm_process();
+			}
+			t2 = ktime_get();
+			ecp5_txcache_finish(&host_ecp5, result);
+
+			init_ns += t1 - t0;
+			process_ns += t2 - t1;
+		} while (ecp5_clock_retry(&host_ecp5, result));
+		ecp5_record_finish(&host_ecp5);
+		ecp5_profile_finish(&host_ecp5);
+		retries += atomic_read(&host_ecp5.progress.retries);
+
+		backend_ns += mock_stats.backend_ns;
+		tx += mock_stats.tx_bytes;
+		rx += mock_stats.rx_bytes;
+		tx_calls += mock_stats.tx_calls;
+		rx_calls += mock_stats.rx_calls;
+		spi_words += mock_stats.spi_words;
+		messages += mock_stats.messages;
+		bus_locks += mock_stats.bus_locks;
+		delay_us += mock_stats.delay_us;
+	}
+
+	if (trace)
+	{
+		mock_trace(NULL);
+		fclose(trace);
+	}
+
+	if (record_name)
+	{
+		FILE *f = fopen(record_name, "wb");
+
+		if (!f || host_debugfs_read(&ecp5_record_fops, f) || fclose(f))
+		{
+			perror(record_name);
+			return 1;
+		}
+	}
+
+	engine_s = (double)(init_ns + process_ns - backend_ns) / 1e9;
+	bus_s = (double)(tx + rx) * 8 / host_ecp5.spi->max_speed_hz;
+
+	printf("result:            %d\n", result);
+	printf("runs:              %d\n", runs);
+	printf("init:              %.3f ms/run\n", init_ns / 1e6 / runs);
+	printf("process:           %.3f ms/run\n", process_ns / 1e6 / runs);
+	printf("  mock backend:    %.3f ms/run\n", backend_ns / 1e6 / runs);
+	printf("  engine:          %.3f ms/run\n", engine_s * 1e3 / runs);
+	printf("tx:                %llu bytes/run in %llu calls\n",
+			(unsigned long long)(tx / runs),
+			(unsigned long long)(tx_calls / runs));
+	printf("rx:                %llu bytes/run in %llu calls\n",
+			(unsigned long long)(rx / runs),
+			(unsigned long long)(rx_calls / runs));
+	printf("spi words:         %llu/run\n",
+			(unsigned long long)(spi_words / runs));
+	printf("spi messages:      %llu/run\n",
+			(unsigned long long)(messages / runs));
+	if (bus_lock)
+		printf("bus locks:         %llu/run\n",
+				(unsigned long long)(bus_locks / runs));
+	printf("engine throughput: %.2f MB/s\n",
+			engine_s > 0 ? (tx + rx) / engine_s / 1e6 : 0.0);
+	printf("delays:            %.3f ms/run\n", delay_us / 1e3 / runs);
+	printf("bus time:          %.3f ms/run at %u Hz\n",
+			bus_s * 1e3 / runs, host_ecp5.spi->max_speed_hz);
+	printf("clock retries:     %d\n", retries);
+
+	if (show_profile && host_ecp5.profile)
+	{
+		printf("\nprofile of the last run:\n");
+		host_debugfs_show(&ecp5_profile_fops, stdout);
+		printf("\n");
+	}
+
+	if (tx_cache)
+	{
+		printf("\ntransaction cache:\n");
+		host_debugfs_show(&ecp5_txcache_fops, stdout);
+		printf("\n");
+	}
+
+	if (model)
+	{
+		const struct ecp5_model_stats *stats = ecp5_model_stats(model);
+
+		/* the last run only */
+		printf("model time:        %.3f ms\n", stats->now_us / 1e3);
+		printf("model done:        %d\n", ecp5_model_done(model));
+		printf("model commands:    %llu\n",
+				(unsigned long long)stats->commands);
+		printf("model polls:       %llu, %llu while busy\n",
+				(unsigned long long)stats->status_polls,
+				(unsigned long long)stats->busy_polls);
+		printf("model bitstream:   %llu bytes, %llu read back\n",
+				(unsigned long long)stats->burst_bytes,
+				(unsigned long long)stats->readback_bytes);
+		printf("model violations:  %llu\n",
+				(unsigned long long)stats->violations);
+
+		if (result == PROC_OVER &&
+				(!ecp5_model_done(model) || stats->violations))
+			result = 0;
+
+		mock_set_backend(NULL);
+		ecp5_model_destroy(model);
+	}
+
+	free(algo);
+	free(data);
+
+	return result == PROC_OVER ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#include <linux/kernel.h>
+#include <linux/seq_file.h>
+
+#include <../arch/arm/mach-mx6/board-mx6_ecp5com.h>
+
+#include "ecp5.h"
+#include "driver.h"
+
+/*
+ * The parts of the kernel driver lattice/hardware.c relies on: the
+ * device being programmed and the progress hooks.  The profiler, the
+ * SPI recorder and the transaction cache are the driver's own profile.c,
+ * record.c, txcache.c, arena.c and pins.c.
+ */
+
+int host_verbose;
+
+struct spi_device *current_programming_ecp5;
+
+static struct spi_master host_master;
+static struct spi_device host_spi;
+struct ecp5 host_ecp5;
+
+/* the Kondor pins, as the board file passes them to the real driver */
+static const struct ecp5_platform_data host_pins = {
+	.gpios = {
+		[ECP5_PIN_CFG0]		= IMX_GPIO_NR(1, 6),
+		[ECP5_PIN_CFG1]		= IMX_GPIO_NR(1, 7),
+		[ECP5_PIN_DONE]		= IMX_GPIO_NR(1, 8),
+		[ECP5_PIN_INITN]	= IMX_GPIO_NR(1, 9),
+		[ECP5_PIN_PROGRAMN]	= IMX_GPIO_NR(7, 11),
+		[ECP5_PIN_CS]		= IMX_GPIO_NR(5, 12),
+	},
+};
+
+void host_driver_init(void)
+{
+	host_spi.master = &host_master;
+	host_spi.max_speed_hz = 30000000;
+	host_spi.bits_per_word = 8;
+	host_ecp5.has_bulk_words = 1;
+	host_ecp5.bulk_words = 1;
+	spi_set_drvdata(&host_spi, &host_ecp5);
+	host_ecp5.spi = &host_spi;
+	current_programming_ecp5 = &host_spi;
+	host_ecp5.profile = ecp5_profile_alloc();
+	host_ecp5.record = ecp5_record_alloc();
+	ecp5_txcache_init(&host_ecp5);
+	if (ecp5_arena_init(&host_ecp5.arena))
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	if (ecp5_pins_request(&host_ecp5, &host_pins))
+	{
+		fprintf(stderr, "can't request the GPIOs\n");
+		exit(1);
+	}
+}
+
+/* print what the debugfs file would show */
+void host_debugfs_show(const struct file_operations *fops, FILE *stream)
+{
+	struct inode inode = { .i_private = &host_ecp5 };
+	struct file file = { .stream = stream };
+
+	fops->open(&inode, &file);
+}
+
+/* copy a binary debugfs file of the driver to stream */
+int host_debugfs_read(const struct file_operations *fops, FILE *stream)
+{
+	struct inode inode = { .i_private = &host_ecp5 };
+	struct file file = { .stream = stream };
+	char buf[4096];
+	loff_t pos = 0;
+	ssize_t n;
+	int res;
+
+	res = fops->open(&inode, &file);
+	if (res)
+		return res;
+
+	while ((n = fops->read(&file, buf, sizeof(buf), &pos)) > 0)
+		fwrite(buf, 1, n, stream);
+
+	fops->release(&inode, &file);
+	return n < 0 ? n : 0;
+}
+
+ssize_t simple_read_from_buffer(void *to, size_t count, loff_t *ppos,
+		const void *from, size_t available)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= available || !count)
+		return 0;
+	if (count > available - pos)
+		count = available - pos;
+
+	memcpy(to, (const char *)from + pos, count);
+	*ppos = pos + count;
+	return count;
+}
+
+loff_t default_llseek(struct file *file, loff_t offset, int whence)
+{
+	return 0;
+}
+
+ssize_t seq_read(struct file *file, char *buf, size_t size, loff_t *ppos)
+{
+	return 0;
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence)
+{
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	return 0;
+}
+
+u32 crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--)
+	{
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+	}
+	return crc;
+}
+
+void ecp5_progress_tx(struct ecp5_progress *progress, int n_bytes)
+{
+	atomic_long_add(n_bytes, &progress->tx_bytes);
+}
+
+void ecp5_progress_rx(struct ecp5_progress *progress, int n_bytes)
+{
+	atomic_long_add(n_bytes, &progress->rx_bytes);
+}
+
+void ecp5_progress_verified(struct ecp5_progress *progress, int n_bytes)
+{
+	atomic_long_add(n_bytes, &progress->verified_bytes);
+}
+
+void ecp5_progress_data_set(struct ecp5_progress *progress, int data_set)
+{
+	atomic_set(&progress->data_set, data_set);
+}
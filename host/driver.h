@@ -0,0 +1,17 @@
+#ifndef _HOST_DRIVER_H_
+#define _HOST_DRIVER_H_
+
+#include "ecp5.h"
+
+extern struct ecp5 host_ecp5;
+
+/* set up the fake SPI device lattice/hardware.c programs */
+void host_driver_init(void);
+
+/* print a debugfs file of the driver */
+void host_debugfs_show(const struct file_operations *fops, FILE *stream);
+
+/* copy a binary debugfs file of the driver, returns 0 or -errno */
+int host_debugfs_read(const struct file_operations *fops, FILE *stream);
+
+#endif
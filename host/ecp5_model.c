@@ -0,0 +1,567 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#include <stdarg.h>
+
+#include <../arch/arm/mach-mx6/board-mx6_ecp5com.h>
+
+#include "ecp5_model.h"
+
+/* the pins lattice/hardware.c drives */
+#define MODEL_CFG0		IMX_GPIO_NR(1, 6)
+#define MODEL_CFG1		IMX_GPIO_NR(1, 7)
+#define MODEL_DONE		IMX_GPIO_NR(1, 8)
+#define MODEL_INITN		IMX_GPIO_NR(1, 9)
+#define MODEL_PROGRAMN		IMX_GPIO_NR(7, 11)
+#define MODEL_CS		IMX_GPIO_NR(5, 12)
+
+/* sysCONFIG commands */
+#define ISC_NOOP		0xFF
+#define READ_ID			0xE0
+#define USERCODE		0xC0
+#define LSC_READ_STATUS		0x3C
+#define LSC_CHECK_BUSY		0xF0
+#define LSC_REFRESH		0x79
+#define ISC_ENABLE		0xC6
+#define ISC_ENABLE_X		0x74
+#define ISC_DISABLE		0x26
+#define ISC_ERASE		0x0E
+#define LSC_RESET_CRC		0x3B
+#define LSC_INIT_ADDRESS	0x46
+#define LSC_BITSTREAM_BURST	0x7A
+#define LSC_READ_INCR_NV	0x73
+#define ISC_PROGRAM_USERCODE	0xC2
+#define ISC_PROGRAM_DONE	0x5E
+
+/* status register */
+#define STATUS_DONE		(1 << 8)
+#define STATUS_ISC		(1 << 9)
+#define STATUS_BUSY		(1 << 12)
+#define STATUS_FAIL		(1 << 13)
+
+#define MODEL_NEVER		(~0ULL)
+#define MODEL_MAX_REPORTS	10
+
+struct ecp5_model
+{
+	struct ecp5_model_config config;
+	struct ecp5_model_stats stats;
+	struct mock_backend backend;
+
+	unsigned long spi_hz;	/* current clock */
+	u8 last_rx;		/* last byte read, shifted in late */
+
+	/* pin levels driven by the host, -1 while not driven */
+	int cfg0;
+	int cfg1;
+	int programn;
+	int cs;
+
+	u64 initn_at;		/* INITN goes high */
+	u64 busy_until;
+	u64 done_at;		/* DONE goes high, MODEL_NEVER if not */
+	int isc;
+	int fail;
+	u32 usercode;
+
+	/* current frame */
+	u8 cmd[4];
+	int cmd_len;
+	u8 resp[4];
+	int resp_len;
+	int resp_pos;
+	u8 payload[4];
+	int payload_len;
+	int burst;
+
+	/* last bitstream, read back by LSC_READ_INCR_NV */
+	u8 *bitstream;
+	size_t bitstream_len;
+	size_t bitstream_size;
+	size_t read_pos;
+	int burst_seen;
+};
+
+static void model_violation(struct ecp5_model *model, const char *fmt, ...)
+{
+	va_list args;
+
+	if (model->stats.violations++ >= MODEL_MAX_REPORTS)
+		return;
+
+	fprintf(stderr, "ecp5 model: %llu us: ",
+			(unsigned long long)model->stats.now_us);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+static int model_busy(struct ecp5_model *model)
+{
+	return model->stats.now_us < model->busy_until;
+}
+
+static int model_is_done(struct ecp5_model *model)
+{
+	return model->done_at != MODEL_NEVER &&
+		model->stats.now_us >= model->done_at;
+}
+
+static int model_initn(struct ecp5_model *model)
+{
+	return model->programn != 0 && model->stats.now_us >= model->initn_at &&
+		!model->fail;
+}
+
+static u32 model_status(struct ecp5_model *model)
+{
+	u32 status = 0;
+
+	if (model_is_done(model))
+		status |= STATUS_DONE;
+	if (model->isc)
+		status |= STATUS_ISC;
+	if (model_busy(model))
+		status |= STATUS_BUSY;
+	if (model->fail)
+		status |= STATUS_FAIL;
+
+	return status;
+}
+
+static void model_respond(struct ecp5_model *model, u32 value, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		model->resp[i] = value >> ((len - 1 - i) * 8);
+	model->resp_len = len;
+	model->resp_pos = 0;
+}
+
+/* what PROGRAMN low and LSC_REFRESH do */
+static void model_clear_config(struct ecp5_model *model)
+{
+	model->isc = 0;
+	model->fail = 0;
+	model->burst = 0;
+	model->busy_until = 0;
+	model->done_at = MODEL_NEVER;
+}
+
+static int model_need_isc(struct ecp5_model *model, u8 opcode)
+{
+	if (model->isc)
+		return 1;
+
+	model_violation(model, "command 0x%02x outside ISC_ENABLE", opcode);
+	return 0;
+}
+
+static void model_command(struct ecp5_model *model)
+{
+	u8 opcode = model->cmd[0];
+
+	if (opcode == ISC_NOOP)
+		return;
+
+	model->stats.commands++;
+
+	if (model_busy(model) && opcode != LSC_READ_STATUS &&
+			opcode != LSC_CHECK_BUSY)
+		model_violation(model, "command 0x%02x while busy", opcode);
+
+	switch (opcode)
+	{
+	case READ_ID:
+		model_respond(model, model->config.idcode, 4);
+		break;
+	case USERCODE:
+		model_respond(model, model->usercode, 4);
+		break;
+	case LSC_READ_STATUS:
+	case LSC_CHECK_BUSY:
+		model->stats.status_polls++;
+		if (model_busy(model))
+			model->stats.busy_polls++;
+		if (opcode == LSC_READ_STATUS)
+			model_respond(model, model_status(model), 4);
+		else
+			model_respond(model, model_busy(model) ? 0x80 : 0x00, 1);
+		break;
+	case ISC_ENABLE:
+	case ISC_ENABLE_X:
+		model->isc = 1;
+		break;
+	case ISC_DISABLE:
+		model->isc = 0;
+		break;
+	case ISC_ERASE:
+		if (!model_need_isc(model, opcode))
+			break;
+		model->busy_until = model->stats.now_us + model->config.erase_us;
+		model->done_at = MODEL_NEVER;
+		model->bitstream_len = 0;
+		model->burst_seen = 0;
+		break;
+	case LSC_RESET_CRC:
+		break;
+	case LSC_INIT_ADDRESS:
+		model->read_pos = 0;
+		break;
+	case LSC_BITSTREAM_BURST:
+		if (!model_need_isc(model, opcode))
+			break;
+		model->burst = 1;
+		model->burst_seen = 1;
+		model->bitstream_len = 0;
+		break;
+	case LSC_READ_INCR_NV:
+	case ISC_PROGRAM_USERCODE:
+		model_need_isc(model, opcode);
+		break;
+	case ISC_PROGRAM_DONE:
+		if (!model_need_isc(model, opcode))
+			break;
+		if (!model->burst_seen || !model->bitstream_len)
+		{
+			model_violation(model, "ISC_PROGRAM_DONE without bitstream");
+			model->fail = 1;
+			break;
+		}
+		model->done_at = model->stats.now_us + model->config.done_us;
+		break;
+	case LSC_REFRESH:
+		model_clear_config(model);
+		model->initn_at = model->stats.now_us + model->config.initn_us;
+		break;
+	default:
+		model_violation(model, "unknown command 0x%02x", opcode);
+		break;
+	}
+}
+
+static void model_burst_byte(struct ecp5_model *model, u8 byte)
+{
+	if (model->bitstream_len == model->bitstream_size)
+	{
+		size_t size = model->bitstream_size ? model->bitstream_size * 2 : 65536;
+		u8 *bitstream = krealloc(model->bitstream, size, GFP_KERNEL);
+
+		if (!bitstream)
+		{
+			model_violation(model, "out of memory for the bitstream");
+			model->burst = 0;
+			return;
+		}
+		model->bitstream = bitstream;
+		model->bitstream_size = size;
+	}
+
+	model->bitstream[model->bitstream_len++] = byte;
+	model->stats.burst_bytes++;
+}
+
+static void model_tx_byte(struct ecp5_model *model, u8 byte)
+{
+	if (model->cmd_len < 4)
+	{
+		model->cmd[model->cmd_len++] = byte;
+		if (model->cmd_len == 4)
+			model_command(model);
+	}
+	else if (model->burst)
+		model_burst_byte(model, byte);
+	else if (model->cmd[0] == ISC_PROGRAM_USERCODE && model->payload_len < 4)
+		model->payload[model->payload_len++] = byte;
+}
+
+static u8 model_rx_byte(struct ecp5_model *model)
+{
+	if (model->cmd_len < 4)
+	{
+		model_violation(model, "read after %d command bytes",
+				model->cmd_len);
+		return 0xFF;
+	}
+
+	if (model->cmd[0] == LSC_READ_INCR_NV)
+	{
+		model->stats.readback_bytes++;
+		if (model->read_pos < model->bitstream_len)
+			return model->bitstream[model->read_pos++];
+		return 0xFF;
+	}
+
+	if (model->resp_pos < model->resp_len)
+		return model->resp[model->resp_pos++];
+
+	return 0xFF;
+}
+
+static void model_frame_start(struct ecp5_model *model)
+{
+	model->cmd_len = 0;
+	model->resp_len = 0;
+	model->resp_pos = 0;
+	model->payload_len = 0;
+	model->burst = 0;
+}
+
+static void model_frame_end(struct ecp5_model *model)
+{
+	if (model->cmd_len > 0 && model->cmd_len < 4 && model->cmd[0] != ISC_NOOP)
+		model_violation(model, "frame ended after %d command bytes",
+				model->cmd_len);
+
+	if (model->cmd_len == 4 && model->cmd[0] == ISC_PROGRAM_USERCODE &&
+			model->isc)
+	{
+		if (model->payload_len == 4)
+			model->usercode = (u32)model->payload[0] << 24 |
+				model->payload[1] << 16 | model->payload[2] << 8 |
+				model->payload[3];
+		else
+			model_violation(model, "ISC_PROGRAM_USERCODE with %d bytes",
+					model->payload_len);
+	}
+
+	model->burst = 0;
+}
+
+static void model_transfer(void *priv, const u8 *tx, u8 *rx, size_t len)
+{
+	struct ecp5_model *model = priv;
+	size_t i;
+
+	model->stats.now_us += model->config.xfer_us +
+		(u64)len * 8 * 1000000 / model->spi_hz;
+
+	if (model->cfg0 != 1 || model->cfg1 != 0 || model->cs != 0 ||
+			!model_initn(model))
+	{
+		model_violation(model, "%zu byte %s with cfg %d%d cs %d initn %d",
+				len, tx ? "write" : "read", model->cfg0,
+				model->cfg1, model->cs, model_initn(model));
+		if (rx)
+			memset(rx, 0xFF, len);
+		return;
+	}
+
+	for (i = 0; i < len; i++)
+	{
+		if (tx)
+			model_tx_byte(model, tx[i]);
+		else
+			rx[i] = model_rx_byte(model);
+	}
+
+	if (rx && model->config.max_hz && model->spi_hz > model->config.max_hz)
+	{
+		for (i = 0; i < len; i++)
+		{
+			u8 byte = rx[i];
+
+			rx[i] = model->last_rx << 7 | byte >> 1;
+			model->last_rx = byte;
+		}
+	}
+}
+
+static void model_gpio_set(void *priv, unsigned gpio, int value)
+{
+	struct ecp5_model *model = priv;
+
+	switch (gpio)
+	{
+	case MODEL_CFG0:
+		model->cfg0 = value;
+		break;
+	case MODEL_CFG1:
+		model->cfg1 = value;
+		break;
+	case MODEL_PROGRAMN:
+		if (!value)
+		{
+			model_clear_config(model);
+			model->initn_at = MODEL_NEVER;
+		}
+		else if (model->programn == 0)
+			model->initn_at = model->stats.now_us +
+				model->config.initn_us;
+		model->programn = value;
+		break;
+	case MODEL_CS:
+		if (model->cs != 0 && !value)
+			model_frame_start(model);
+		else if (model->cs == 0 && value)
+			model_frame_end(model);
+		model->cs = value;
+		break;
+	case MODEL_DONE:
+	case MODEL_INITN:
+		model_violation(model, "host drives FPGA output %u", gpio);
+		break;
+	}
+}
+
+static int model_gpio_get(void *priv, unsigned gpio)
+{
+	struct ecp5_model *model = priv;
+
+	switch (gpio)
+	{
+	case MODEL_CFG0:
+		return model->cfg0 > 0;
+	case MODEL_CFG1:
+		return model->cfg1 > 0;
+	case MODEL_PROGRAMN:
+		return model->programn > 0;
+	case MODEL_CS:
+		return model->cs > 0;
+	case MODEL_DONE:
+		return model_is_done(model);
+	case MODEL_INITN:
+		return model_initn(model);
+	}
+
+	return 0;
+}
+
+static void model_delay(void *priv, unsigned long usecs)
+{
+	struct ecp5_model *model = priv;
+
+	model->stats.now_us += usecs;
+}
+
+static void model_set_clock(void *priv, unsigned long hz)
+{
+	struct ecp5_model *model = priv;
+
+	if (hz)
+		model->spi_hz = hz;
+}
+
+void ecp5_model_defaults(struct ecp5_model_config *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->idcode = 0x41111043;	/* LFE5U-25 */
+	config->usercode = 0xFFFFFFFF;
+	config->spi_hz = 30000000;
+	config->initn_us = 5000;
+	config->erase_us = 1000;
+	config->done_us = 100;
+	config->xfer_us = 0;
+}
+
+int ecp5_model_set(struct ecp5_model_config *config, const char *option)
+{
+	static const struct
+	{
+		const char *name;
+		size_t offset;
+		int is_u32;
+	} options[] = {
+		{ "idcode", offsetof(struct ecp5_model_config, idcode), 1 },
+		{ "usercode", offsetof(struct ecp5_model_config, usercode), 1 },
+		{ "spi_hz", offsetof(struct ecp5_model_config, spi_hz), 0 },
+		{ "max_hz", offsetof(struct ecp5_model_config, max_hz), 0 },
+		{ "initn_us", offsetof(struct ecp5_model_config, initn_us), 0 },
+		{ "erase_us", offsetof(struct ecp5_model_config, erase_us), 0 },
+		{ "done_us", offsetof(struct ecp5_model_config, done_us), 0 },
+		{ "xfer_us", offsetof(struct ecp5_model_config, xfer_us), 0 },
+	};
+	const char *value = strchr(option, '=');
+	unsigned long number;
+	char *end;
+	size_t i;
+
+	if (!value)
+		return -EINVAL;
+
+	number = strtoul(value + 1, &end, 0);
+	if (end == value + 1 || *end)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(options); i++)
+	{
+		if (strlen(options[i].name) != (size_t)(value - option) ||
+				strncmp(options[i].name, option, value - option))
+			continue;
+
+		if (options[i].is_u32)
+			*(u32 *)((char *)config + options[i].offset) = number;
+		else
+			*(unsigned long *)((char *)config + options[i].offset) = number;
+
+		return config->spi_hz ? 0 : -EINVAL;
+	}
+
+	return -EINVAL;
+}
+
+struct ecp5_model *ecp5_model_create(const struct ecp5_model_config *config)
+{
+	struct ecp5_model *model = kzalloc(sizeof(*model), GFP_KERNEL);
+
+	if (!model)
+		return NULL;
+
+	model->config = *config;
+	model->backend.name = "ecp5";
+	model->backend.priv = model;
+	model->backend.transfer = model_transfer;
+	model->backend.gpio_set = model_gpio_set;
+	model->backend.gpio_get = model_gpio_get;
+	model->backend.delay = model_delay;
+	model->backend.set_clock = model_set_clock;
+	model->spi_hz = config->spi_hz;
+
+	ecp5_model_reset(model);
+
+	return model;
+}
+
+void ecp5_model_destroy(struct ecp5_model *model)
+{
+	if (!model)
+		return;
+
+	kfree(model->bitstream);
+	kfree(model);
+}
+
+void ecp5_model_reset(struct ecp5_model *model)
+{
+	memset(&model->stats, 0, sizeof(model->stats));
+
+	model->cfg0 = -1;
+	model->cfg1 = -1;
+	model->programn = 1;
+	model->cs = 1;
+	model->initn_at = 0;
+	model->usercode = model->config.usercode;
+	model_clear_config(model);
+	model_frame_start(model);
+
+	model->bitstream_len = 0;
+	model->read_pos = 0;
+	model->burst_seen = 0;
+}
+
+const struct mock_backend *ecp5_model_backend(struct ecp5_model *model)
+{
+	return &model->backend;
+}
+
+const struct ecp5_model_stats *ecp5_model_stats(struct ecp5_model *model)
+{
+	return &model->stats;
+}
+
+int ecp5_model_done(struct ecp5_model *model)
+{
+	return model_is_done(model);
+}
@@ -0,0 +1,69 @@
+#ifndef _HOST_ECP5_MODEL_H_
+#define _HOST_ECP5_MODEL_H_
+
+/*
+ * Software model of an ECP5 in slave SPI configuration mode, as a mock
+ * backend for the host build.
+ *
+ * It follows the Kondor wiring used by lattice/hardware.c: CFG0/CFG1
+ * select slave SPI, PROGRAMN resets the device, INITN and DONE are read
+ * back, CS0 frames every command.  Each command is an 8 bit opcode and a
+ * 24 bit operand; the model answers READ_ID, USERCODE, LSC_READ_STATUS
+ * and LSC_CHECK_BUSY, takes the bitstream after LSC_BITSTREAM_BURST and
+ * raises DONE on ISC_PROGRAM_DONE.  LSC_READ_INCR_NV reads the last
+ * bitstream back from LSC_INIT_ADDRESS on, so images can verify data.
+ *
+ * Time is virtual: delays the engine asks for, SPI transfer time at
+ * spi_hz and a fixed per transfer overhead advance the model clock, and
+ * the latencies below are measured against it.  Anything the real
+ * device would not accept is counted as a violation.
+ *
+ * spi_setup() changes spi_hz.  Above max_hz the board is too slow for
+ * the clock: the host samples every byte read one bit late.
+ */
+
+#include <linux/types.h>
+
+#include "mock.h"
+
+struct ecp5_model_config
+{
+	u32 idcode;
+	u32 usercode;
+	unsigned long spi_hz;
+	unsigned long max_hz;		/* reads are corrupted above, 0 for none */
+
+	unsigned long initn_us;		/* PROGRAMN high to INITN high */
+	unsigned long erase_us;		/* ISC_ERASE busy time */
+	unsigned long done_us;		/* ISC_PROGRAM_DONE to DONE high */
+	unsigned long xfer_us;		/* controller overhead per transfer */
+};
+
+struct ecp5_model_stats
+{
+	u64 now_us;			/* virtual time */
+	u64 commands;
+	u64 status_polls;
+	u64 busy_polls;			/* status reads while busy */
+	u64 burst_bytes;
+	u64 readback_bytes;
+	u64 violations;
+};
+
+struct ecp5_model;
+
+struct ecp5_model *ecp5_model_create(const struct ecp5_model_config *config);
+void ecp5_model_destroy(struct ecp5_model *model);
+
+/* power-on state, keeps the configuration */
+void ecp5_model_reset(struct ecp5_model *model);
+
+const struct mock_backend *ecp5_model_backend(struct ecp5_model *model);
+const struct ecp5_model_stats *ecp5_model_stats(struct ecp5_model *model);
+int ecp5_model_done(struct ecp5_model *model);
+
+/* apply "name=value", see ecp5_model_config, returns 0 or -EINVAL */
+int ecp5_model_set(struct ecp5_model_config *config, const char *option);
+void ecp5_model_defaults(struct ecp5_model_config *config);
+
+#endif
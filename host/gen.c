@@ -0,0 +1,722 @@
+/*
+ * sspi-gen - write synthetic SSPI algorithm and data images.
+ *
+ * usage: sspi-gen [options] algo_file data_file
+ *
+ *	-f frames	bitstream frames, default 256
+ *	-b bits		bits per frame, default 4096, need not be a multiple of 8
+ *	-l levels	comma separated nesting around the frames, outermost
+ *			first: a number is a REPEAT of that many iterations,
+ *			L or Ln a LOOP (max n) that succeeds on its first pass.
+ *			The first level must be a REPEAT.  The frame count is
+ *			the product of the REPEATs.  0 writes the frames
+ *			unrolled.  Default: one REPEAT of all frames.
+ *	-s sets		data sets in the table of content, 1..16, default 1.
+ *			With 2 or more, frames alternate between data set
+ *			0x27 (PROGDATAEH) and 0x04 (PROGDATA); the others
+ *			are filler the engine has to seek over.  These are
+ *			stored uncompressed: HLDataGetByte() can't resume a
+ *			compressed data set after switching away from it.
+ *	-F bytes	size of each filler data set, default 1024
+ *	-r percent	share of frame bytes in runs of 0xff, default 0
+ *	-u		store the data uncompressed even if it has runs
+ *	-v percent	share of frames read back and compared, default 0
+ *	-p polls	max status polls after erase and program, default 10
+ *	-w ms		fixed WAIT after erase and program before the status
+ *			poll, as vendor algorithms pad them, default 0
+ *	-i idcode	IDCODE the algorithm checks, default 0x41111043
+ *	-S seed		random seed, default 1
+ *
+ * The algorithm drives the command sequence host/ecp5_model.c accepts:
+ * READ_ID check, ISC_ENABLE, ISC_ERASE, busy poll, LSC_INIT_ADDRESS,
+ * LSC_BITSTREAM_BURST with the frames, ISC_PROGRAM_DONE, DONE poll,
+ * then LSC_INIT_ADDRESS and LSC_READ_INCR_NV for the verified frames,
+ * and ISC_DISABLE.  Read back is only meaningful for byte aligned
+ * frames, the engine pads unaligned frames at the start on the way out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lattice/opcode.h"
+
+/* limits of lattice/core.c and lattice/hardware.c */
+#define GEN_MAX_FRAME_BITS	(65536 * 8)	/* MAXFRAME */
+#define GEN_D_TOC_NUMBER	16	/* D_TOC_NUMBER */
+#define GEN_MAX_LEVELS		32	/* the engine does not limit nesting */
+
+#define GEN_SET_EH		0x27	/* what PROGDATAEH reads */
+#define GEN_SET_PROG		0x04	/* what PROGDATA reads */
+#define GEN_SET_FILLER		0x30
+
+#define GEN_DATA_BEGIN0		0xB0
+#define GEN_DATA_BEGIN1		0xB1
+#define GEN_DATA_END0		0xB9
+#define GEN_DATA_END1		0xB2
+
+#define GEN_RLE_NONE		0x00
+#define GEN_RLE_FF		0x01
+#define GEN_MAX_RUN		255
+
+/* sysCONFIG */
+#define READ_ID			0xE0
+#define LSC_READ_STATUS		0x3C
+#define ISC_ENABLE		0xC6
+#define ISC_DISABLE		0x26
+#define ISC_ERASE		0x0E
+#define LSC_INIT_ADDRESS	0x46
+#define LSC_BITSTREAM_BURST	0x7A
+#define LSC_READ_INCR_NV	0x73
+#define ISC_PROGRAM_DONE	0x5E
+
+struct gen_buf
+{
+	unsigned char *data;
+	size_t len;
+	size_t size;
+};
+
+struct gen_level
+{
+	int loop;
+	unsigned int count;
+};
+
+struct gen
+{
+	unsigned int frames;
+	unsigned int bits;
+	struct gen_level levels[GEN_MAX_LEVELS];
+	int nr_levels;			/* 0: unrolled */
+	int sets;
+	unsigned int filler;
+	int rle;
+	int compress;
+	int verify;
+	unsigned int polls;
+	unsigned int wait_ms;
+	unsigned int idcode;
+	unsigned int seed;
+
+	int interleave;			/* frames per innermost body, 1 or 2 */
+	unsigned int iterations;	/* innermost bodies */
+	unsigned int max_body;
+	int max_depth;
+
+	unsigned long long raw_bytes;
+	unsigned long long stored_bytes;
+};
+
+static void gen_fail(const char *msg)
+{
+	fprintf(stderr, "sspi-gen: %s\n", msg);
+	exit(1);
+}
+
+static void put(struct gen_buf *buf, unsigned char byte)
+{
+	if (buf->len == buf->size)
+	{
+		buf->size = buf->size ? buf->size * 2 : 4096;
+		buf->data = realloc(buf->data, buf->size);
+		if (!buf->data)
+			gen_fail("out of memory");
+	}
+	buf->data[buf->len++] = byte;
+}
+
+static void put_bytes(struct gen_buf *buf, const unsigned char *bytes, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		put(buf, bytes[i]);
+}
+
+/* VME_getNumber() encoding */
+static void put_number(struct gen_buf *buf, unsigned int number)
+{
+	do
+	{
+		unsigned char byte = number & 0x7F;
+
+		number >>= 7;
+		put(buf, number ? byte | 0x80 : byte);
+	} while (number);
+}
+
+static void put_comment(struct gen_buf *buf, const char *text)
+{
+	put(buf, HCOMMENT);
+	put_bytes(buf, (const unsigned char *)text, strlen(text));
+	put(buf, HENDCOMMENT);
+}
+
+/* xorshift32, so images are the same on every host */
+static unsigned int gen_random(struct gen *gen)
+{
+	gen->seed ^= gen->seed << 13;
+	gen->seed ^= gen->seed >> 17;
+	gen->seed ^= gen->seed << 5;
+	return gen->seed;
+}
+
+/* one 32 bit command, optionally followed by a masked 32 bit compare */
+static void put_command(struct gen_buf *algo, unsigned char command,
+		unsigned char operand, const unsigned char *expect,
+		const unsigned char *mask)
+{
+	unsigned char cmd[4] = {command, operand, 0x00, 0x00};
+
+	put(algo, STARTTRAN);
+	put(algo, TRANSOUT);
+	put_number(algo, 32);
+	put(algo, ALGODATA);
+	put_bytes(algo, cmd, 4);
+	if (expect)
+	{
+		put(algo, TRANSIN);
+		put_number(algo, 32);
+		if (mask)
+		{
+			put(algo, MASK);
+			put_bytes(algo, mask, 4);
+		}
+		put(algo, ALGODATA);
+		put_bytes(algo, expect, 4);
+	}
+	put(algo, ENDTRAN);
+}
+
+/* the fixed delay after a busy command, if any */
+static void put_wait(struct gen *gen, struct gen_buf *algo)
+{
+	if (!gen->wait_ms)
+		return;
+
+	put(algo, WAIT);
+	put_number(algo, gen->wait_ms);
+}
+
+/* LOOP with a 1 ms wait in front of a status compare */
+static void put_status_poll(struct gen *gen, struct gen_buf *algo,
+		const unsigned char *expect, const unsigned char *mask)
+{
+	size_t start;
+
+	put(algo, LOOP);
+	put_number(algo, gen->polls);
+	start = algo->len;
+	put(algo, WAIT);
+	put_number(algo, 1);
+	put_command(algo, LSC_READ_STATUS, 0x00, expect, mask);
+	if (algo->len - start > gen->max_body)
+		gen->max_body = algo->len - start;
+	put(algo, ENDLOOP);
+}
+
+/*
+ * The frames of one burst or read back pass: the nesting levels around
+ * a body that moves one frame of each used data set.
+ */
+static void put_frames(struct gen *gen, struct gen_buf *algo, int in,
+		unsigned int iterations)
+{
+	unsigned char eh = PROGDATAEH, prog = PROGDATA;
+	unsigned int i;
+	int level;
+	size_t start[GEN_MAX_LEVELS];
+
+	if (!gen->nr_levels)
+	{
+		for (i = 0; i < iterations; i++)
+		{
+			put(algo, in ? TRANSIN : TRANSOUT);
+			put_number(algo, gen->bits);
+			put(algo, eh);
+			if (gen->interleave == 2)
+				put(algo, prog);
+		}
+		return;
+	}
+
+	for (level = 0; level < gen->nr_levels; level++)
+	{
+		unsigned int count = gen->levels[level].count;
+
+		/* read back fewer frames by cutting the outermost REPEAT */
+		if (level == 0)
+			count = iterations / (gen->iterations / count);
+
+		put(algo, gen->levels[level].loop ? LOOP : REPEAT);
+		put_number(algo, count);
+		start[level] = algo->len;
+	}
+
+	put(algo, in ? TRANSIN : TRANSOUT);
+	put_number(algo, gen->bits);
+	put(algo, eh);
+	if (gen->interleave == 2)
+		put(algo, prog);
+	/* ends the buffered proc_TRANS() without touching the hardware */
+	put(algo, RUNCLOCK);
+
+	for (level = gen->nr_levels - 1; level >= 0; level--)
+	{
+		if (algo->len - start[level] > gen->max_body)
+			gen->max_body = algo->len - start[level];
+		put(algo, gen->levels[level].loop ? ENDLOOP : ENDREPEAT);
+	}
+}
+
+static void put_algo_body(struct gen *gen, struct gen_buf *algo)
+{
+	static const unsigned char zero[4] = {0x00, 0x00, 0x00, 0x00};
+	static const unsigned char busy_mask[4] = {0x00, 0x00, 0x10, 0x00};
+	static const unsigned char done[4] = {0x00, 0x00, 0x01, 0x00};
+	unsigned char idcode[4] = {
+		gen->idcode >> 24, gen->idcode >> 16, gen->idcode >> 8, gen->idcode
+	};
+	unsigned int verified;
+
+	put_command(algo, READ_ID, 0x00, idcode, NULL);
+	put_command(algo, ISC_ENABLE, 0x00, NULL, NULL);
+	put_command(algo, ISC_ERASE, 0x01, NULL, NULL);
+	put_wait(gen, algo);
+	put_status_poll(gen, algo, zero, busy_mask);
+	put_command(algo, LSC_INIT_ADDRESS, 0x00, NULL, NULL);
+
+	put(algo, STARTTRAN);
+	put(algo, TRANSOUT);
+	put_number(algo, 32);
+	put(algo, ALGODATA);
+	put(algo, LSC_BITSTREAM_BURST);
+	put(algo, 0x00);
+	put(algo, 0x00);
+	put(algo, 0x00);
+	put_frames(gen, algo, 0, gen->iterations);
+	put(algo, ENDTRAN);
+
+	put_command(algo, ISC_PROGRAM_DONE, 0x00, NULL, NULL);
+	put_wait(gen, algo);
+	put_status_poll(gen, algo, done, done);
+
+	/* whole outermost iterations only */
+	verified = (unsigned long long)gen->iterations * gen->verify / 100;
+	if (gen->nr_levels)
+	{
+		unsigned int inner = gen->iterations / gen->levels[0].count;
+
+		verified = (verified + inner - 1) / inner * inner;
+	}
+	if (verified)
+	{
+		put(algo, RESETDATA);
+		put_command(algo, LSC_INIT_ADDRESS, 0x00, NULL, NULL);
+		put(algo, STARTTRAN);
+		put(algo, TRANSOUT);
+		put_number(algo, 32);
+		put(algo, ALGODATA);
+		put(algo, LSC_READ_INCR_NV);
+		put(algo, 0x00);
+		put(algo, 0x00);
+		put(algo, 0x00);
+		put_frames(gen, algo, 1, verified);
+		put(algo, ENDTRAN);
+	}
+
+	put_command(algo, ISC_DISABLE, 0x00, NULL, NULL);
+	put(algo, ENDOFALGO);
+}
+
+static void put_algo(struct gen *gen, struct gen_buf *algo, const char *comment)
+{
+	struct gen_buf body = {0};
+	unsigned int checksum = 0;
+	size_t i;
+
+	put_algo_body(gen, &body);
+
+	put_comment(algo, comment);
+	put(algo, ALGOID);
+	put_bytes(algo, (const unsigned char *)"\0\0\0\0", 4);
+	put(algo, VERSION);
+	put(algo, 4);
+	put(algo, 0);
+	put(algo, 0);
+	/* one byte, the engine measures larger bodies itself */
+	put(algo, BUFFERREQ);
+	put(algo, gen->max_body > 255 ? 255 : gen->max_body);
+	put(algo, STACKREQ);
+	put(algo, gen->max_depth > 0 ? gen->max_depth - 1 : 0);
+	put(algo, MASKBUFREQ);
+	put(algo, 4);
+	put(algo, HCHANNEL);
+	put(algo, 0);
+	put(algo, COMPRESSION);
+	put(algo, gen->compress);
+
+	for (i = 0; i < algo->len; i++)
+		checksum += algo->data[i];
+	put(algo, HEADERCRC);
+	put(algo, checksum >> 8);
+	put(algo, checksum);
+	put(algo, STARTOFALGO);
+
+	put_bytes(algo, body.data, body.len);
+	free(body.data);
+}
+
+/* frame content with about rle percent of the bytes in runs of 0xff */
+static void make_frame(struct gen *gen, unsigned char *frame, size_t len)
+{
+	size_t runs = len * gen->rle / 100;
+	size_t pos = 0;
+
+	while (pos < len)
+	{
+		if (runs && gen_random(gen) % 100 < (unsigned int)gen->rle)
+		{
+			size_t run = 2 + gen_random(gen) % 63;
+
+			if (run > runs)
+				run = runs;
+			if (run > len - pos)
+				run = len - pos;
+			memset(frame + pos, 0xFF, run);
+			pos += run;
+			runs -= run;
+		}
+		else
+			frame[pos++] = gen_random(gen) % 0xFF;
+	}
+}
+
+/* decomp_initFrame()/decomp_getByte() format for one frame */
+static void put_frame(struct gen *gen, struct gen_buf *set,
+		const unsigned char *frame, size_t len)
+{
+	size_t i, run;
+	int has_runs = 0;
+
+	gen->raw_bytes += len;
+
+	if (!gen->compress)
+	{
+		put_bytes(set, frame, len);
+		gen->stored_bytes += len;
+		return;
+	}
+
+	for (i = 0; i + 1 < len && !has_runs; i++)
+		has_runs = frame[i] == 0xFF && frame[i + 1] == 0xFF;
+
+	if (!has_runs)
+	{
+		put(set, GEN_RLE_NONE);
+		put_bytes(set, frame, len);
+		gen->stored_bytes += len + 1;
+		return;
+	}
+
+	put(set, GEN_RLE_FF);
+	gen->stored_bytes++;
+	for (i = 0; i < len; i += run)
+	{
+		if (frame[i] != 0xFF)
+		{
+			put(set, frame[i]);
+			gen->stored_bytes++;
+			run = 1;
+			continue;
+		}
+
+		for (run = 1; i + run < len && run < GEN_MAX_RUN &&
+				frame[i + run] == 0xFF; run++)
+			;
+		put(set, 0xFF);
+		put(set, run);
+		gen->stored_bytes += 2;
+	}
+}
+
+static void make_sets(struct gen *gen, struct gen_buf *eh, struct gen_buf *prog)
+{
+	unsigned int bytes = (gen->bits + 7) / 8;
+	unsigned char *frame = malloc(bytes);
+	unsigned int i;
+
+	if (!frame)
+		gen_fail("out of memory");
+
+	for (i = 0; i < gen->frames; i++)
+	{
+		make_frame(gen, frame, bytes);
+		put_frame(gen, gen->interleave == 2 && (i & 1) ? prog : eh,
+				frame, bytes);
+	}
+
+	free(frame);
+}
+
+static void put_set(struct gen_buf *stream, const struct gen_buf *set)
+{
+	unsigned int checksum = 0;
+	size_t i;
+
+	put(stream, GEN_DATA_BEGIN0);
+	put(stream, GEN_DATA_BEGIN1);
+	put_bytes(stream, set->data, set->len);
+	for (i = 0; i < set->len; i++)
+		checksum += set->data[i];
+	put(stream, checksum >> 8);
+	put(stream, checksum);
+	put(stream, GEN_DATA_END0);
+	put(stream, GEN_DATA_END1);
+}
+
+static void put_toc_entry(struct gen_buf *data, unsigned char id,
+		unsigned int uncomp_size, int compress, unsigned int address)
+{
+	put(data, HTOC);
+	put(data, id);
+	put(data, 0x00);
+	put_number(data, uncomp_size);
+	put(data, compress);
+	put(data, address >> 24);
+	put(data, address >> 16);
+	put(data, address >> 8);
+	put(data, address);
+}
+
+/* data set 0x27 first, then the filler, then 0x04 */
+static void put_data(struct gen *gen, struct gen_buf *data, const char *comment)
+{
+	struct gen_buf eh = {0}, prog = {0}, filler = {0}, stream = {0};
+	unsigned int bytes = (gen->bits + 7) / 8;
+	unsigned int per_set = gen->frames / gen->interleave;
+	unsigned int address[GEN_D_TOC_NUMBER];
+	int i;
+
+	make_sets(gen, &eh, &prog);
+	for (i = 0; i < (int)gen->filler; i++)
+		put(&filler, gen_random(gen));
+
+	address[0] = stream.len;
+	put_set(&stream, &eh);
+	for (i = 1; i < gen->sets - (gen->interleave == 2); i++)
+	{
+		address[i] = stream.len;
+		put_set(&stream, &filler);
+	}
+	if (gen->interleave == 2)
+	{
+		address[i] = stream.len;
+		put_set(&stream, &prog);
+	}
+
+	put_comment(data, comment);
+	put(data, HDATASET_NUM);
+	put(data, gen->sets);
+	put_toc_entry(data, GEN_SET_EH, per_set * bytes, gen->compress, address[0]);
+	for (i = 1; i < gen->sets - (gen->interleave == 2); i++)
+		put_toc_entry(data, GEN_SET_FILLER + i, gen->filler, 0, address[i]);
+	if (gen->interleave == 2)
+		put_toc_entry(data, GEN_SET_PROG, per_set * bytes, gen->compress,
+				address[i]);
+
+	put_bytes(data, stream.data, stream.len);
+
+	free(eh.data);
+	free(prog.data);
+	free(filler.data);
+	free(stream.data);
+}
+
+static void parse_levels(struct gen *gen, const char *arg)
+{
+	char *copy = strdup(arg), *item, *save = NULL;
+	unsigned int product = 1;
+
+	gen->nr_levels = 0;
+	if (!strcmp(arg, "0"))
+	{
+		free(copy);
+		return;
+	}
+
+	for (item = strtok_r(copy, ",", &save); item;
+			item = strtok_r(NULL, ",", &save))
+	{
+		struct gen_level *level;
+
+		if (gen->nr_levels == GEN_MAX_LEVELS)
+			gen_fail("too many nesting levels");
+		level = &gen->levels[gen->nr_levels++];
+
+		if (item[0] == 'L')
+		{
+			level->loop = 1;
+			level->count = item[1] ? strtoul(item + 1, NULL, 0) : 1;
+			if (gen->nr_levels == 1)
+				gen_fail("the outermost level must be a REPEAT");
+		}
+		else
+		{
+			level->count = strtoul(item, NULL, 0);
+			product *= level->count;
+		}
+		if (!level->count)
+			gen_fail("bad nesting level");
+	}
+	free(copy);
+
+	gen->iterations = product;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: sspi-gen [-f frames] [-b bits] [-l levels] "
+			"[-s sets] [-F bytes] [-r percent] [-u] [-v percent] "
+			"[-p polls] [-w ms] [-i idcode] [-S seed] "
+			"algo_file data_file\n");
+	exit(2);
+}
+
+static void write_file(const char *name, const struct gen_buf *buf)
+{
+	FILE *f = fopen(name, "wb");
+
+	if (!f || fwrite(buf->data, 1, buf->len, f) != buf->len || fclose(f))
+	{
+		perror(name);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct gen gen = {
+		.frames = 256,
+		.bits = 4096,
+		.sets = 1,
+		.filler = 1024,
+		.compress = -1,
+		.polls = 10,
+		.idcode = 0x41111043,
+		.seed = 1,
+	};
+	struct gen_buf algo = {0}, data = {0};
+	const char *levels = NULL;
+	char comment[256];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:b:l:s:F:r:uv:p:w:i:S:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'f':
+			gen.frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			gen.bits = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			levels = optarg;
+			break;
+		case 's':
+			gen.sets = atoi(optarg);
+			break;
+		case 'F':
+			gen.filler = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			gen.rle = atoi(optarg);
+			break;
+		case 'u':
+			gen.compress = 0;
+			break;
+		case 'v':
+			gen.verify = atoi(optarg);
+			break;
+		case 'p':
+			gen.polls = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			gen.wait_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			gen.idcode = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			gen.seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 2)
+		usage();
+
+	if (!gen.bits || gen.bits > GEN_MAX_FRAME_BITS)
+		gen_fail("frame size must be 1..524288 bits");
+	if (gen.sets < 1 || gen.sets > GEN_D_TOC_NUMBER)
+		gen_fail("data set count must be 1..16");
+	if (gen.rle < 0 || gen.rle > 100 || gen.verify < 0 || gen.verify > 100)
+		gen_fail("percentages must be 0..100");
+	if (!gen.polls || !gen.seed)
+		gen_fail("polls and seed must not be 0");
+	gen.interleave = gen.sets >= 2 ? 2 : 1;
+	if (gen.compress < 0)
+		gen.compress = gen.rle > 0 && gen.interleave == 1;
+
+	if (levels)
+	{
+		parse_levels(&gen, levels);
+		if (gen.nr_levels)
+			gen.frames = gen.iterations * gen.interleave;
+	}
+	else
+	{
+		gen.nr_levels = 1;
+		gen.levels[0].count = gen.frames / gen.interleave;
+	}
+	if (!gen.frames || gen.frames % gen.interleave)
+		gen_fail("frame count must be a non-zero multiple of the frames "
+				"per iteration");
+	gen.iterations = gen.frames / gen.interleave;
+	gen.max_depth = gen.nr_levels;
+
+	if (gen.verify && gen.bits % 8)
+		fprintf(stderr, "sspi-gen: warning: unaligned frames do not read "
+				"back as written\n");
+
+	snprintf(comment, sizeof(comment),
+			"sspi-gen -f %u -b %u -l %s -s %d -F %u -r %d%s -v %d "
+			"-p %u -w %u -i 0x%08x -S %u", gen.frames, gen.bits,
+			levels ? levels : "default", gen.sets, gen.filler,
+			gen.rle, gen.compress ? "" : " -u", gen.verify,
+			gen.polls, gen.wait_ms, gen.idcode, gen.seed);
+
+	put_data(&gen, &data, comment);
+	put_algo(&gen, &algo, comment);
+
+	write_file(argv[optind], &algo);
+	write_file(argv[optind + 1], &data);
+
+	printf("frames:      %u x %u bits, %u per iteration\n",
+			gen.frames, gen.bits, gen.interleave);
+	printf("algo:        %zu bytes, body %u, depth %d\n",
+			algo.len, gen.max_body, gen.max_depth);
+	printf("data:        %zu bytes, %d sets\n", data.len, gen.sets);
+	printf("compression: %llu -> %llu bytes (%.1f%%)\n",
+			gen.raw_bytes, gen.stored_bytes,
+			gen.raw_bytes ? 100.0 * gen.stored_bytes / gen.raw_bytes : 0.0);
+
+	free(algo.data);
+	free(data.data);
+
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef _HOST_ASM_UNALIGNED_H
+#define _HOST_ASM_UNALIGNED_H
+
+#include <string.h>
+#include <linux/types.h>
+
+static inline u32 get_unaligned_be32(const void *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return __builtin_bswap32(v);
+}
+
+static inline void put_unaligned_be32(u32 v, void *p)
+{
+	v = __builtin_bswap32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+#endif
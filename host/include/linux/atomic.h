@@ -0,0 +1,20 @@
+#ifndef _HOST_LINUX_ATOMIC_H
+#define _HOST_LINUX_ATOMIC_H
+
+/* the host build is single threaded, plain variables will do */
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+
+static inline int atomic_read(const atomic_t *v) { return v->counter; }
+static inline void atomic_set(atomic_t *v, int i) { v->counter = i; }
+static inline void atomic_add(int i, atomic_t *v) { v->counter += i; }
+static inline void atomic_inc(atomic_t *v) { v->counter++; }
+
+static inline long atomic_long_read(const atomic_long_t *v) { return v->counter; }
+static inline void atomic_long_set(atomic_long_t *v, long i) { v->counter = i; }
+static inline void atomic_long_add(long i, atomic_long_t *v) { v->counter += i; }
+static inline void atomic_long_inc(atomic_long_t *v) { v->counter++; }
+
+#endif
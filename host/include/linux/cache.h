@@ -0,0 +1,6 @@
+#ifndef _HOST_LINUX_CACHE_H
+#define _HOST_LINUX_CACHE_H
+
+#define L1_CACHE_BYTES	64
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _HOST_LINUX_CRC32_H
+#define _HOST_LINUX_CRC32_H
+
+#include <linux/types.h>
+
+/* host/driver.c */
+u32 crc32_le(u32 crc, unsigned char const *p, size_t len);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _HOST_LINUX_DELAY_H
+#define _HOST_LINUX_DELAY_H
+
+/* delays go to the mock backend, see host/mock.c */
+void msleep(unsigned int msecs);
+void udelay(unsigned long usecs);
+void usleep_range(unsigned long min, unsigned long max);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _HOST_LINUX_FS_H
+#define _HOST_LINUX_FS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+struct dentry;
+
+struct inode
+{
+	void *i_private;
+};
+
+struct file
+{
+	FILE *stream;		/* where seq_file output goes */
+	void *private_data;
+};
+
+#define THIS_MODULE	NULL
+
+struct file_operations
+{
+	void *owner;
+	int (*open)(struct inode *inode, struct file *file);
+	ssize_t (*read)(struct file *file, char *buf, size_t size, loff_t *ppos);
+	loff_t (*llseek)(struct file *file, loff_t offset, int whence);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+#define __user
+
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+		const void *from, size_t available);
+loff_t default_llseek(struct file *file, loff_t offset, int whence);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _HOST_LINUX_GPIO_H
+#define _HOST_LINUX_GPIO_H
+
+#include <linux/kernel.h>
+
+/* GPIOs go to the mock backend, see host/mock.c */
+int gpio_request(unsigned gpio, const char *label);
+void gpio_free(unsigned gpio);
+int gpio_export(unsigned gpio, bool direction_may_change);
+int gpio_direction_input(unsigned gpio);
+int gpio_direction_output(unsigned gpio, int value);
+int gpio_get_value(unsigned gpio);
+void gpio_set_value(unsigned gpio, int value);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _HOST_LINUX_KREF_H
+#define _HOST_LINUX_KREF_H
+
+/* the host build never frees the device, nothing counts */
+struct kref
+{
+	int refcount;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _HOST_LINUX_KTIME_H
+#define _HOST_LINUX_KTIME_H
+
+#include <time.h>
+#include <linux/types.h>
+
+typedef s64 ktime_t;
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ktime_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline ktime_t ktime_set(s64 secs, unsigned long nsecs)
+{
+	return secs * 1000000000LL + nsecs;
+}
+
+static inline s64 ktime_to_ns(ktime_t kt) { return kt; }
+static inline s64 ktime_to_us(ktime_t kt) { return kt / 1000; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return a - b; }
+static inline ktime_t ktime_add_ns(ktime_t kt, u64 ns) { return kt + ns; }
+static inline s64 ktime_us_delta(ktime_t later, ktime_t earlier)
+{
+	return (later - earlier) / 1000;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _HOST_LINUX_LIST_H
+#define _HOST_LINUX_LIST_H
+
+struct list_head
+{
+	struct list_head *next;
+	struct list_head *prev;
+};
+
+#endif
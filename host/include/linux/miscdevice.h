@@ -0,0 +1,15 @@
+#ifndef _HOST_LINUX_MISCDEVICE_H
+#define _HOST_LINUX_MISCDEVICE_H
+
+#include <linux/fs.h>
+
+#define MISC_DYNAMIC_MINOR	255
+
+struct miscdevice
+{
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+};
+
+#endif
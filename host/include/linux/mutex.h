@@ -0,0 +1,18 @@
+#ifndef _HOST_LINUX_MUTEX_H
+#define _HOST_LINUX_MUTEX_H
+
+/* the host build is single threaded */
+struct mutex
+{
+	int locked;
+};
+
+#define DEFINE_MUTEX(m)		struct mutex m = { 0 }
+
+static inline void mutex_init(struct mutex *m) { m->locked = 0; }
+static inline void mutex_lock(struct mutex *m) { m->locked = 1; }
+static inline int mutex_trylock(struct mutex *m) { return m->locked ? 0 : (m->locked = 1); }
+static inline void mutex_unlock(struct mutex *m) { m->locked = 0; }
+static inline void mutex_destroy(struct mutex *m) { }
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _HOST_LINUX_SEQ_FILE_H
+#define _HOST_LINUX_SEQ_FILE_H
+
+/*
+ * seq_file on the host prints straight to a stdio stream: single_open()
+ * runs the show function at once on the stream of the struct file.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <linux/fs.h>
+
+struct seq_file
+{
+	FILE *stream;
+	void *private;
+};
+
+static inline void seq_printf(struct seq_file *s, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(s->stream, fmt, args);
+	va_end(args);
+}
+
+static inline void seq_puts(struct seq_file *s, const char *str)
+{
+	fputs(str, s->stream);
+}
+
+static inline int single_open(struct file *file,
+		int (*show)(struct seq_file *, void *), void *data)
+{
+	struct seq_file s = { file->stream, data };
+
+	return show(&s, NULL);
+}
+
+ssize_t seq_read(struct file *file, char *buf, size_t size, loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+int single_release(struct inode *inode, struct file *file);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _HOST_LINUX_SLAB_H
+#define _HOST_LINUX_SLAB_H
+
+#include <linux/kernel.h>
+
+#define GFP_KERNEL	0
+#define GFP_DMA		0
+
+static inline void *kmalloc(size_t size, int flags)
+{
+	return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, int flags)
+{
+	return calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, int flags)
+{
+	return calloc(n, size);
+}
+
+static inline void *krealloc(void *p, size_t size, int flags)
+{
+	return realloc(p, size);
+}
+
+static inline void *kmemdup(const void *src, size_t len, int flags)
+{
+	void *p = malloc(len);
+
+	if (p)
+		memcpy(p, src, len);
+	return (p);
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+#define kzfree(p)	kfree(p)
+
+#endif
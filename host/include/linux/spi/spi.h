@@ -0,0 +1,80 @@
+#ifndef _HOST_LINUX_SPI_H
+#define _HOST_LINUX_SPI_H
+
+#include <linux/kernel.h>
+
+#define SPI_MODE_0	0
+
+struct spi_master
+{
+	int bus_num;
+};
+
+struct spi_device
+{
+	struct spi_master *master;
+	int chip_select;
+	u32 max_speed_hz;
+	u8 bits_per_word;
+	u8 mode;
+	void *drvdata;
+};
+
+static inline void spi_set_drvdata(struct spi_device *spi, void *data)
+{
+	spi->drvdata = data;
+}
+
+static inline void *spi_get_drvdata(struct spi_device *spi)
+{
+	return spi->drvdata;
+}
+
+struct spi_transfer
+{
+	const void *tx_buf;
+	void *rx_buf;
+	unsigned len;
+	u8 bits_per_word;	/* 0 for the device's */
+	struct spi_transfer *next;
+};
+
+/* a list of transfers, done in order with chip select held */
+struct spi_message
+{
+	struct spi_transfer *first;
+	struct spi_transfer *last;
+	unsigned actual_length;	/* bytes done, added to by the mock */
+};
+
+static inline void spi_message_init(struct spi_message *m)
+{
+	m->first = NULL;
+	m->last = NULL;
+	m->actual_length = 0;
+}
+
+static inline void spi_message_add_tail(struct spi_transfer *t,
+		struct spi_message *m)
+{
+	t->next = NULL;
+	if (m->last)
+		m->last->next = t;
+	else
+		m->first = t;
+	m->last = t;
+}
+
+/* transfers go to the mock backend, see host/mock.c */
+int spi_setup(struct spi_device *spi);
+int spi_sync(struct spi_device *spi, struct spi_message *message);
+int spi_sync_locked(struct spi_device *spi, struct spi_message *message);
+int spi_bus_lock(struct spi_master *master);
+int spi_bus_unlock(struct spi_master *master);
+int spi_write(struct spi_device *spi, const void *buf, size_t len);
+int spi_read(struct spi_device *spi, void *buf, size_t len);
+int spi_write_then_read(struct spi_device *spi,
+		const void *txbuf, unsigned n_tx,
+		void *rxbuf, unsigned n_rx);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _HOST_LINUX_SPINLOCK_H
+#define _HOST_LINUX_SPINLOCK_H
+
+/* the host build is single threaded, nothing spins */
+typedef struct
+{
+	int locked;
+} spinlock_t;
+
+#endif
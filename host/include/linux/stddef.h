@@ -0,0 +1,6 @@
+#ifndef _HOST_LINUX_STDDEF_H
+#define _HOST_LINUX_STDDEF_H
+
+#include <stddef.h>
+
+#endif
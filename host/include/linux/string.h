@@ -0,0 +1,6 @@
+#ifndef _HOST_LINUX_STRING_H
+#define _HOST_LINUX_STRING_H
+
+#include <string.h>
+
+#endif
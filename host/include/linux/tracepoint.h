@@ -0,0 +1,14 @@
+#ifndef _HOST_LINUX_TRACEPOINT_H
+#define _HOST_LINUX_TRACEPOINT_H
+
+/* tracepoints compile to empty functions on the host */
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)	\
+	static inline void trace_##name(proto) { }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args)		\
+	static inline void trace_##name(proto) { }
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _HOST_LINUX_VMALLOC_H
+#define _HOST_LINUX_VMALLOC_H
+
+#include <linux/kernel.h>
+
+static inline void *vmalloc(unsigned long size)
+{
+	return malloc(size);
+}
+
+static inline void vfree(const void *p)
+{
+	free((void *)p);
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _HOST_LINUX_WAIT_H
+#define _HOST_LINUX_WAIT_H
+
+/* the host build is single threaded, nothing waits */
+typedef struct
+{
+	int unused;
+} wait_queue_head_t;
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _HOST_LINUX_WORKQUEUE_H
+#define _HOST_LINUX_WORKQUEUE_H
+
+struct work_struct
+{
+	void (*func)(struct work_struct *work);
+};
+
+struct workqueue_struct;
+
+#endif
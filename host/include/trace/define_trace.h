@@ -0,0 +1 @@
+/* nothing to define on the host, see linux/tracepoint.h */
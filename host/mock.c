@@ -0,0 +1,299 @@
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/gpio.h>
+#include <linux/spi/spi.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mock.h"
+
+#define MOCK_NR_GPIOS	256
+
+struct mock_stats mock_stats;
+int mock_real_sleep;
+u8 mock_fill = 0xFF;
+
+static FILE *mock_trace_file;
+static int mock_gpio_level[MOCK_NR_GPIOS];
+
+static void mock_default_transfer(void *priv, const u8 *tx, u8 *rx, size_t len)
+{
+	if (rx)
+		memset(rx, mock_fill, len);
+}
+
+static void mock_default_gpio_set(void *priv, unsigned gpio, int value)
+{
+}
+
+static int mock_default_gpio_get(void *priv, unsigned gpio)
+{
+	return gpio < MOCK_NR_GPIOS ? mock_gpio_level[gpio] : 0;
+}
+
+static void mock_default_delay(void *priv, unsigned long usecs)
+{
+}
+
+static const struct mock_backend mock_default_backend = {
+	.name = "fill",
+	.transfer = mock_default_transfer,
+	.gpio_set = mock_default_gpio_set,
+	.gpio_get = mock_default_gpio_get,
+	.delay = mock_default_delay,
+};
+
+static const struct mock_backend *backend = &mock_default_backend;
+
+void mock_set_backend(const struct mock_backend *new_backend)
+{
+	backend = new_backend ? new_backend : &mock_default_backend;
+}
+
+void mock_reset_stats(void)
+{
+	memset(&mock_stats, 0, sizeof(mock_stats));
+}
+
+void mock_trace(FILE *f)
+{
+	mock_trace_file = f;
+}
+
+static void mock_trace_bytes(char dir, const u8 *buf, size_t len)
+{
+	size_t i;
+
+	if (!mock_trace_file)
+		return;
+
+	fprintf(mock_trace_file, "%c %zu", dir, len);
+	for (i = 0; i < len; i++)
+		fprintf(mock_trace_file, " %02x", buf[i]);
+	fputc('\n', mock_trace_file);
+}
+
+static void mock_transfer(const u8 *tx, u8 *rx, size_t len)
+{
+	ktime_t start = ktime_get();
+
+	backend->transfer(backend->priv, tx, rx, len);
+	mock_stats.backend_ns += ktime_get() - start;
+
+	if (tx)
+	{
+		mock_stats.tx_bytes += len;
+		mock_stats.tx_calls++;
+		mock_trace_bytes('T', tx, len);
+	}
+	else
+	{
+		mock_stats.rx_bytes += len;
+		mock_stats.rx_calls++;
+		mock_trace_bytes('R', rx, len);
+	}
+}
+
+int spi_setup(struct spi_device *spi)
+{
+	if (backend->set_clock)
+		backend->set_clock(backend->priv, spi->max_speed_hz);
+	return 0;
+}
+
+int spi_write(struct spi_device *spi, const void *buf, size_t len)
+{
+	mock_transfer(buf, NULL, len);
+	mock_stats.spi_words += len;
+	mock_stats.messages++;
+	return 0;
+}
+
+int spi_read(struct spi_device *spi, void *buf, size_t len)
+{
+	mock_transfer(NULL, buf, len);
+	mock_stats.spi_words += len;
+	mock_stats.messages++;
+	return 0;
+}
+
+/* 32 bit words go out MSB first, the backend sees bytes in wire order */
+static void mock_swap_words(u8 *dst, const u8 *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += 4)
+	{
+		u32 word;
+
+		memcpy(&word, src + i, 4);
+		word = __builtin_bswap32(word);
+		memcpy(dst + i, &word, 4);
+	}
+}
+
+/*
+ * The bus lock is only checked: in the kernel spi_sync() with the bus
+ * locked by the caller waits forever, so it fails here.
+ */
+static int mock_bus_locked;
+
+int spi_bus_lock(struct spi_master *master)
+{
+	if (mock_bus_locked)
+	{
+		fprintf(stderr, "mock: SPI bus locked twice\n");
+		return -EDEADLK;
+	}
+	mock_bus_locked = 1;
+	mock_stats.bus_locks++;
+	return 0;
+}
+
+int spi_bus_unlock(struct spi_master *master)
+{
+	if (!mock_bus_locked)
+		fprintf(stderr, "mock: SPI bus unlocked while not locked\n");
+	mock_bus_locked = 0;
+	return 0;
+}
+
+static int mock_sync(struct spi_message *message);
+
+int spi_sync(struct spi_device *spi, struct spi_message *message)
+{
+	if (mock_bus_locked)
+	{
+		fprintf(stderr, "mock: spi_sync() on a locked SPI bus\n");
+		return -EDEADLK;
+	}
+	return mock_sync(message);
+}
+
+int spi_sync_locked(struct spi_device *spi, struct spi_message *message)
+{
+	if (!mock_bus_locked)
+		fprintf(stderr, "mock: spi_sync_locked() without the bus lock\n");
+	return mock_sync(message);
+}
+
+static int mock_sync(struct spi_message *message)
+{
+	struct spi_transfer *t;
+	u8 *wire;
+
+	mock_stats.messages++;
+
+	for (t = message->first; t; t = t->next)
+	{
+		if (t->bits_per_word != 32)
+		{
+			mock_transfer(t->tx_buf, t->tx_buf ? NULL : t->rx_buf,
+					t->len);
+			mock_stats.spi_words += t->len;
+			message->actual_length += t->len;
+			continue;
+		}
+
+		wire = t->len % 4 ? NULL : malloc(t->len);
+		if (!wire)
+			return -EINVAL;
+		if (t->tx_buf)
+		{
+			mock_swap_words(wire, t->tx_buf, t->len);
+			mock_transfer(wire, NULL, t->len);
+		}
+		else
+		{
+			mock_transfer(NULL, wire, t->len);
+			mock_swap_words(t->rx_buf, wire, t->len);
+		}
+		free(wire);
+		mock_stats.spi_words += t->len / 4;
+		message->actual_length += t->len;
+	}
+	return 0;
+}
+
+int spi_write_then_read(struct spi_device *spi,
+		const void *txbuf, unsigned n_tx,
+		void *rxbuf, unsigned n_rx)
+{
+	mock_transfer(txbuf, NULL, n_tx);
+	mock_transfer(NULL, rxbuf, n_rx);
+	mock_stats.spi_words += n_tx + n_rx;
+	mock_stats.messages++;
+	return 0;
+}
+
+static void mock_delay(unsigned long usecs)
+{
+	ktime_t start = ktime_get();
+
+	mock_stats.delay_us += usecs;
+	if (mock_trace_file)
+		fprintf(mock_trace_file, "D %lu\n", usecs);
+
+	backend->delay(backend->priv, usecs);
+	if (mock_real_sleep)
+		usleep(usecs);
+	mock_stats.backend_ns += ktime_get() - start;
+}
+
+void msleep(unsigned int msecs)
+{
+	mock_delay(msecs * 1000UL);
+}
+
+void udelay(unsigned long usecs)
+{
+	mock_delay(usecs);
+}
+
+void usleep_range(unsigned long min, unsigned long max)
+{
+	mock_delay(min);
+}
+
+int gpio_request(unsigned gpio, const char *label)
+{
+	return gpio < MOCK_NR_GPIOS ? 0 : -EINVAL;
+}
+
+void gpio_free(unsigned gpio)
+{
+}
+
+int gpio_export(unsigned gpio, bool direction_may_change)
+{
+	return 0;
+}
+
+int gpio_direction_input(unsigned gpio)
+{
+	return 0;
+}
+
+int gpio_direction_output(unsigned gpio, int value)
+{
+	gpio_set_value(gpio, value);
+	return 0;
+}
+
+int gpio_get_value(unsigned gpio)
+{
+	mock_stats.gpio_ops++;
+	return backend->gpio_get(backend->priv, gpio);
+}
+
+void gpio_set_value(unsigned gpio, int value)
+{
+	mock_stats.gpio_ops++;
+	if (gpio < MOCK_NR_GPIOS)
+		mock_gpio_level[gpio] = !!value;
+	if (mock_trace_file)
+		fprintf(mock_trace_file, "G %u %d\n", gpio, !!value);
+	backend->gpio_set(backend->priv, gpio, !!value);
+}
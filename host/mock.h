@@ -0,0 +1,54 @@
+#ifndef _HOST_MOCK_H_
+#define _HOST_MOCK_H_
+
+/*
+ * In-memory stand-in for the SPI controller, GPIOs and delays used by
+ * lattice/hardware.c in the host build.
+ *
+ * Everything goes through a backend.  The default one remembers GPIO
+ * output levels, reads them back for inputs and answers every SPI read
+ * with mock_fill.  Delays are virtual: they are accounted, not slept,
+ * unless mock_real_sleep is set.
+ */
+
+#include <stdio.h>
+#include <linux/types.h>
+
+struct mock_backend
+{
+	const char *name;
+	void *priv;
+
+	/* either tx or rx is NULL */
+	void (*transfer)(void *priv, const u8 *tx, u8 *rx, size_t len);
+	void (*gpio_set)(void *priv, unsigned gpio, int value);
+	int (*gpio_get)(void *priv, unsigned gpio);
+	void (*delay)(void *priv, unsigned long usecs);
+	void (*set_clock)(void *priv, unsigned long hz);	/* optional */
+};
+
+struct mock_stats
+{
+	u64 tx_bytes;
+	u64 rx_bytes;
+	u64 tx_calls;
+	u64 rx_calls;
+	u64 spi_words;		/* FIFO entries, 8 or 32 bit words */
+	u64 messages;		/* controller round trips */
+	u64 gpio_ops;
+	u64 bus_locks;		/* spi_bus_lock() calls */
+	u64 delay_us;		/* requested delay time */
+	s64 backend_ns;		/* time spent inside the backend */
+};
+
+extern struct mock_stats mock_stats;
+extern int mock_real_sleep;
+extern u8 mock_fill;
+
+void mock_set_backend(const struct mock_backend *backend);
+void mock_reset_stats(void);
+
+/* log every transfer, GPIO change and delay to f, NULL turns it off */
+void mock_trace(FILE *f);
+
+#endif
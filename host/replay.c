@@ -0,0 +1,357 @@
+/*
+ * sspi-replay - replay an SPI session recorded by the driver (debugfs
+ * "record", or sspi-bench -R) through lattice/hardware.c and the mock
+ * backend, and time it.
+ *
+ * usage: sspi-replay [-n runs] [-c spi_hz] [-f fill] [-t trace] [-s] [-v]
+ *                    [-m] [-o name=value] record_file
+ *
+ *	-n	number of replays, default 1
+ *	-c	SPI clock for the bus time estimate, default 30000000
+ *	-m	answer like an ECP5, see ecp5_model.h
+ *	-o	set an ECP5 model parameter, e.g. -o erase_us=2000
+ *	-f	byte the mock answers SPI reads with, default 0xff
+ *	-t	write the SPI/GPIO/delay trace of the last replay to a file
+ *	-s	really sleep on delays instead of only accounting them
+ *	-v	print engine messages
+ *
+ * Transfers, chip select changes and WAITs are replayed in order, the
+ * reset sequence by running SPI_init() again.  Bytes read during the
+ * replay are compared with the recorded ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+
+#include "lattice/hardware.h"
+#include "ecp5_sspi.h"
+#include "mock.h"
+#include "ecp5_model.h"
+#include "driver.h"
+
+struct replay_entry
+{
+	struct ecp5_record_entry hdr;
+	const unsigned char *data;
+};
+
+struct replay
+{
+	struct ecp5_record_header hdr;
+	struct replay_entry *entries;
+	unsigned int count;
+	unsigned int max_transfer;	/* what the session is opened for */
+	unsigned char *file;
+};
+
+static int load_record(const char *name, struct replay *replay)
+{
+	FILE *f = fopen(name, "rb");
+	unsigned char *p, *end;
+	long len;
+
+	if (!f)
+	{
+		perror(name);
+		return -1;
+	}
+
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	replay->file = malloc(len > 0 ? len : 1);
+	if (!replay->file || fread(replay->file, 1, len, f) != (size_t)len)
+	{
+		fprintf(stderr, "%s: can't read\n", name);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	if (len < (long)sizeof(replay->hdr))
+	{
+		fprintf(stderr, "%s: too short\n", name);
+		return -1;
+	}
+	memcpy(&replay->hdr, replay->file, sizeof(replay->hdr));
+	if (replay->hdr.magic != ECP5_RECORD_MAGIC ||
+			replay->hdr.version != ECP5_RECORD_VERSION)
+	{
+		fprintf(stderr, "%s: not an ECP5 SPI record\n", name);
+		return -1;
+	}
+
+	replay->entries = calloc(replay->hdr.records ? replay->hdr.records : 1,
+			sizeof(*replay->entries));
+	if (!replay->entries)
+		return -1;
+
+	p = replay->file + sizeof(replay->hdr);
+	end = replay->file + len;
+	while (p < end && replay->count < replay->hdr.records)
+	{
+		struct replay_entry *e = &replay->entries[replay->count];
+
+		if (end - p < (long)sizeof(e->hdr))
+			break;
+		memcpy(&e->hdr, p, sizeof(e->hdr));
+		p += sizeof(e->hdr);
+
+		if (e->hdr.type == ECP5_REC_TX || e->hdr.type == ECP5_REC_RX)
+		{
+			if (end - p < (long)e->hdr.len)
+				break;
+			e->data = p;
+			p += e->hdr.len;
+			if (e->hdr.len > replay->max_transfer)
+				replay->max_transfer = e->hdr.len;
+		}
+		else if (e->hdr.type > ECP5_REC_WAIT)
+		{
+			break;
+		}
+		replay->count++;
+	}
+
+	if (replay->count != replay->hdr.records || p != end)
+	{
+		fprintf(stderr, "%s: corrupt at record %u\n", name, replay->count);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* replay all records, returns the number of mismatching bytes read */
+static u64 replay_run(const struct replay *replay)
+{
+	SSPIEm_sizes sizes = { 0 };
+	unsigned char *rx;
+	int initialized = 0;
+	u64 mismatches = 0;
+	unsigned int i, j;
+
+	/* the transfer buffers come with a session, reads go to dataBuffer */
+	sizes.frameBytes = replay->max_transfer;
+	if (!SSPIEm_open(&sizes))
+	{
+		fprintf(stderr, "sspi-replay: out of memory\n");
+		exit(1);
+	}
+	rx = dataBuffer;
+
+	if (!replay->count || replay->entries[0].hdr.type != ECP5_REC_RESET)
+	{
+		SPI_init();
+		initialized = 1;
+	}
+
+	for (i = 0; i < replay->count; i++)
+	{
+		const struct replay_entry *e = &replay->entries[i];
+
+		switch (e->hdr.type)
+		{
+		case ECP5_REC_RESET:
+			if (initialized)
+				SPI_final();
+			SPI_init();
+			initialized = 1;
+			break;
+		case ECP5_REC_CS:
+			if (e->hdr.len)
+				TRANS_starttranx(0);
+			else
+				TRANS_endtranx();
+			break;
+		case ECP5_REC_TX:
+			TRANS_transmitBytes((unsigned char *)e->data,
+					e->hdr.len * 8);
+			break;
+		case ECP5_REC_RX:
+			TRANS_receiveBytes(rx, e->hdr.len * 8);
+			for (j = 0; j < e->hdr.len; j++)
+				mismatches += rx[j] != e->data[j];
+			break;
+		case ECP5_REC_WAIT:
+			wait(e->hdr.len);
+			break;
+		}
+	}
+
+	SPI_final();
+	SSPIEm_close();
+
+	return mismatches;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: sspi-replay [-n runs] [-c spi_hz] [-f fill] "
+			"[-t trace] [-s] [-v] [-m] [-o name=value] "
+			"record_file\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay replay;
+	struct ecp5_model_config config;
+	struct ecp5_model *model = NULL;
+	int use_model = 0;
+	const char *trace_name = NULL;
+	FILE *trace = NULL;
+	int runs = 1;
+	s64 replay_ns = 0, backend_ns = 0;
+	u64 tx = 0, rx = 0, delay_us = 0, mismatches = 0;
+	u64 recorded_ns;
+	double replay_s, bus_s;
+	int ok = 1;
+	int opt;
+	int i;
+
+	ecp5_model_defaults(&config);
+
+	while ((opt = getopt(argc, argv, "n:c:f:t:svmo:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'c':
+			config.spi_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			mock_fill = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			trace_name = optarg;
+			break;
+		case 's':
+			mock_real_sleep = 1;
+			break;
+		case 'v':
+			host_verbose++;
+			break;
+		case 'm':
+			use_model = 1;
+			break;
+		case 'o':
+			if (ecp5_model_set(&config, optarg))
+			{
+				fprintf(stderr, "bad model parameter %s\n", optarg);
+				return 2;
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || runs < 1 || config.spi_hz == 0)
+		usage();
+
+	memset(&replay, 0, sizeof(replay));
+	if (load_record(argv[optind], &replay))
+		return 1;
+	if (replay.hdr.dropped)
+		fprintf(stderr, "%u records were dropped, the replay starts "
+				"in the middle of the session\n",
+				replay.hdr.dropped);
+
+	host_driver_init();
+
+	if (use_model)
+	{
+		model = ecp5_model_create(&config);
+		if (!model)
+		{
+			fprintf(stderr, "can't create the ECP5 model\n");
+			return 1;
+		}
+		mock_set_backend(ecp5_model_backend(model));
+	}
+
+	for (i = 0; i < runs; i++)
+	{
+		ktime_t t0;
+
+		if (trace_name && i == runs - 1)
+		{
+			trace = fopen(trace_name, "w");
+			if (!trace)
+			{
+				perror(trace_name);
+				return 1;
+			}
+			mock_trace(trace);
+		}
+
+		mock_reset_stats();
+		if (model)
+			ecp5_model_reset(model);
+
+		t0 = ktime_get();
+		mismatches = replay_run(&replay);
+		replay_ns += ktime_get() - t0;
+
+		backend_ns += mock_stats.backend_ns;
+		tx += mock_stats.tx_bytes;
+		rx += mock_stats.rx_bytes;
+		delay_us += mock_stats.delay_us;
+	}
+
+	if (trace)
+	{
+		mock_trace(NULL);
+		fclose(trace);
+	}
+
+	recorded_ns = replay.count ?
+		replay.entries[replay.count - 1].hdr.ns : 0;
+	replay_s = (double)(replay_ns - backend_ns) / 1e9;
+	bus_s = (double)(tx + rx) * 8 / config.spi_hz;
+
+	printf("records:           %u, %u dropped\n",
+			replay.count, replay.hdr.dropped);
+	printf("recorded session:  %.3f ms\n", recorded_ns / 1e6);
+	printf("runs:              %d\n", runs);
+	printf("replay:            %.3f ms/run\n", replay_ns / 1e6 / runs);
+	printf("  mock backend:    %.3f ms/run\n", backend_ns / 1e6 / runs);
+	printf("  transfer path:   %.3f ms/run\n", replay_s * 1e3 / runs);
+	printf("tx:                %llu bytes/run\n",
+			(unsigned long long)(tx / runs));
+	printf("rx:                %llu bytes/run, %llu differ from the "
+			"record\n", (unsigned long long)(rx / runs),
+			(unsigned long long)mismatches);
+	printf("delays:            %.3f ms/run\n", delay_us / 1e3 / runs);
+	printf("bus time:          %.3f ms/run at %lu Hz\n",
+			bus_s * 1e3 / runs, config.spi_hz);
+
+	if (model)
+	{
+		const struct ecp5_model_stats *stats = ecp5_model_stats(model);
+
+		/* the last replay only */
+		printf("model time:        %.3f ms\n", stats->now_us / 1e3);
+		printf("model done:        %d\n", ecp5_model_done(model));
+		printf("model violations:  %llu\n",
+				(unsigned long long)stats->violations);
+
+		ok = !stats->violations && !mismatches;
+
+		mock_set_backend(NULL);
+		ecp5_model_destroy(model);
+	}
+
+	free(replay.entries);
+	free(replay.file);
+
+	return ok ? 0 : 1;
+}
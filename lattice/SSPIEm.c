@@ -14,6 +14,8 @@
 *************************************************************************/
 #include "core.h"
 #include "intrface.h"
+#include "debug.h"
+#include "hardware.h"
 
 #include <linux/slab.h>
 
@@ -37,10 +39,8 @@ int SSPIEm_preset(unsigned char *setAlgoPtr, unsigned int setAlgoSize,
 /************************************************************************
 * Function SSPIEm
 * The main function of the processing engine.  During regular time,
-* it automatically gets byte from external storage.  However, this 
-* function requires an array of buffered algorithm during 
-* loop / repeat operations.  Input bufAlgo must be 0 to indicate
-* regular operation.
+* it automatically gets byte from external storage and buffers the
+* bodies of loop / repeat operations, see SSPIEm_process().
 *
 * To call the VME, simply call SSPIEm(int debug);
 *************************************************************************/
@@ -50,8 +50,70 @@ int SSPIEm(unsigned int algoID){
 //	pr_info("#1 retVal = %d\n", retVal);
 	if(retVal <= 0)
 		return retVal;
-	retVal = SSPIEm_process(0,0);
+	retVal = SSPIEm_process();
 //	pr_info("#2 retVal = %d\n", retVal);
 	return retVal;
 }
 
+
+/************************************************************************
+* Function SSPIEm_validate
+* Check algorithm header, header checksum and data table of content
+* without touching the hardware.  Images are preset by this function,
+* so call SSPIEm_preset() again before SSPIEm().
+*
+* Returns PROC_COMPLETE if images are fine, or an error code.
+*************************************************************************/
+int SSPIEm_validate(unsigned char *setAlgoPtr, unsigned int setAlgoSize,
+				  unsigned char *setDataPtr, unsigned int setDataSize){
+	int retVal = SSPIEm_preset(setAlgoPtr, setAlgoSize, setDataPtr, setDataSize);
+	if(!retVal)
+		return ERROR_INIT_ALGO;
+	retVal = SSPIEm_initHeader(0xFFFFFFFF);
+	algoFinal();
+	dataFinal();
+	return retVal;
+}
+
+/************************************************************************
+* Function SSPIEm_scanImages
+* Preset the images and walk the algorithm with SSPIEm_scan() without
+* touching the hardware.  Call SSPIEm_preset() again before SSPIEm().
+*************************************************************************/
+int SSPIEm_scanImages(unsigned char *setAlgoPtr, unsigned int setAlgoSize,
+				  unsigned char *setDataPtr, unsigned int setDataSize,
+				  SSPIEm_scanCallback callback, void *context){
+	int retVal = SSPIEm_preset(setAlgoPtr, setAlgoSize, setDataPtr, setDataSize);
+	if(!retVal)
+		return ERROR_INIT_ALGO;
+	retVal = SSPIEm_scan(callback, context);
+	algoFinal();
+	dataFinal();
+	return retVal;
+}
+
+/************************************************************************
+* Function SSPIEm_dryrun
+* Run the algorithm on the images like SSPIEm() does, with the hardware
+* functions only counting what they would do: bits sent and received,
+* transactions, transfers and delays.  Nothing is sent and nothing is
+* waited for.
+*
+* Read back data is taken to match, so every LOOP ends after its first
+* pass and verification never fails.  Data sets are still read, so
+* broken images fail as they would in SSPIEm().
+*
+* Returns the SSPIEm() result; stats are filled in either way.
+*************************************************************************/
+int SSPIEm_dryrun(unsigned char *setAlgoPtr, unsigned int setAlgoSize,
+				  unsigned char *setDataPtr, unsigned int setDataSize,
+				  SSPIEm_dryrunStats *stats){
+	int retVal = 0;
+	memset(stats, 0, sizeof(*stats));
+	if(!SSPIEm_preset(setAlgoPtr, setAlgoSize, setDataPtr, setDataSize))
+		return ERROR_INIT_ALGO;
+	SPI_setDryRun(stats);
+	retVal = SSPIEm(0xFFFFFFFF);
+	SPI_setDryRun(0);
+	return retVal;
+}
@@ -1,8 +1,18 @@
 #ifndef _SSPIEM_H_
 #define _SSPIEM_H_
 
+#include "core.h"
+
 int SSPIEm_preset(unsigned char *setAlgoPtr, unsigned int setAlgoSize, 
 				  unsigned char *setDataPtr, unsigned int setDataSize);
 int SSPIEm(unsigned int algoID);
+int SSPIEm_validate(unsigned char *setAlgoPtr, unsigned int setAlgoSize,
+				  unsigned char *setDataPtr, unsigned int setDataSize);
+int SSPIEm_scanImages(unsigned char *setAlgoPtr, unsigned int setAlgoSize,
+				  unsigned char *setDataPtr, unsigned int setDataSize,
+				  SSPIEm_scanCallback callback, void *context);
+int SSPIEm_dryrun(unsigned char *setAlgoPtr, unsigned int setAlgoSize,
+				  unsigned char *setDataPtr, unsigned int setDataSize,
+				  SSPIEm_dryrunStats *stats);
 
 #endif
@@ -17,6 +17,9 @@
 #include "debug.h"
 #include "util.h"
 
+#include <linux/string.h>
+#include <linux/cache.h>
+
 /************************************************************************
 *
 * Definition of System properties
@@ -24,21 +27,20 @@
 * This section defines properties of the processing system.  This 
 * part need to be configured when generating algorithm byte stream.
 *
-* MAXBUF		- maximum buffer allowed.
-* MAXTRANSBUF	- maximum transmission buffer allowed.
+* MAXFRAME		- maximum data frame allowed in bytes.
 *	HOLDAF		- time (millisecond) hold after fail, must be positive
 *				  0:		not continue, exit.
 *				  Other:	milliseconds
-* MAXSTACK	- maximum stack allowed, indicating maximum nested loop
-*				  allowed in a loop / repeat.  
-* MAX_MASKSIZE- maximum mask size allowed in bytes.  4 or more is required
+* MAX_MASKSIZE- masks of up to this many bits are read, MASKBUFREQ may
+*				  ask for larger ones.
+*
+* Other buffers are not limited: they are sized for each algorithm from
+* its header and a scan of it, see SSPIEm_measure().
 *
 **************************************************************************/
 
-#define MAXBUF			200
-#define MAXTRANSBUF		500
+#define MAXFRAME		65536
 #define HOLDAF			0
-#define MAXSTACK		3
 #define MAX_MASKSIZE	32
 #define MAX_DEBUGSTR	80
 #define HEADERCRCSIZE	2
@@ -50,8 +52,178 @@
 **************************************************************************/
 
 const unsigned char version[] = {4, 0, 0};
-unsigned char algoBuffer[MAXBUF];
-unsigned char stack[MAXSTACK];
+unsigned char *algoBuffer;		/* body and the 0 after it */
+
+/*************************************************************************
+*
+* Control stack
+*
+* A frame for each LOOP / REPEAT being processed, with its body in
+* algoBuffer.  A transmission keeps its state on the transmission stack,
+* one entry deeper for each REPEAT met in a transmission.  Both, and the
+* stack checking the nesting while a body is buffered, are taken from
+* the session arena, see SSPIEm_open().
+*
+**************************************************************************/
+
+/* proc_TRANS() results that do not end the transmission */
+#define PROC_NEXT		3	/* next opcode read */
+#define PROC_NEST		4	/* REPEAT met */
+
+typedef struct {
+	unsigned char	opcode;			/* LOOP or REPEAT */
+	short int	inTrans;		/* REPEAT met in a transmission */
+	unsigned int	start;			/* body in algoBuffer */
+	unsigned int	end;
+	unsigned int	nestStart;		/* last nested body in it */
+	unsigned int	nestEnd;
+	unsigned int	loopCount;
+	unsigned int	loopMax;
+	unsigned long long profStart;
+} SSPIEm_frame;
+
+typedef struct {
+	unsigned char	*trBuffer;		/* largest ALGODATA */
+	unsigned char	*maskBuffer;		/* largest MASK */
+	unsigned char	currentByte;		/* opcode to process */
+	unsigned char	opcode;			/* TRANSIN / TRANSOUT it started with */
+	int		trCount;
+	int		byteNum;
+	short int	flag_mask;
+	short int	flag_transin;
+	unsigned int	mismatch;
+	unsigned int	repeatMax;		/* of the REPEAT met */
+	unsigned long long procStart;		/* PROF_PROCESS of opcode */
+	unsigned long long profStart;		/* PROF_TRANS of currentByte */
+} SSPIEm_trans;
+
+typedef struct {
+	unsigned char	*bufAlgo;		/* algoBuffer in a body, else 0 */
+	unsigned int	bufAlgoSize;		/* end of the body */
+	unsigned int	bufAlgoIndex;
+	unsigned int	depth;			/* frames in use */
+	unsigned int	transDepth;		/* REPEATs in transmissions among them */
+	short int	transmitting;		/* transStack[transDepth] in use */
+} SSPIEm_state;
+
+static SSPIEm_frame	*frames;
+static unsigned int	framesMax;
+static SSPIEm_trans	*transStack;
+static unsigned int	transMax;
+static unsigned char	*scanStack;
+static unsigned int	scanMax;
+
+/* requirements of the header */
+static unsigned int	bufferReq;		/* BUFFERREQ */
+static unsigned int	stackReq;		/* STACKREQ */
+static unsigned int	maskReq;		/* MASKBUFREQ, in bytes */
+static unsigned int	maskBits;		/* longest MASK read */
+
+/* the open session */
+static unsigned char	*arena;
+static SSPIEm_sizes	session;
+
+static int proc_TRANS(SSPIEm_trans *trans, unsigned char *bufAlgo,
+			   unsigned int bufAlgoSize, unsigned int *bufAlgoIndex);
+static int proc_BEGIN(SSPIEm_state *state, unsigned char opcode,
+				unsigned int LoopMax, short int inTrans, unsigned long long profStart);
+static int proc_END(SSPIEm_state *state, int procReturn);
+
+/*************************************************************************
+*
+* Session arena
+*
+* Every buffer of a session is laid out in memory sized for what
+* SSPIEm_measure() found, taken from the arena of the device, see
+* SPI_sessionMemory(): the SPI buffers of hardware.c first, so the one
+* the controller may DMA from is cache line aligned, then the control
+* stacks, the transmission buffers and algoBuffer.
+*
+**************************************************************************/
+
+/* take size bytes from *next, keeping it cache line aligned */
+static unsigned char *SSPIEm_carve(unsigned char **next, unsigned int size)
+{
+	unsigned char *buffer = *next;
+
+	*next += SPI_BUFFER_ALIGN(size);
+	return buffer;
+}
+
+/**************************************************************************
+* Function SSPIEm_open
+* Lay out the buffers of a session for sizes in the arena of the device
+* and hand the hardware its buffers.  A session still open is closed
+* first.
+*
+* Returns 1 on success, 0 if the arena is too small and can't grow.
+**************************************************************************/
+int SSPIEm_open(const SSPIEm_sizes *sizes)
+{
+	unsigned int transferBytes = sizes->algoBytes > sizes->frameBytes ?
+		sizes->algoBytes : sizes->frameBytes;
+	unsigned int spiBytes = SPI_buffersSize(transferBytes, sizes->frameBytes);
+	unsigned int frameCount = sizes->depth + 1;
+	unsigned int transCount = sizes->depth + 2;
+	unsigned int size;
+	unsigned char *next;
+	unsigned int i;
+
+	SSPIEm_close();
+	size = SPI_BUFFER_ALIGN(spiBytes) +
+		SPI_BUFFER_ALIGN(frameCount * sizeof(SSPIEm_frame)) +
+		SPI_BUFFER_ALIGN(transCount * sizeof(SSPIEm_trans)) +
+		SPI_BUFFER_ALIGN(transCount * sizes->algoBytes) +
+		SPI_BUFFER_ALIGN(transCount * sizes->maskBytes) +
+		SPI_BUFFER_ALIGN(sizes->bodyBytes) +
+		sizes->bodyBytes + 1;
+	arena = SPI_sessionMemory(size);
+	if(!arena)
+		return 0;
+	memset(arena, 0, size);
+	session = *sizes;
+
+	next = arena;
+	SPI_setBuffers(SSPIEm_carve(&next, spiBytes), transferBytes,
+		sizes->frameBytes);
+	frames = (SSPIEm_frame *) SSPIEm_carve(&next,
+		frameCount * sizeof(SSPIEm_frame));
+	framesMax = frameCount;
+	transStack = (SSPIEm_trans *) SSPIEm_carve(&next,
+		transCount * sizeof(SSPIEm_trans));
+	transMax = transCount;
+	for(i = 0; i < transCount; i++)
+		transStack[i].trBuffer = next + i * sizes->algoBytes;
+	SSPIEm_carve(&next, transCount * sizes->algoBytes);
+	for(i = 0; i < transCount; i++)
+		transStack[i].maskBuffer = next + i * sizes->maskBytes;
+	SSPIEm_carve(&next, transCount * sizes->maskBytes);
+	/* a body can't nest deeper than it is long */
+	scanStack = SSPIEm_carve(&next, sizes->bodyBytes);
+	scanMax = sizes->bodyBytes;
+	algoBuffer = next;
+	return 1;
+}
+
+/**************************************************************************
+* Function SSPIEm_close
+* Drop the buffers of the session, if one is open.  The arena stays with
+* the device for the next session.
+**************************************************************************/
+void SSPIEm_close()
+{
+	if(!arena)
+		return;
+	SPI_setBuffers(0, 0, 0);
+	arena = 0;
+	frames = 0;
+	framesMax = 0;
+	transStack = 0;
+	transMax = 0;
+	scanStack = 0;
+	scanMax = 0;
+	algoBuffer = 0;
+}
 
 /*************************************************************************
 *
@@ -80,28 +252,56 @@ unsigned char getCurrentChannel()
 
 /**************************************************************************
 * Function SSPIEm_init()
-* Start initialization
+* Start initialization.  The algorithm is measured and the session
+* opened before the SPI port is initialized, so an image the scan
+* rejects or the arena can't hold does not reset the device.
+* SSPIEm_process() closes the session.
 **************************************************************************/
 
 int SSPIEm_init(unsigned int algoID)
 {
-	unsigned char currentByte = 0;
-	int i					  = 0;
-	unsigned int mask         = 0;
-	CSU headerCS;
-	/* initialize header check sum unit */
-	init_CS(&headerCS, HEADERCRCSIZE * 8, 8);
+	SSPIEm_sizes sizes;
+	int retVal = 0;
 	/* initialize debug */
 	#ifdef	DEBUG_LEVEL_1
 	dbgu_init();
 	#endif
+	retVal = SSPIEm_measure(algoID, &sizes);
+	if(retVal <= 0)
+		return retVal;
+	if(!SSPIEm_open(&sizes))
+		return ERROR_INIT;
 	/* initialize SPI */
 	if(!SPI_init()){
 		#ifdef	DEBUG_LEVEL_1
 		dbgu_putint(DBGU_L1_ALGO_INIT, INIT_SPI_FAIL);
 		#endif
+		SSPIEm_close();
 		return ERROR_INIT_SPI;
 	}
+	retVal = SSPIEm_initHeader(algoID);
+	if(retVal <= 0){
+		SPI_final();
+		SSPIEm_close();
+	}
+	return retVal;
+}
+
+/**************************************************************************
+* Function SSPIEm_initHeader()
+* Parse and check the algorithm header and the data table of content.
+* It does not touch the hardware, so it may also be used to validate
+* images before programming.
+**************************************************************************/
+
+int SSPIEm_initHeader(unsigned int algoID)
+{
+	unsigned char currentByte = 0;
+	int i					  = 0;
+	unsigned int mask         = 0;
+	CSU headerCS;
+	/* initialize header check sum unit */
+	init_CS(&headerCS, HEADERCRCSIZE * 8, 8);
 	#ifdef	DEBUG_LEVEL_2
 	dbgu_putint(DBGU_L2_INIT, INIT_BEGIN);//"Initialization begin"
 	#endif
@@ -202,16 +402,18 @@ int SSPIEm_init(unsigned int algoID)
 	else 
 	{
 		putChunk(&headerCS, (unsigned int) currentByte);
-		if(!VME_getByte(&currentByte, 0, 0, 0) ||
-			currentByte > MAXBUF)
+		/* the body size algoBuffer starts with */
+		if(!VME_getByte(&currentByte, 0, 0, 0))
 		{
 			#ifdef	DEBUG_LEVEL_1
 			dbgu_putint(DBGU_L1_MISMATCH, NO_BUFFERREQ); 
 			#endif
 			return ERROR_INIT;
 		}
-		else
+		else{
 			putChunk(&headerCS, (unsigned int) currentByte);
+			bufferReq = currentByte;
+		}
 	}
 	/* check STACKREQ */
 	if(!VME_getByte(&currentByte, 0, 0, 0) || 
@@ -225,9 +427,8 @@ int SSPIEm_init(unsigned int algoID)
 	else 
 	{
 		putChunk(&headerCS, (unsigned int) currentByte);
-		/* check STACKREQ */
-		if(!VME_getByte(&currentByte, 0, 0, 0) || 
-			currentByte > MAXSTACK)
+		/* the nesting the control stack starts with */
+		if(!VME_getByte(&currentByte, 0, 0, 0))
 		{
 			#ifdef	DEBUG_LEVEL_1
 			dbgu_putint(DBGU_L1_MISMATCH, NO_STACKREQ);
@@ -237,6 +438,7 @@ int SSPIEm_init(unsigned int algoID)
 		/* no STACKREQ byte available */
 		else{
 			putChunk(&headerCS, (unsigned int) currentByte);
+			stackReq = currentByte;
 		}
 	}
 	/* check MASKBUFREQ */
@@ -249,15 +451,18 @@ int SSPIEm_init(unsigned int algoID)
 	}
 	else {
 		putChunk(&headerCS, (unsigned int) currentByte);
-		if(!VME_getByte(&currentByte, 0, 0, 0) || 
-			currentByte > MAX_MASKSIZE){	
+		/* the mask size, in bytes, masks are read up to */
+		if(!VME_getByte(&currentByte, 0, 0, 0)){
 			#ifdef DEBUG_LEVEL_1
 			dbgu_putint(DBGU_L1_MISMATCH, NO_MASKBUFREQ); 
 			#endif
 			return ERROR_INIT;
 		}
-		else
+		else{
 			putChunk(&headerCS, (unsigned int) currentByte);
+			maskReq  = currentByte;
+			maskBits = maskReq * 8 > MAX_MASKSIZE ? maskReq * 8 : MAX_MASKSIZE;
+		}
 	}
 	/* store Channel */
 	if(!VME_getByte(&currentByte, 0, 0, 0) ||
@@ -371,259 +576,312 @@ int SSPIEm_init(unsigned int algoID)
 **************************************************************************/
 
 /**************************************************************************
-* Function SSPI_process
-* The main function of the processing engine.  During regular time,
-* it automatically gets byte from external storage.  However, this 
-* function requires an array of buffered algorithm during 
-* loop / repeat operations.  Input bufferedAlgo must be 0 to indicate
-* regular operation.
+* Function SSPIEm_process
+* The main function of the processing engine.  It gets the algorithm
+* byte by byte from external storage and runs it in one loop, whatever
+* the nesting of LOOP and REPEAT blocks in it.
 *
-* To call the VME, simply call SSPI_processVME(int debug, 0, 0, 0);
-* Having input for this function is better suited for internal use.
-* We highly recommend not to use any input in external environment.
-*
-* Input:
-* debug				- 0 for normal mode, 1 for debug mode
-* Internal Input:
-* *bufferedAlgo		- array of algorithm during loop / repeat operation
-* bufferedAlgoSize	- max size of buffer
-* repeatVar			- special input for repeat only
+* A LOOP or REPEAT buffers its body, pushes a frame on the control
+* stack and the loop goes on in the body.  The end of the body, or an
+* error in it, goes to proc_END() which runs the body again or pops the
+* frame.  TRANSIN and TRANSOUT start a transmission, processed one
+* opcode at a time by proc_TRANS() until ENDTRAN.  A REPEAT met in a
+* transmission runs its body at this level and the transmission goes
+* on after it, so each such REPEAT has the state of the transmission
+* it was met in saved on the transmission stack.
 *
+* Both stacks are in the arena SSPIEm_init() opened for the nesting
+* measured, the session is closed at the end.
 *
 * Output (procReturn value):
-* 0	- Process fail
-* 1	- Process complete
-* 2	- Process successfully over
+* PROC_OVER	- Process successfully over
+* other		- error code
 **************************************************************************/
-int SSPIEm_process(unsigned char *bufAlgo, unsigned int bufAlgoSize)
+int SSPIEm_process()
 {
-	unsigned int	bufAlgoIndex = 0;
-	short int		procReturn   = PROC_COMPLETE;
+	SSPIEm_state	state;
+	SSPIEm_trans	*trans		= 0;
+	int		procReturn   = PROC_COMPLETE;
 	unsigned char	currentByte  = 0;
 	unsigned int	temp         = 0;
+	unsigned long long profStart = 0;
+
+	state.bufAlgo      = 0;
+	state.bufAlgoSize  = 0;
+	state.bufAlgoIndex = 0;
+	state.depth        = 0;
+	state.transDepth   = 0;
+	state.transmitting = 0;
 	#ifdef	DEBUG_LEVEL_2
-	if(bufAlgo == 0)
-		dbgu_putint(DBGU_L2_PROC, START_PROC);
-	else	
-		dbgu_putint(DBGU_L2_PROC, START_PROC_BUFFER);
+	dbgu_putint(DBGU_L2_PROC, START_PROC);
 	#endif
+	if(!arena)
+		procReturn = ERROR_PROC_ALGO;
+
 	while(procReturn == PROC_COMPLETE)
 	{
-		/************************************************************************
-		*	Under STANDBY state, it allows opcode STARTTRAN, WAIT, LOOP, REPEAT
-		*	If it is in LOOP or REPEAT, it also allows CONDITION
-		************************************************************************/
-
-		if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, &bufAlgoIndex)){
-			if(bufAlgo != 0){	
-				#ifdef	DEBUG_LEVEL_2
-				dbgu_putint(DBGU_L2_PROC, END_PROC_BUFFER); 
-				#endif
-				return PROC_OVER;
-			}
-			else{
-				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_ALGO_PROC, UNABLE_TO_GET_BYTE);
-				#endif
-				return ERROR_PROC_ALGO;
-			}
-		}
-		switch(currentByte)
+		if(state.transmitting)
 		{
-		case HCOMMENT:
-			if(proc_HCOMMENT(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0) == PROC_FAIL)
+			trans = &transStack[state.transDepth];
+			procReturn = proc_TRANS(trans, state.bufAlgo,
+				state.bufAlgo ? state.bufAlgoSize + 1 : 0,
+				&state.bufAlgoIndex);
+			if(procReturn == PROC_NEXT)
 			{
-				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_ALGO_PROC, COMMENT_END_UNEXPECTED);
-				#endif
-				return ERROR_PROC_ALGO;
+				procReturn = PROC_COMPLETE;
+				continue;
 			}
-			break;
-		case STARTTRAN:	/* starts transmission */
-			#ifdef	DEBUG_LEVEL_2
-			dbgu_putint(DBGU_L2_PROC, ENTER_STARTTRAN);
-			#endif
-
-			if(TRANS_starttranx( getCurrentChannel() ) == PROC_FAIL){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_TRANX_PROC, STARTTRAN_FAIL);
+			if(procReturn == PROC_NEST)
+			{
+				procReturn = proc_BEGIN(&state, REPEAT, trans->repeatMax, 1,
+					trans->profStart);
+				if(procReturn == PROC_COMPLETE)
+				{
+					state.transmitting = 0;
+					continue;
+				}
+				#ifdef	DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_PROCESS, REPEAT_FAIL);
 				#endif
-				return ERROR_PROC_HARDWARE;
+				procReturn = ERROR_PROC_ALGO;
 			}
-			break;
-		case TRANSIN:
-		case TRANSOUT:
-			//************************************************************************
-			//* Under STARTTRAN, opcode TRANSOUT, TRANSIN are allowed.  Since the 
-			//* SSPI Embedded system operates under Master SPI mode, it always does
-			//* TRANSOUT first.
-			//************************************************************************
-			if(bufAlgo == 0)
-				procReturn = proc_TRANS(bufAlgo, bufAlgoSize, &bufAlgoIndex, getCurrentChannel(),currentByte);
-			else
-				procReturn = proc_TRANS(&(bufAlgo[bufAlgoIndex]), bufAlgoSize, &bufAlgoIndex, getCurrentChannel(),currentByte);
+			/* the transmission is over */
+			state.transmitting = 0;
 			if(procReturn <= 0){
 				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_PROCESS, TRANX_FAIL);//"Transmission fail", 
+				dbgu_putint(DBGU_L1_PROCESS, TRANX_FAIL);//"Transmission fail",
 				#endif
 			}
-			break;
-		case RUNCLOCK:
-			#ifdef	DEBUG_LEVEL_2
-			dbgu_putint(DBGU_L2_PROC, ENTER_RUNCLOCK);
-			#endif
-			if(!TRANS_runClk()){
-				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_PROCESS, RUNCLOCK_FAIL);
+			PROF_end(PROF_PROCESS, trans->opcode, trans->procStart);
+		}
+		else if(!VME_getByte(&currentByte, state.bufAlgo, state.bufAlgoSize,
+			&state.bufAlgoIndex))
+		{
+			if(state.bufAlgo != 0){
+				#ifdef	DEBUG_LEVEL_2
+				dbgu_putint(DBGU_L2_PROC, END_PROC_BUFFER);
 				#endif
-				procReturn = ERROR_PROC_HARDWARE;
+				procReturn = PROC_OVER;
 			}
-			break;
-		case REPEAT:
-			#ifdef	DEBUG_LEVEL_2
-			dbgu_putint(DBGU_L2_PROC, ENTER_REPEAT);
-			#endif
-			
-			/************************************************************************
-			* REPEAT opcode is followed by the number of repeats.
-			* Then it start processing the transmission by calling proc_REPEAT().
-			************************************************************************/
-			temp = VME_getNumber(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0);
-			if(temp == PROC_FAIL){
+			else{
 				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_REPEAT);
+				dbgu_putint(DBGU_L1_ALGO_PROC, UNABLE_TO_GET_BYTE);
 				#endif
 				procReturn = ERROR_PROC_ALGO;
 			}
-			else{
-				a_uiCheckFailedRow = 1;
-				a_uiRowCount      = 1;
-				if(bufAlgo == 0)
-					procReturn = proc_REPEAT(bufAlgo, bufAlgoSize, 
-						&bufAlgoIndex, temp);
-				else
-					procReturn = proc_REPEAT(&(bufAlgo[bufAlgoIndex]), 
-						bufAlgoSize, &bufAlgoIndex, temp);
-				a_uiCheckFailedRow = 0;
-				if(procReturn <= 0){
+		}
+		else
+		{
+			/************************************************************************
+			*	Under STANDBY state, it allows opcode STARTTRAN, WAIT, LOOP, REPEAT
+			*	If it is in LOOP or REPEAT, it also allows CONDITION
+			************************************************************************/
+			profStart = PROF_begin();
+			switch(currentByte)
+			{
+			case HCOMMENT:
+				if(proc_HCOMMENT(state.bufAlgo, state.bufAlgoSize,
+					&state.bufAlgoIndex, 0) == PROC_FAIL)
+				{
 					#ifdef	DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_PROCESS, REPEAT_FAIL);
+					dbgu_putint(DBGU_L1_ALGO_PROC, COMMENT_END_UNEXPECTED);
 					#endif
+					procReturn = ERROR_PROC_ALGO;
+					profStart = 0;
 				}
-			}
-			break;
-		case LOOP:		
-			#ifdef	DEBUG_LEVEL_2
-			dbgu_putint(DBGU_L2_PROC, ENTER_LOOP); 
-			#endif
-			
-			/************************************************************************
-			* LOOP opcode is followed by the max number of looping, then it process
-			* the transmission by calling proc_LOOP().
-			*************************************************************************/
+				break;
+			case STARTTRAN:	/* starts transmission */
+				#ifdef	DEBUG_LEVEL_2
+				dbgu_putint(DBGU_L2_PROC, ENTER_STARTTRAN);
+				#endif
 
-			temp = VME_getNumber(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0);
-			if(temp == PROC_FAIL){
-				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_LOOP);
+				if(TRANS_starttranx( getCurrentChannel() ) == PROC_FAIL){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_TRANX_PROC, STARTTRAN_FAIL);
+					#endif
+					procReturn = ERROR_PROC_HARDWARE;
+					profStart = 0;
+				}
+				break;
+			case TRANSIN:
+			case TRANSOUT:
+				//************************************************************************
+				//* Under STARTTRAN, opcode TRANSOUT, TRANSIN are allowed.  Since the
+				//* SSPI Embedded system operates under Master SPI mode, it always does
+				//* TRANSOUT first.  The transmission starts with this opcode.
+				//************************************************************************
+				trans = &transStack[state.transDepth];
+				trans->currentByte  = currentByte;
+				trans->opcode       = currentByte;
+				trans->trCount      = 0;
+				trans->byteNum      = 0;
+				trans->flag_mask    = 0;
+				trans->flag_transin = 0;
+				trans->mismatch     = 0;
+				trans->procStart    = profStart;
+				state.transmitting  = 1;
+				continue;
+			case RUNCLOCK:
+				#ifdef	DEBUG_LEVEL_2
+				dbgu_putint(DBGU_L2_PROC, ENTER_RUNCLOCK);
 				#endif
-				procReturn = ERROR_PROC_ALGO;
-			}
-			else{
-				if(bufAlgo == 0){
-					procReturn = proc_LOOP(bufAlgo, bufAlgoSize, &bufAlgoIndex, temp);
+				if(!TRANS_runClk()){
+					#ifdef	DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_PROCESS, RUNCLOCK_FAIL);
+					#endif
+					procReturn = ERROR_PROC_HARDWARE;
+				}
+				break;
+			case REPEAT:
+				#ifdef	DEBUG_LEVEL_2
+				dbgu_putint(DBGU_L2_PROC, ENTER_REPEAT);
+				#endif
+
+				/************************************************************************
+				* REPEAT opcode is followed by the number of repeats.
+				* Then the body is processed on a frame pushed by proc_BEGIN().
+				************************************************************************/
+				temp = VME_getNumber(state.bufAlgo, state.bufAlgoSize,
+					&state.bufAlgoIndex, 0);
+				if(temp == PROC_FAIL){
+					#ifdef	DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_REPEAT);
+					#endif
+					procReturn = ERROR_PROC_ALGO;
 				}
 				else{
-					procReturn = proc_LOOP(&(bufAlgo[bufAlgoIndex]), bufAlgoSize, &bufAlgoIndex, temp);
+					a_uiCheckFailedRow = 1;
+					a_uiRowCount      = 1;
+					procReturn = proc_BEGIN(&state, REPEAT, temp, 0, profStart);
+					if(procReturn == PROC_COMPLETE)
+						continue;
+					a_uiCheckFailedRow = 0;
+					#ifdef	DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_PROCESS, REPEAT_FAIL);
+					#endif
+				}
+				break;
+			case LOOP:
+				#ifdef	DEBUG_LEVEL_2
+				dbgu_putint(DBGU_L2_PROC, ENTER_LOOP);
+				#endif
+
+				/************************************************************************
+				* LOOP opcode is followed by the max number of looping, then the
+				* body is processed on a frame pushed by proc_BEGIN().
+				*************************************************************************/
+
+				temp = VME_getNumber(state.bufAlgo, state.bufAlgoSize,
+					&state.bufAlgoIndex, 0);
+				if(temp == PROC_FAIL){
+					#ifdef	DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_LOOP);
+					#endif
+					procReturn = ERROR_PROC_ALGO;
 				}
-				if(procReturn <= 0){
+				else{
+					procReturn = proc_BEGIN(&state, LOOP, temp, 0, profStart);
+					if(procReturn == PROC_COMPLETE)
+						continue;
 					#ifdef	DEBUG_LEVEL_1
 					dbgu_putint(DBGU_L1_PROCESS, LOOP_FAIL);
 					#endif
 					procReturn = ERROR_LOOP_COND;
 				}
-			}
-			break;
-		case WAIT:		/* process WAIT */
-			#ifdef	DEBUG_LEVEL_2
-			dbgu_putint(DBGU_L2_PROC, ENTER_WAIT);"Enter WAIT", 
-			#endif
-			
-			/************************************************************************
-			* WAIT opcode is followed by wait time in millisecond, then it process
-			* the wait by calling proc_WAIT().
-			************************************************************************/
+				break;
+			case WAIT:		/* process WAIT */
+				#ifdef	DEBUG_LEVEL_2
+				dbgu_putint(DBGU_L2_PROC, ENTER_WAIT);"Enter WAIT",
+				#endif
 
-			temp = VME_getNumber(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0);
-			if(temp == PROC_FAIL){
-				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_WAIT);
+				/************************************************************************
+				* WAIT opcode is followed by wait time in millisecond, then it process
+				* the wait by calling proc_WAIT().
+				************************************************************************/
+
+				temp = VME_getNumber(state.bufAlgo, state.bufAlgoSize,
+					&state.bufAlgoIndex, 0);
+				if(temp == PROC_FAIL){
+					#ifdef	DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_WAIT);
+					#endif
+					procReturn = ERROR_PROC_ALGO;
+				}
+				else{
+					procReturn = wait(temp);
+				}
+				break;
+			case RESETDATA:
+				if(!dataReset(1)){
+					#ifdef	DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_PROCESS, RESETDATA_FAIL);
+					#endif
+					procReturn = ERROR_PROC_DATA;
+				}
+				break;
+			case ENDTRAN:
+				if(!TRANS_endtranx()){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_TRANX_PROC, ENDTRAN_FAIL);
+					#endif
+					procReturn = ERROR_PROC_HARDWARE;
+				}
+				break;
+			case ENDOFALGO:
+				#ifdef	DEBUG_LEVEL_2
+				if(state.bufAlgo != 0)
+					dbgu_putint(DBGU_L2_PROC, END_PROC_BUFFER);
+				else
+					dbgu_putint(DBGU_L2_PROC, END_PROC);
 				#endif
-				procReturn = ERROR_PROC_ALGO;
-			}
-			else{
-				procReturn = wait(temp);
-			}
-			break;
-		case RESETDATA:
-			if(!dataReset(1)){
+				procReturn = PROC_OVER;
+				break;
+			default:
 				#ifdef	DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_PROCESS, RESETDATA_FAIL);
-				#endif
-				procReturn = ERROR_PROC_DATA;
-			}
-			break;
-		case ENDTRAN:
-			if(!TRANS_endtranx()){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_TRANX_PROC, ENDTRAN_FAIL);
+				dbgu_putint(DBGU_L1_ALGO_PROC, UNRECOGNIZED_OPCODE);/*"Unrecognized opcode" */
 				#endif
-				procReturn = ERROR_PROC_HARDWARE;
+				procReturn = ERROR_PROC_ALGO;
+				profStart = 0;
+				break;
 			}
-			break;
-		case ENDOFALGO:
-			#ifdef	DEBUG_LEVEL_2
-			if(bufAlgo != 0)
-				dbgu_putint(DBGU_L2_PROC, END_PROC_BUFFER);
-			else
-				dbgu_putint(DBGU_L2_PROC, END_PROC);
-			#endif
-			procReturn = PROC_OVER;
-			break;
-		default:
-			#ifdef	DEBUG_LEVEL_1
-			dbgu_putint(DBGU_L1_ALGO_PROC, UNRECOGNIZED_OPCODE);/*"Unrecognized opcode" */
-			#endif
-			return ERROR_PROC_ALGO;
-			break;
+			PROF_end(PROF_PROCESS, currentByte, profStart);
 		}
+		/* the body, or the algorithm, is over */
+		if(procReturn != PROC_COMPLETE)
+			procReturn = proc_END(&state, procReturn);
 	}
-	if(bufAlgo == 0){
-		if( !algoFinal() )
-			procReturn = ERROR_PROC_ALGO;
-		if( !dataFinal() )
-			procReturn = ERROR_PROC_DATA;
-		if( !SPI_final() )
-			procReturn = ERROR_PROC_HARDWARE;
-	}
+	if( !algoFinal() )
+		procReturn = ERROR_PROC_ALGO;
+	if( !dataFinal() )
+		procReturn = ERROR_PROC_DATA;
+	if( !SPI_final() )
+		procReturn = ERROR_PROC_HARDWARE;
+	SSPIEm_close();
 	return procReturn;
 }
 
 /**************************************************************************
 * Function proc_TRANS
-* Start processing transmissions
+* Process one opcode of a transmission
+*
+* The opcode is trans->currentByte.  Once it is processed, the next one
+* is read into trans->currentByte.  In a buffered body bufAlgoSize lets
+* it read the byte after the body, the ENDLOOP / ENDREPEAT or the 0
+* after a body read from the algorithm, so a transmission still open at
+* the end of the body ends there as an unrecognized opcode.
 *
 * Input:
-* bufAlgo			- the pointer to buffered algorithm if available
-* bufAlgoSize		- the size of buffered algorithm
-*					  this field is discarded if bufAlgo is 0
-*	absBufAlgoIndex	- the pointer to the absolute Algorithm Index from 
-*					  the caller so proc_TRANS accumulates the absolute 
-*					  index while processing the transmission
+* trans			- state of the transmission
+* bufAlgo		- the pointer to buffered algorithm if available
+* bufAlgoSize	- the size of buffered algorithm
+*				  this field is discarded if bufAlgo is 0
+* bufAlgoIndex	- the current index in the buffered algorithm
 *
 * Return:
-* PROC_FAIL		- Transmission fail or mismatch appears
+* PROC_NEXT		- the transmission goes on with trans->currentByte
+* PROC_NEST		- REPEAT of trans->repeatMax, its body comes next
 * PROC_COMPLETE	- Transmission complete
+* other			- error code, ERROR_VERIFICATION on a mismatch
 **************************************************************************/
 
 #define NO_DATA		0
@@ -632,625 +890,590 @@ int SSPIEm_process(unsigned char *bufAlgo, unsigned int bufAlgoSize)
 #define DATA_TX		3
 #define DATA_RX		4
 
-int proc_TRANS(unsigned char *bufAlgo, unsigned int bufAlgoSize, 
-			   unsigned int *absbufAlgoIndex, unsigned char channel, unsigned char currentByte)
+static int proc_TRANS(SSPIEm_trans *trans, unsigned char *bufAlgo,
+			   unsigned int bufAlgoSize, unsigned int *bufAlgoIndex)
 {
-
-	unsigned char trBuffer[MAXTRANSBUF];
-	unsigned char maskBuffer[MAX_MASKSIZE / 8];
-	int trCount = 0;
-	unsigned int bufAlgoIndex = 0;
-	short int flag_mask = 0;
-	short int flag_transin = 0;
-	int byteNum = 0;
+	unsigned char currentByte = trans->currentByte;
+	unsigned char profOpcode = currentByte;
 	short int retVal = 0;
-	unsigned int mismatch = 0;	
 	int temp;
 	int i;
 
-	while(retVal != PROC_OVER){
-		switch (currentByte){
-			case HCOMMENT:
-				if(proc_HCOMMENT(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0) == PROC_FAIL){
-					#ifdef	DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_ALGO_PROC, COMMENT_END_UNEXPECTED);
-					#endif
-					return ERROR_PROC_ALGO;
-				}
-				break;
-			case WAIT:
-				//************************************************************************
-				//* WAIT opcode is followed by wait time in millisecond, then it process
-				//* the wait by calling proc_WAIT().
-				//************************************************************************
+	trans->profStart = PROF_begin();
+	switch (currentByte){
+		case HCOMMENT:
+			if(proc_HCOMMENT(bufAlgo, bufAlgoSize, bufAlgoIndex, 0) == PROC_FAIL){
+				#ifdef	DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_ALGO_PROC, COMMENT_END_UNEXPECTED);
+				#endif
+				return ERROR_PROC_ALGO;
+			}
+			break;
+		case WAIT:
+			//************************************************************************
+			//* WAIT opcode is followed by wait time in millisecond, then it process
+			//* the wait by calling proc_WAIT().
+			//************************************************************************
 
-				temp = VME_getNumber(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0);
-				if(temp == PROC_FAIL){
-					#ifdef	DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_WAIT);//"No millisecond after WAIT", 
-					#endif
-					return ERROR_PROC_ALGO;
-				}
-				else{
-					wait(temp);
-				}
-				break;
-			// since the proc system is Master SPI, it always transmit data out first
-			case TRANSOUT:
-				#ifdef DEBUG_LEVEL_2
-				dbgu_putint(15,2);//"Enter TRANSOUT",
+			temp = VME_getNumber(bufAlgo, bufAlgoSize, bufAlgoIndex, 0);
+			if(temp == PROC_FAIL){
+				#ifdef	DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_WAIT);//"No millisecond after WAIT",
 				#endif
-				// get transmit size in bits, whether the data is compressed or not
-				trCount = VME_getNumber(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0);
-				if(trCount == PROC_FAIL){
+				return ERROR_PROC_ALGO;
+			}
+			else{
+				wait(temp);
+			}
+			break;
+		// since the proc system is Master SPI, it always transmit data out first
+		case TRANSOUT:
+			#ifdef DEBUG_LEVEL_2
+			dbgu_putint(15,2);//"Enter TRANSOUT",
+			#endif
+			// get transmit size in bits, whether the data is compressed or not
+			trans->trCount = VME_getNumber(bufAlgo, bufAlgoSize, bufAlgoIndex, 0);
+			if(trans->trCount == PROC_FAIL){
+				#ifdef DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSOUT_SIZE);//"No byte available at Size",
+				#endif
+				return ERROR_PROC_ALGO;		// no byte available at Size
+			}
+			trans->byteNum = trans->trCount / 8;
+			if(trans->trCount % 8 != 0)
+				trans->byteNum ++;
+			// check if the next Byte is DATA or DATAM
+			if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, bufAlgoIndex)){
 					#ifdef DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSOUT_SIZE);//"No byte available at Size", 
+					dbgu_putint(DBGU_L1_ALGO_TRANX,NO_TRANSOUT_TYPE);//"Algo error: no byte available at DATA type",
 					#endif
-					return ERROR_PROC_ALGO;		// no byte available at Size
-				}
-				byteNum = trCount / 8;
-				if(trCount % 8 != 0)
-					byteNum ++;
-				// check if the next Byte is DATA or DATAM
-				if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, &bufAlgoIndex)){
-						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_ALGO_TRANX,NO_TRANSOUT_TYPE);//"Algo error: no byte available at DATA type", 
-						#endif
-					return ERROR_PROC_ALGO;		// no byte available at DATA type
-				}
-				if( currentByte == ALGODATA)
-				{
-
-					// buffer transmit bytes
-					for(i=0; i< byteNum; i++){
-						if(!VME_getByte(&(trBuffer[i]), bufAlgo, bufAlgoSize, &bufAlgoIndex)){
-							#ifdef DEBUG_LEVEL_1
-							dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSOUT_DATA);//"Algo error: no byte available for transmit",
-							#endif
-							return ERROR_PROC_ALGO;
-						}
-					}
-//printf("trans1\n");
-					retVal = TRANS_transceive_stream(trCount, trBuffer, 0, NO_DATA, 0, flag_mask, maskBuffer);
-					if( retVal <= 0 && retVal != ERROR_VERIFICATION ){
-						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OPCODE_FAIL);
-						#endif
-						return retVal;
-					}
+				return ERROR_PROC_ALGO;		// no byte available at DATA type
+			}
+			if( currentByte == ALGODATA)
+			{
+				if(trans->byteNum > session.algoBytes){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSOUT_DATA);
+					#endif
+					return ERROR_PROC_ALGO;
 				}
-				else if( currentByte == PROGDATAEH)
-				{
-//printf("trans2\n");
-					retVal = TRANS_transceive_stream(0, trBuffer, trCount, DATA_TX, &currentByte, flag_mask, maskBuffer);
-					if(retVal <= 0){
+				// buffer transmit bytes
+				for(i=0; i< trans->byteNum; i++){
+					if(!VME_getByte(&(trans->trBuffer[i]), bufAlgo, bufAlgoSize, bufAlgoIndex)){
 						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_PROG_FAIL);
+						dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSOUT_DATA);//"Algo error: no byte available for transmit",
 						#endif
-						return retVal;
+						return ERROR_PROC_ALGO;
 					}
-
 				}
-				else
-				{
+				retVal = TRANS_transceive_stream(trans->trCount, trans->trBuffer, 0, NO_DATA, 0,
+					trans->flag_mask, trans->maskBuffer);
+				if( retVal <= 0 && retVal != ERROR_VERIFICATION ){
 					#ifdef DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_ALGO_TRANX,NO_TRANSOUT_TYPE);//"Algo error: no byte available at DATA type", 
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OPCODE_FAIL);
 					#endif
-					return ERROR_PROC_ALGO;		// no byte available at DATA type
+					return retVal;
 				}
-				flag_transin = 0;
-				break;
-			case ALGODATA:
-				if(!flag_transin)
-				{
-//printf("trans3\n");
-					retVal = TRANS_transceive_stream(0, 0, trCount, BUFFER_TX, trBuffer,flag_mask, maskBuffer);
-					if(retVal <= 0){
-						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_ALGO_FAIL); 
-						#endif
-						return retVal;
-					}
+			}
+			else if( currentByte == PROGDATAEH)
+			{
+				retVal = TRANS_transceive_stream(0, trans->trBuffer, trans->trCount, DATA_TX,
+					&currentByte, trans->flag_mask, trans->maskBuffer);
+				if(retVal <= 0){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_PROG_FAIL);
+					#endif
+					return retVal;
 				}
-				else
-				{
-//printf("trans4\n");
-					retVal = TRANS_transceive_stream(0, 0, trCount, BUFFER_RX, trBuffer, flag_mask, maskBuffer);
-					if(retVal <= 0 && retVal != ERROR_VERIFICATION){
-						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_IN_ALGO_FAIL);//"Transmit error: unable to transmit", 
-						#endif
-						return retVal;
-					}
 
-					for(i=0; i< byteNum; i++){
-						if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, &bufAlgoIndex)){
-							#ifdef DEBUG_LEVEL_1
-							dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSIN_DATA);//"Algo error: no byte available for transmit", 
-							#endif
-							return ERROR_PROC_ALGO;
-						}
-										
-						if(flag_mask)
-						{
-							trBuffer[i] = trBuffer[i] & maskBuffer[i];
-							currentByte  = currentByte & maskBuffer[i];
-						}
-						else if(i == byteNum - 1 && trCount % 8 != 0)
-						{
-//printf("correction\n");
-							trBuffer[i] = trBuffer[i] & (~((unsigned char) (0xFF >> (trCount % 8))));
-						}
-
-						if(trBuffer[i] != currentByte)
-						{
-//printf("mismatch %d 0x%02x 0x%02x\n", i, trBuffer[i], currentByte);
-							mismatch ++;
-						}
-					}
+			}
+			else
+			{
+				#ifdef DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_ALGO_TRANX,NO_TRANSOUT_TYPE);//"Algo error: no byte available at DATA type",
+				#endif
+				return ERROR_PROC_ALGO;		// no byte available at DATA type
+			}
+			trans->flag_transin = 0;
+			break;
+		case ALGODATA:
+			if(trans->byteNum > session.algoBytes){
+				#ifdef DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_ALGO_TRANX, trans->flag_transin ?
+					NO_TRANSIN_DATA : NO_TRANSOUT_DATA);
+				#endif
+				return ERROR_PROC_ALGO;
+			}
+			if(!trans->flag_transin)
+			{
+				retVal = TRANS_transceive_stream(0, 0, trans->trCount, BUFFER_TX, trans->trBuffer,
+					trans->flag_mask, trans->maskBuffer);
+				if(retVal <= 0){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_ALGO_FAIL);
+					#endif
+					return retVal;
 				}
-				break;
-			case PROGDATA:
-				if(!flag_transin)
-				{
-//printf("trans5\n");
-					retVal = TRANS_transceive_stream(0, trBuffer, trCount, DATA_TX, 0, flag_mask, maskBuffer);
-					if(retVal <= 0){
-						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_PROG_FAIL);
-						#endif
-						return retVal;
-					}
+			}
+			else
+			{
+				retVal = TRANS_transceive_stream(0, 0, trans->trCount, BUFFER_RX, trans->trBuffer,
+					trans->flag_mask, trans->maskBuffer);
+				if(retVal <= 0 && retVal != ERROR_VERIFICATION){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_IN_ALGO_FAIL);//"Transmit error: unable to transmit",
+					#endif
+					return retVal;
 				}
-				else
-				{
-//printf("trans6\n");
-					retVal = TRANS_transceive_stream(0, trBuffer, trCount, DATA_RX, 0, flag_mask, maskBuffer);
-					if(retVal <= 0 && retVal != ERROR_VERIFICATION){
+
+				for(i=0; i< trans->byteNum; i++){
+					if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, bufAlgoIndex)){
 						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_IN_PROG_FAIL);//"Transmit error: unable to transmit", 
+						dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSIN_DATA);//"Algo error: no byte available for transmit",
 						#endif
-						return retVal;
+						return ERROR_PROC_ALGO;
 					}
-				}	
-				break;
-			case PROGDATAEH:
-				if(!flag_transin)
-				{
-//printf("trans7\n");
-					retVal = TRANS_transceive_stream(0, trBuffer, trCount, DATA_TX, &currentByte,flag_mask, maskBuffer);
-					if(retVal <= 0){
-						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_PROG_FAIL);
-						#endif
-						return retVal;
+
+					if(trans->flag_mask)
+					{
+						trans->trBuffer[i] = trans->trBuffer[i] & trans->maskBuffer[i];
+						currentByte  = currentByte & trans->maskBuffer[i];
+						CACHE_expect(i, currentByte, trans->maskBuffer[i], ERROR_VERIFICATION, 0);
 					}
-				}
-				else
-				{
-//printf("trans8\n");
-					retVal = TRANS_transceive_stream(0, trBuffer, trCount, DATA_RX, &currentByte, flag_mask, maskBuffer);
-					if(retVal <= 0 && retVal != ERROR_VERIFICATION){
-						#ifdef DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_IN_PROG_FAIL);//"Transmit error: unable to transmit", 
-						#endif
-						return retVal;
+					else if(i == trans->byteNum - 1 && trans->trCount % 8 != 0)
+					{
+						trans->trBuffer[i] = trans->trBuffer[i] &
+							(~((unsigned char) (0xFF >> (trans->trCount % 8))));
+						CACHE_expect(i, currentByte,
+							~((unsigned char) (0xFF >> (trans->trCount % 8))), ERROR_VERIFICATION, 0);
+					}
+					else
+						CACHE_expect(i, currentByte, 0xFF, ERROR_VERIFICATION, 0);
+
+					if(trans->trBuffer[i] != currentByte && !SPI_isDryRun())
+					{
+						trans->mismatch ++;
 					}
 				}
-				break;
-			case TRANSIN:
-				trCount = VME_getNumber(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0);
-				if(trCount == PROC_FAIL){
+			}
+			break;
+		case PROGDATA:
+			if(!trans->flag_transin)
+			{
+				retVal = TRANS_transceive_stream(0, trans->trBuffer, trans->trCount, DATA_TX, 0,
+					trans->flag_mask, trans->maskBuffer);
+				if(retVal <= 0){
 					#ifdef DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSIN_SIZE);//"No byte available at Size", 
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_PROG_FAIL);
 					#endif
-					return ERROR_PROC_ALGO;		// no byte available at Size
+					return retVal;
 				}
-
-				byteNum = trCount / 8;
-				if(trCount % 8 != 0)
-					byteNum ++;
-				flag_transin = 1;
-				break;
-			case MASK:
-				if(trCount <= MAX_MASKSIZE){
-					for(i = 0; i< byteNum; i++){
-						if(!VME_getByte(&(maskBuffer[i]), bufAlgo, bufAlgoSize, &bufAlgoIndex)){
-							#ifdef DEBUG_LEVEL_1
-							dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSIN_MASK);//"No byte available at Mask", 
-							#endif
-							return ERROR_PROC_ALGO;		// no byte available at Mask
-						}
-					}
-					flag_mask = 1;
+			}
+			else
+			{
+				retVal = TRANS_transceive_stream(0, trans->trBuffer, trans->trCount, DATA_RX, 0,
+					trans->flag_mask, trans->maskBuffer);
+				if(retVal <= 0 && retVal != ERROR_VERIFICATION){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_IN_PROG_FAIL);//"Transmit error: unable to transmit",
+					#endif
+					return retVal;
 				}
-				break;
-			case ENDTRAN:
-				if(!TRANS_endtranx()){
+			}
+			break;
+		case PROGDATAEH:
+			if(!trans->flag_transin)
+			{
+				retVal = TRANS_transceive_stream(0, trans->trBuffer, trans->trCount, DATA_TX,
+					&currentByte, trans->flag_mask, trans->maskBuffer);
+				if(retVal <= 0){
 					#ifdef DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_TRANX_PROC, ENDTRAN_FAIL);
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_OUT_PROG_FAIL);
 					#endif
-					return ERROR_PROC_HARDWARE;
+					return retVal;
 				}
-				if(bufAlgo != 0)
-					(*absbufAlgoIndex) += bufAlgoIndex;
-				if(mismatch){
-					return ERROR_VERIFICATION;
+			}
+			else
+			{
+				retVal = TRANS_transceive_stream(0, trans->trBuffer, trans->trCount, DATA_RX,
+					&currentByte, trans->flag_mask, trans->maskBuffer);
+				if(retVal <= 0 && retVal != ERROR_VERIFICATION){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_TRANX_PROC, TRANX_IN_PROG_FAIL);//"Transmit error: unable to transmit",
+					#endif
+					return retVal;
 				}
-				else
-					return PROC_COMPLETE;
-				break;
-			case REPEAT:
-				// starts repeat. Buffer whatever in the repeat loop.
-				//************************************************************************
-				//* REPEAT opcode is followed by the number of repeats.
-				//* Then it start processing the transmission by calling proc_REPEAT().
-				//************************************************************************
-				temp = VME_getNumber(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0);
-				if(temp == PROC_FAIL){
-					#ifdef	DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_REPEAT);
+			}
+			break;
+		case TRANSIN:
+			trans->trCount = VME_getNumber(bufAlgo, bufAlgoSize, bufAlgoIndex, 0);
+			if(trans->trCount == PROC_FAIL){
+				#ifdef DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSIN_SIZE);//"No byte available at Size",
+				#endif
+				return ERROR_PROC_ALGO;		// no byte available at Size
+			}
+
+			trans->byteNum = trans->trCount / 8;
+			if(trans->trCount % 8 != 0)
+				trans->byteNum ++;
+			trans->flag_transin = 1;
+			break;
+		case MASK:
+			if(trans->trCount <= maskBits){
+				if(trans->byteNum > session.maskBytes){
+					#ifdef DEBUG_LEVEL_1
+					dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSIN_MASK);
 					#endif
 					return ERROR_PROC_ALGO;
 				}
-				else{
-					if(bufAlgo == 0)
-						retVal = proc_REPEAT(bufAlgo, bufAlgoSize, &bufAlgoIndex, temp);
-					else
-						retVal = proc_REPEAT(&(bufAlgo[bufAlgoIndex]), bufAlgoSize, &bufAlgoIndex, temp);
-					if(retVal <= 0){
-						#ifdef	DEBUG_LEVEL_1
-						dbgu_putint(DBGU_L1_PROCESS, REPEAT_FAIL);
+				for(i = 0; i< trans->byteNum; i++){
+					if(!VME_getByte(&(trans->maskBuffer[i]), bufAlgo, bufAlgoSize, bufAlgoIndex)){
+						#ifdef DEBUG_LEVEL_1
+						dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANSIN_MASK);//"No byte available at Mask",
 						#endif
-						return ERROR_PROC_ALGO;	
-					}
-				}
-				break;
-			case RESETDATA:
-				if(!dataReset(1)){
-					#ifdef	DEBUG_LEVEL_1
-					dbgu_putint(DBGU_L1_PROCESS, RESETDATA_FAIL);// fail to reset data
-					#endif
-					retVal = ERROR_PROC_DATA;
-				}
-				break;
-			default:
-				if(bufAlgo != 0)
-				{
-					if(bufAlgo != 0)
-						(*absbufAlgoIndex) += bufAlgoIndex;
-					if(mismatch){
-						return ERROR_VERIFICATION;
+						return ERROR_PROC_ALGO;		// no byte available at Mask
 					}
-					else
-						return PROC_COMPLETE;
 				}
+				trans->flag_mask = 1;
+			}
+			break;
+		case ENDTRAN:
+			if(!TRANS_endtranx()){
 				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_ALGO_TRANX, UNRECOGNIZED_OPCODE);
+				dbgu_putint(DBGU_L1_TRANX_PROC, ENDTRAN_FAIL);
 				#endif
-				return ERROR_PROC_ALGO;
-				break;
-		}
-		if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, &bufAlgoIndex)){
+				return ERROR_PROC_HARDWARE;
+			}
+			PROF_end(PROF_TRANS, profOpcode, trans->profStart);
+			if(trans->mismatch){
 				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANX_OPCODE);
+				dbgu_putint(DBGU_L1_TRANX_PROC, COMPARE_FAIL);
+				#endif
+				return ERROR_VERIFICATION;
+			}
+			return PROC_COMPLETE;
+		case REPEAT:
+			// starts repeat, its body is processed on a frame pushed by
+			// proc_BEGIN() and the transmission goes on after it
+			//************************************************************************
+			//* REPEAT opcode is followed by the number of repeats.
+			//************************************************************************
+			temp = VME_getNumber(bufAlgo, bufAlgoSize, bufAlgoIndex, 0);
+			if(temp == PROC_FAIL){
+				#ifdef	DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_ALGO_PROC, NO_NUMBER_OF_REPEAT);
 				#endif
 				return ERROR_PROC_ALGO;
-		}
+			}
+			trans->repeatMax = temp;
+			return PROC_NEST;
+		case RESETDATA:
+			if(!dataReset(1)){
+				#ifdef	DEBUG_LEVEL_1
+				dbgu_putint(DBGU_L1_PROCESS, RESETDATA_FAIL);// fail to reset data
+				#endif
+				retVal = ERROR_PROC_DATA;
+			}
+			break;
+		default:
+			if(bufAlgo != 0)
+			{
+				if(trans->mismatch){
+					return ERROR_VERIFICATION;
+				}
+				else
+					return PROC_COMPLETE;
+			}
+			#ifdef DEBUG_LEVEL_1
+			dbgu_putint(DBGU_L1_ALGO_TRANX, UNRECOGNIZED_OPCODE);
+			#endif
+			return ERROR_PROC_ALGO;
 	}
-	if(bufAlgo != 0)
-		(*absbufAlgoIndex) += bufAlgoIndex;
-
-	if(retVal <= 0)
-		return retVal;
-
-	if(mismatch){
-		#ifdef DEBUG_LEVEL_1
-		dbgu_putint(DBGU_L1_TRANX_PROC, COMPARE_FAIL);
-		// internal debugging
-		dbgu_putint(15,mismatch);
-		#ifdef DEBUG_LEVEL_3
-		for (i=0; i<4; i++){
-			dbgu_putint(2,(unsigned int)(trBuffer[i] >> 4));//"Mismatch occurs", 
-			dbgu_putint(2,(unsigned int)(trBuffer[i] & 0x0f));//"Mismatch occurs", 
-		}
-		#endif
-		#endif
-		return ERROR_VERIFICATION;
+	PROF_end(PROF_TRANS, profOpcode, trans->profStart);
+	if(!VME_getByte(&trans->currentByte, bufAlgo, bufAlgoSize, bufAlgoIndex)){
+			#ifdef DEBUG_LEVEL_1
+			dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANX_OPCODE);
+			#endif
+			return ERROR_PROC_ALGO;
 	}
-	else
-		return PROC_COMPLETE;
-	
+	return PROC_NEXT;
 }
 
 /************************************************************************
-* Function proc_REPEAT
-* Process Repeat block
-*
-* Input:
-* bufAlgo		- the pointer to buffered algorithm if available
-* bufAlgoSize	- the size of buffered algorithm
-*				  this field is discarded if bufAlgo is 0
-*	absBufAlgoIndex	- the pointer to the absolute Algorithm Index from the caller
-*					  so proc_REPEAT accumulates the absolute index while
-*					  processing the transmission
-* LoopMax		- Max number of repeat
+* Function proc_BODY
+* Find the body of the LOOP or REPEAT just read, up to its ENDLOOP or
+* ENDREPEAT.  Read from the algorithm, the body is buffered in
+* algoBuffer without its comments and followed by a 0.  A nested body
+* is already in algoBuffer, where the enclosing frame keeps the last
+* one found so it is not scanned again on each pass.
 *
 * Return:
-* PROC_FAIL		- loop condition not met
-* PROC_COMPLETE	- loop condition met
+* PROC_COMPLETE	- body in [*start, *end) of algoBuffer
+* ERROR_PROC_ALGO	- body not ended or too large
 ************************************************************************/
-int proc_REPEAT(unsigned char *bufAlgo, unsigned int bufAlgoSize,
-				unsigned int *absBufAlgoIndex, unsigned int LoopMax)
+static int proc_BODY(SSPIEm_state *state, unsigned char opcode,
+				unsigned int *start, unsigned int *end)
 {
-	unsigned char		*bufferPtr   = 0;	/* loop / repeat buffer */
+	SSPIEm_frame		*parent      = 0;
 	unsigned int		bufferSize   = 0;	/* size of algorithm within loop / repeat */
-	unsigned int		loopCount    = 0;
-	unsigned int		stackIndex   = 0;
+	unsigned int		scanIndex    = 0;	/* nested LOOP / REPEAT */
+	unsigned int		bufAlgoIndex = state->bufAlgoIndex;
 	unsigned char		currentByte  = 0;
-	unsigned int		bufAlgoIndex = 0;
-	int					flag         = 1;	/* initialize to 1 for counting / buffering algo */
-										    /* when processing loop, flag becomes the condition */
-										    /* whether the loop succeed or fail. */
-
-
 	int i = 0;
-	// initialize bufferPtr.  If processed is not buffered, 
-	// it points to the beginning of buffer.  Else it points to where bufAlgo points to
-	if(bufAlgo == 0)
+
+	// initialize the buffer.  If processed is not buffered, it is read
+	// into the global buffer.  Else the body is where the index points to
+	if(state->bufAlgo == 0)
 	{
-		for(i = 0; i < MAXBUF; i++)
+		for(i = 0; i <= session.bodyBytes; i++)
 		{
 			algoBuffer[i] = 0;
 		}
-		bufferPtr = algoBuffer;	// points to the global buffer
+		*start = 0;
 	}
 	else
-		bufferPtr = bufAlgo;
+	{
+		parent = &frames[state->depth - 1];
+		*start = state->bufAlgoIndex;
+		if(parent->nestStart == *start && parent->nestEnd != 0)
+		{
+			*end = parent->nestEnd;
+			return PROC_COMPLETE;
+		}
+	}
 	#ifdef DEBUG_LEVEL_2
-	dbgu_putint(DBGU_L2_REPEAT, PREPARE_BUFFER);
+	dbgu_putint(opcode == LOOP ? DBGU_L2_LOOP : DBGU_L2_REPEAT, PREPARE_BUFFER);
 	#endif
-	do{
-		if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, &bufAlgoIndex)){
+	while(1){
+		if(!VME_getByte(&currentByte, state->bufAlgo, state->bufAlgoSize, &bufAlgoIndex)){
 			#ifdef DEBUG_LEVEL_1
-			dbgu_putint(DBGU_L1_REPEAT, BUFFER_FAIL);
+			dbgu_putint(opcode == LOOP ? DBGU_L1_LOOP : DBGU_L1_REPEAT, BUFFER_FAIL);
 			#endif
-			return ERROR_PROC_ALGO;			
+			return ERROR_PROC_ALGO;
 		}
+		/* discard comment for buffering */
 		if(currentByte == HCOMMENT){
-			if(proc_HCOMMENT(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0) == PROC_FAIL){
+			if(proc_HCOMMENT(state->bufAlgo, state->bufAlgoSize, &bufAlgoIndex, 0) == PROC_FAIL){
 				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_REPEAT, REPEAT_COMMENT_FAIL);
+				dbgu_putint(DBGU_L1_REPEAT, opcode == LOOP ? LOOP_COMMENT_FAIL : REPEAT_COMMENT_FAIL);
 				#endif
 				return ERROR_PROC_ALGO;
 			}
+			continue;
 		}
 		/* nested LOOP / REPEAT check
 		   if currentByte is LOOP or REPEAT, nested loop, put in stack */
 		else if(currentByte == LOOP || currentByte == REPEAT)
 		{
-			stack[stackIndex] = currentByte;
-			stackIndex++;
-		}
-		/* if currentByte is ENDREPEAT, pop from stack */
-		else if(currentByte == ENDREPEAT)
-		{
-			if(stackIndex == 0)
-				flag = 0;		/* end of loop */
-			else if(stack[stackIndex-1] != REPEAT){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_REPEAT, STACK_MISMATCH);/* Stack mismatch when buffering REPEAT */ 
-				#endif
+			if(scanIndex >= scanMax)
 				return ERROR_PROC_ALGO;
-			} 							
-			else
-				stackIndex--;
+			scanStack[scanIndex] = currentByte;
+			scanIndex++;
 		}
-		/* if currentByte is ENDLOOP, check if its end of loop, 
-		   or pop from stack if its end of nested loop */
-		else if(currentByte == ENDLOOP){
-			if(stackIndex == 0 || stack[stackIndex-1] != LOOP){
+		/* if currentByte is ENDREPEAT or ENDLOOP, check if its end of the
+		   body, or pop from stack if its end of nested loop */
+		else if(currentByte == ENDREPEAT || currentByte == ENDLOOP)
+		{
+			if(scanIndex == 0 && currentByte == (opcode == LOOP ? ENDLOOP : ENDREPEAT))
+				break;		/* end of loop */
+			if(scanIndex == 0 ||
+				scanStack[scanIndex-1] != (currentByte == ENDLOOP ? LOOP : REPEAT)){
 				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_REPEAT, STACK_MISMATCH);
+				dbgu_putint(opcode == LOOP ? DBGU_L1_LOOP : DBGU_L1_REPEAT, STACK_MISMATCH);
 				#endif
 				return ERROR_PROC_ALGO;
 			}
-			else
-				stackIndex--;
+			scanIndex--;
 		}
-		/* discard comment for buffering */
-		if(flag == 1 && currentByte != HCOMMENT){
-			if(bufferSize > MAXBUF){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_REPEAT , REPEAT_SIZE_EXCEED);
-				#endif
-				return ERROR_PROC_ALGO;
-			}
-			else{
-				if(bufAlgo == 0)
-					algoBuffer[bufferSize] = currentByte;
-				bufferSize++;
-			}
+		if(bufferSize >= session.bodyBytes){
+			#ifdef DEBUG_LEVEL_1
+			dbgu_putint(opcode == LOOP ? DBGU_L1_LOOP : DBGU_L1_REPEAT,
+				opcode == LOOP ? LOOP_SIZE_EXCEED : REPEAT_SIZE_EXCEED);
+			#endif
+			return ERROR_PROC_ALGO;
 		}
-	}while(flag == 1);
-
+		if(state->bufAlgo == 0)
+			algoBuffer[bufferSize] = currentByte;
+		bufferSize++;
+	}
 	#ifdef DEBUG_LEVEL_2
-	dbgu_putint(DBGU_L2_REPEAT, FINISH_BUFFER);/* End calculate REPEAT size, and buffer REPEAT */
+	dbgu_putint(opcode == LOOP ? DBGU_L2_LOOP : DBGU_L2_REPEAT, FINISH_BUFFER);
 	#endif
-	bufAlgoIndex = 0;
-	/* process REPEAT */
-	flag = 0;
-	loopCount = 0;
+	*end = *start + bufferSize;
+	if(parent != 0)
+	{
+		parent->nestStart = *start;
+		parent->nestEnd   = *end;
+	}
+	return PROC_COMPLETE;
+}
+
+/************************************************************************
+* Function proc_BEGIN
+* Start a LOOP or REPEAT block: buffer its body with proc_BODY(), push
+* a frame for it and go on at the beginning of the body.
+*
+* Input:
+* state			- state of the engine
+* opcode		- LOOP or REPEAT
+* LoopMax		- Max number of loop / repeat
+* inTrans		- 1 if the REPEAT was met in a transmission
+* profStart		- PROF_begin() of the opcode
+*
+* Return:
+* PROC_COMPLETE	- the body comes next
+* ERROR_PROC_ALGO	- body not ended, or larger or deeper than measured
+************************************************************************/
+static int proc_BEGIN(SSPIEm_state *state, unsigned char opcode,
+				unsigned int LoopMax, short int inTrans, unsigned long long profStart)
+{
+	SSPIEm_frame	*frame;
+	unsigned int	start = 0;
+	unsigned int	end   = 0;
+
+	if(state->depth >= framesMax ||
+		(inTrans && state->transDepth + 2 > transMax))
+		return ERROR_PROC_ALGO;
+	if(proc_BODY(state, opcode, &start, &end) != PROC_COMPLETE)
+		return ERROR_PROC_ALGO;
+
+	frame = &frames[state->depth];
+	frame->opcode    = opcode;
+	frame->inTrans   = inTrans;
+	frame->start     = start;
+	frame->end       = end;
+	frame->nestStart = 0;
+	frame->nestEnd   = 0;
+	frame->loopCount = 0;
+	frame->loopMax   = LoopMax;
+	frame->profStart = profStart;
+	state->depth++;
+	if(inTrans)
+		state->transDepth++;
+
+	state->bufAlgo      = algoBuffer;
+	state->bufAlgoSize  = end;
+	state->bufAlgoIndex = start;
+
 	#ifdef DEBUG_LEVEL_2
-	dbgu_putint(DBGU_L2_REPEAT, START_PROC_REPEAT);
+	dbgu_putint(opcode == LOOP ? DBGU_L2_LOOP : DBGU_L2_REPEAT,
+		opcode == LOOP ? START_PROC_LOOP : START_PROC_REPEAT);
 	#endif
-	do{
-		flag = SSPIEm_process(bufferPtr, bufferSize);
-		loopCount ++;
-	}while(flag == PROC_OVER && loopCount < LoopMax);
-	if(flag <= 0){
-		#ifdef DEBUG_LEVEL_1
-		dbgu_putint(DBGU_L1_REPEAT, REPEAT_COND_FAIL); /* REPEAT condition fails */
-		#endif
-		(*absBufAlgoIndex) += bufferSize + 1;
-		return flag;
-	}
-	else{
-		#ifdef DEBUG_LEVEL_2
-		dbgu_putint(DBGU_L2_REPEAT, END_PROC_REPEAT); /* End processing REPEAT */
-		#endif
-		(*absBufAlgoIndex) += bufferSize + 1;
-		return PROC_COMPLETE;
+	if(opcode == LOOP)
+	{
+		CACHE_loop(CACHE_LOOP_BEGIN, LoopMax);
+		CACHE_loop(CACHE_LOOP_PASS, LoopMax);
 	}
+	else
+		TRANS_repeat(TRANS_REPEAT_BEGIN);
+	return PROC_COMPLETE;
 }
+
 /**************************************************************************
-* Function proc_LOOP
-* Process Loop block
+* Function proc_END
+* A pass through the body on top of the control stack is over with
+* procReturn: PROC_OVER at the end of the body, or an error.
 *
-* The function will see if the processes is being buffered.  If the 
-* processes is not buffered, it buffers the processes.  Else it will
-* calculate the maximum of the buffer between LOOP - ENDLOOP block.
+* A REPEAT runs its body again while the passes end with PROC_OVER, a
+* LOOP while they fail, up to their max number of passes.  Note that the
+* format of the loop requires the condition check to be the end of the
+* loop block: the loop breaks once all the processes within the loop
+* succeed, so it is better to put the condition process, such as TRANS
+* with TRANSIN, as the last process in a loop.
 *
-* Note that the format of the loop requires the condition check to be 
-* the end of the loop block.  Once the last process succeed, the 
-* loop is completed.
-*
-* The loop will break if all the processes within the loop succeed.
-* It will continue if any step in the loop fails.  Therefore it is 
-* better to put the condition process, such as TRANS with TRANSIN, as
-* the last process in a loop so it will go through all the processes
-* before deciding whether the loop will continue or break.
-*
-* Input:
-* bufAlgo			- the pointer to buffered algorithm if available
-* bufAlgoSize		- the size of buffered algorithm
-*					  this field is discarded if bufAlgo is 0
-*	absBufAlgoIndex	- the pointer to the absolute Algorithm Index from the caller
-*					  so proc_LOOP accumulates the absolute index while
-*					  processing the transmission
-* LoopMax			- Max number of loop allowed
+* Once done, the frame is popped and the enclosing code goes on after
+* the block: a LOOP that never succeeded is ERROR_LOOP_COND there, a
+* failed REPEAT met in a transmission is ERROR_PROC_ALGO and ends it.
+* Failures end enclosing bodies in turn.
 *
 * Return:
-* PROC_FAIL		- loop condition not met
-* PROC_COMPLETE	- loop condition met
+* PROC_COMPLETE	- processing goes on
+* other			- the algorithm is over with this result
 **************************************************************************/
-int proc_LOOP(unsigned char *bufAlgo, unsigned int bufAlgoSize, 
-			  unsigned int *absBufAlgoIndex, unsigned int LoopMax)
+static int proc_END(SSPIEm_state *state, int procReturn)
 {
-	unsigned char		*bufferPtr     = 0;	/* loop buffer */
-	unsigned int		bufferSize     = 0;	/* size of algo within loop */
-	unsigned int		loopCount      = 0;
-	unsigned int		stackIndex     = 0;
-	unsigned char		currentByte    = 0;
-	unsigned int		bufAlgoIndex   = 0;
-	int		            flag           = 1; /* initialize to 1 for counting / buffering algo */
-										    /*when processing loop, flag becomes the condition */
-										    /*whether the loop succeed or fail. */
-
+	SSPIEm_frame	*frame;
+	SSPIEm_trans	*trans;
 
-	int i = 0;
-	// initialize bufferPtr.  If processed is not buffered, 
-	// it points to the beginning of buffer.  Else it points to where bufAlgo points to
-	if(bufAlgo == 0)
+	while(procReturn != PROC_COMPLETE && state->depth > 0)
 	{
-		for(i = 0; i < MAXBUF; i++)
+		frame = &frames[state->depth - 1];
+		frame->loopCount++;
+		/* a LOOP runs again on a failed condition, not on a SPI error */
+		if(frame->loopCount < frame->loopMax &&
+			(frame->opcode == REPEAT ? procReturn == PROC_OVER :
+			procReturn <= 0 && procReturn != ERROR_PROC_HARDWARE))
 		{
-			algoBuffer[i] = 0;
-		}
-		bufferPtr = algoBuffer;	// points to the global buffer
-	}
-	else
-		bufferPtr = bufAlgo;
-	#ifdef DEBUG_LEVEL_2
-	dbgu_putint(DBGU_L2_LOOP, PREPARE_BUFFER);
-	#endif
-	do{
-		if(!VME_getByte(&currentByte, bufAlgo, bufAlgoSize, &bufAlgoIndex)){
-			#ifdef DEBUG_LEVEL_1
-			dbgu_putint(DBGU_L1_LOOP, BUFFER_FAIL); 
-			#endif
-			return ERROR_PROC_ALGO;			
+			if(frame->opcode == LOOP)
+				CACHE_loop(CACHE_LOOP_PASS, frame->loopMax);
+			else
+				TRANS_repeat(TRANS_REPEAT_PASS);
+			state->bufAlgoIndex = frame->start;
+			return PROC_COMPLETE;
 		}
-		if(currentByte == HCOMMENT){
-			if(proc_HCOMMENT(bufAlgo, bufAlgoSize, &bufAlgoIndex, 0) == PROC_FAIL){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_REPEAT, LOOP_COMMENT_FAIL);
-				#endif
-				return ERROR_PROC_ALGO;
-			}
+
+		if(frame->opcode == LOOP)
+			CACHE_loop(CACHE_LOOP_END, frame->loopMax);
+		else
+			TRANS_repeat(TRANS_REPEAT_END);
+		PROF_iterations(frame->opcode, frame->loopCount);
+		#ifdef DEBUG_LEVEL_1
+		if(procReturn <= 0)
+			dbgu_putint(frame->opcode == LOOP ? DBGU_L1_LOOP : DBGU_L1_REPEAT,
+				frame->opcode == LOOP ? LOOP_COND_FAIL : REPEAT_COND_FAIL);
+		#endif
+
+		/* back to the enclosing code, after ENDLOOP / ENDREPEAT */
+		state->depth--;
+		if(state->depth == 0)
+		{
+			state->bufAlgo      = 0;
+			state->bufAlgoSize  = 0;
+			state->bufAlgoIndex = 0;
 		}
-		else if(currentByte == LOOP || currentByte == REPEAT){
-			stack[stackIndex] = currentByte;
-			stackIndex++;
+		else
+		{
+			state->bufAlgoSize  = frames[state->depth - 1].end;
+			state->bufAlgoIndex = frame->end + 1;
 		}
-		else if(currentByte == ENDREPEAT){
-			if(stackIndex == 0 || stack[stackIndex-1] != REPEAT){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_LOOP, STACK_MISMATCH);
-				#endif
-				return ERROR_PROC_ALGO;
+
+		if(!frame->inTrans)
+		{
+			if(frame->opcode == REPEAT)
+			{
+				a_uiCheckFailedRow = 0;
+				if(procReturn > 0)
+					procReturn = PROC_COMPLETE;
 			}
-			else
-				stackIndex--;
+			else if(procReturn != ERROR_PROC_HARDWARE)
+				procReturn = procReturn > 0 ? PROC_COMPLETE : ERROR_LOOP_COND;
+			PROF_end(PROF_PROCESS, frame->opcode, frame->profStart);
+			continue;
 		}
-		/* if currentByte is ENDLOOP, check if its end of loop, 
-		   or pop from stack if its end of nested loop */
-		else if(currentByte == ENDLOOP){
-			if(stackIndex == 0)
-				flag = 0;
-			else if(stack[stackIndex-1] != LOOP){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_LOOP, STACK_MISMATCH);
-				#endif
-				return ERROR_PROC_ALGO;
-			} 							
-			else
-				stackIndex--;
-		}
-		/* discard comment for buffering */
-		if(flag == 1 && currentByte != HCOMMENT){
-			if(bufferSize > MAXBUF){
-				#ifdef DEBUG_LEVEL_1
-				dbgu_putint(DBGU_L1_LOOP, LOOP_SIZE_EXCEED);/* Loop size exceed Maximum Buffer size */
-				#endif
-				return ERROR_PROC_ALGO;
-			}
-			else{
-				if(bufAlgo == 0)
-					algoBuffer[bufferSize] = currentByte;
-				bufferSize++;
+
+		state->transDepth--;
+		trans = &transStack[state->transDepth];
+		if(procReturn > 0)
+		{
+			PROF_end(PROF_TRANS, REPEAT, frame->profStart);
+			if(VME_getByte(&trans->currentByte, state->bufAlgo,
+				state->bufAlgo ? state->bufAlgoSize + 1 : 0, &state->bufAlgoIndex))
+			{
+				state->transmitting = 1;
+				return PROC_COMPLETE;
 			}
+			#ifdef DEBUG_LEVEL_1
+			dbgu_putint(DBGU_L1_ALGO_TRANX, NO_TRANX_OPCODE);
+			#endif
 		}
-	}while(flag == 1);
-	#ifdef DEBUG_LEVEL_2
-	dbgu_putint(DBGU_L2_LOOP, FINISH_BUFFER); /* End calculate LOOP size, and buffer LOOP */
-	#endif
-	bufAlgoIndex = 0;
-	/* process loop */
-	flag = 0;
-	loopCount = 0;
-	#ifdef DEBUG_LEVEL_2
-	dbgu_putint(DBGU_L2_LOOP, START_PROC_LOOP);
-	#endif
-	do{
-		flag = SSPIEm_process(bufferPtr, bufferSize);
-		loopCount ++;
-	}while(flag <= 0 && loopCount < LoopMax);
-	if(flag <= 0){
-		#ifdef DEBUG_LEVEL_1
-		dbgu_putint(DBGU_L1_LOOP, LOOP_COND_FAIL); /*LOOP condition not met */
-		#endif
-		(*absBufAlgoIndex) += bufferSize + 1;
-		return flag;
-	}	
-	else{
-		#ifdef DEBUG_LEVEL_2
-		dbgu_putint(DBGU_L2_LOOP, END_PROC_LOOP); /*End processing LOOP */ 
-		#endif
-		(*absBufAlgoIndex) += bufferSize + 1;
-		return PROC_COMPLETE;
+		/* the transmission it was met in is over */
+		procReturn = ERROR_PROC_ALGO;
+		PROF_end(PROF_PROCESS, trans->opcode, trans->procStart);
 	}
+	return procReturn;
 }
+
 /**************************************************************************
 * Function proc_HCOMMENT
 * Process comment block
@@ -1270,6 +1493,266 @@ int proc_HCOMMENT(unsigned char *bufferedAlgo, unsigned int bufferedAlgoSize,
 	}while(currentByte != HENDCOMMENT);
 	return PROC_COMPLETE;
 }
+/**************************************************************************
+* Function SSPIEm_walkBytes
+* Read count bytes of the algorithm into buffer, or skip them if buffer
+* is 0, and add them to *bytes.
+**************************************************************************/
+static int SSPIEm_walkBytes(unsigned char *buffer, unsigned int count,
+				unsigned int *bytes)
+{
+	unsigned char byte = 0;
+	unsigned int i;
+
+	for(i = 0; i < count; i++){
+		if(!algoGetByte(buffer ? &buffer[i] : &byte))
+			return 0;
+	}
+	*bytes += count;
+	return 1;
+}
+
+/**************************************************************************
+* Function SSPIEm_walkNumber
+* Read a number of the algorithm as VME_getNumber() does into *number and
+* add its bytes to *bytes.  Returns 0 at the end of the algorithm, where
+* VME_getNumber() can't tell PROC_FAIL from a number 0.
+**************************************************************************/
+static int SSPIEm_walkNumber(unsigned int *number, unsigned int *bytes)
+{
+	unsigned char byteIn = 0;
+	short int i          = 0;
+
+	*number = 0;
+	do{
+		if(!SSPIEm_walkBytes(&byteIn, 1, bytes))
+			return 0;
+		*number += (unsigned int) ((byteIn & 0x7F) << (7 * i));
+		i++;
+	}while(byteIn & 0x80);
+	return 1;
+}
+
+/**************************************************************************
+* Function SSPIEm_walkComment
+* Skip a comment of the algorithm up to its HENDCOMMENT, returns 0 if the
+* algorithm ends first.  Comments are not counted.
+**************************************************************************/
+static int SSPIEm_walkComment(void)
+{
+	unsigned char byte = 0;
+
+	do{
+		if(!algoGetByte(&byte))
+			return 0;
+	}while(byte != HENDCOMMENT);
+	return 1;
+}
+
+/**************************************************************************
+* Function SSPIEm_walk
+* Walk the algorithm after its header without touching the hardware,
+* see SSPIEm_measure() and SSPIEm_scan().
+*
+* sizes gets what the buffers of a session must hold for the algorithm.
+* Bodies are counted as proc_BODY() buffers them, without comments.
+* With a callback, the ALGODATA and MASK bytes are read into the first
+* transmission of the open session and every data phase is reported.
+**************************************************************************/
+static int SSPIEm_walk(SSPIEm_scanCallback callback, void *context,
+				SSPIEm_sizes *sizes)
+{
+	unsigned char *trBuffer   = callback ? transStack[0].trBuffer : 0;
+	unsigned char *maskBuffer = callback ? transStack[0].maskBuffer : 0;
+	unsigned char currentByte = 0;
+	unsigned int trCount      = 0;
+	unsigned int byteNum      = 0;
+	unsigned int number       = 0;	/* WAIT, REPEAT, LOOP */
+	unsigned int bytes        = 0;	/* read, without comments */
+	unsigned int bodyStart    = 0;
+	unsigned int depth        = 0;
+	short int flag_mask       = 0;
+	short int flag_transin    = 0;
+
+	memset(sizes, 0, sizeof(*sizes));
+	while(1){
+		if(!SSPIEm_walkBytes(&currentByte, 1, &bytes))
+			return ERROR_PROC_ALGO;
+		switch(currentByte){
+		case HCOMMENT:
+			bytes--;
+			if(!SSPIEm_walkComment())
+				return ERROR_PROC_ALGO;
+			break;
+		case STARTTRAN:
+		case ENDTRAN:
+			flag_mask = 0;
+			flag_transin = 0;
+			break;
+		case CSTOGGLE:
+		case RUNCLOCK:
+		case RESETDATA:
+			break;
+		case WAIT:
+			if(!SSPIEm_walkNumber(&number, &bytes))
+				return ERROR_PROC_ALGO;
+			break;
+		case REPEAT:
+		case LOOP:
+			if(!SSPIEm_walkNumber(&number, &bytes))
+				return ERROR_PROC_ALGO;
+			if(depth == 0)
+				bodyStart = bytes;
+			depth++;
+			if(depth > sizes->depth)
+				sizes->depth = depth;
+			break;
+		case ENDREPEAT:
+		case ENDLOOP:
+			if(depth == 0)
+				break;
+			depth--;
+			if(depth == 0 && bytes - 1 - bodyStart > sizes->bodyBytes)
+				sizes->bodyBytes = bytes - 1 - bodyStart;
+			break;
+		case TRANSOUT:
+			if(!SSPIEm_walkNumber(&trCount, &bytes))
+				return ERROR_PROC_ALGO;
+			byteNum = (trCount + 7) / 8;
+			if(!SSPIEm_walkBytes(&currentByte, 1, &bytes))
+				return ERROR_PROC_ALGO;
+			if(currentByte == ALGODATA){
+				if(!SSPIEm_walkBytes(trBuffer, byteNum, &bytes))
+					return ERROR_PROC_ALGO;
+				if(byteNum > sizes->algoBytes)
+					sizes->algoBytes = byteNum;
+				if(callback)
+					callback(context, TRANSOUT, trCount, ALGODATA, trBuffer, 0);
+			}
+			else if(currentByte == PROGDATAEH){
+				if(byteNum > MAXFRAME)
+					return ERROR_PROC_ALGO;
+				if(byteNum > sizes->frameBytes)
+					sizes->frameBytes = byteNum;
+				if(callback)
+					callback(context, TRANSOUT, trCount, PROGDATAEH, 0, 0);
+			}
+			else
+				return ERROR_PROC_ALGO;
+			flag_transin = 0;
+			break;
+		case TRANSIN:
+			if(!SSPIEm_walkNumber(&trCount, &bytes))
+				return ERROR_PROC_ALGO;
+			byteNum = (trCount + 7) / 8;
+			flag_transin = 1;
+			break;
+		case MASK:
+			/* same limit as proc_TRANS(), larger masks are not read */
+			if(trCount <= maskBits){
+				if(!SSPIEm_walkBytes(maskBuffer, byteNum, &bytes))
+					return ERROR_PROC_ALGO;
+				if(byteNum > sizes->maskBytes)
+					sizes->maskBytes = byteNum;
+				flag_mask = 1;
+			}
+			break;
+		case ALGODATA:
+			if(flag_transin &&
+				!SSPIEm_walkBytes(trBuffer, byteNum, &bytes))
+				return ERROR_PROC_ALGO;
+			if(byteNum > sizes->algoBytes)
+				sizes->algoBytes = byteNum;
+			if(callback)
+				callback(context, flag_transin ? TRANSIN : TRANSOUT, trCount,
+					ALGODATA, trBuffer, flag_mask ? maskBuffer : 0);
+			break;
+		case PROGDATA:
+		case PROGDATAEH:
+			if(byteNum > MAXFRAME)
+				return ERROR_PROC_ALGO;
+			if(byteNum > sizes->frameBytes)
+				sizes->frameBytes = byteNum;
+			/* a read back frame is compared through the mask */
+			if(flag_mask && byteNum > sizes->maskBytes)
+				sizes->maskBytes = byteNum;
+			if(callback)
+				callback(context, flag_transin ? TRANSIN : TRANSOUT, trCount,
+					currentByte, 0, flag_mask ? maskBuffer : 0);
+			break;
+		case ENDOFALGO:
+			return PROC_OVER;
+		default:
+			return ERROR_PROC_ALGO;
+		}
+	}
+}
+
+/**************************************************************************
+* Function SSPIEm_measure
+* Parse the header of the preset algorithm as SSPIEm_initHeader() does
+* and scan the algorithm for what the buffers of a session need to hold:
+* its largest body, nesting, mask, ALGODATA and data frame.  BUFFERREQ,
+* STACKREQ and MASKBUFREQ of the header are taken if they ask for more.
+*
+* Return:
+* PROC_OVER		- sizes filled in
+* other			- error code
+**************************************************************************/
+int SSPIEm_measure(unsigned int algoID, SSPIEm_sizes *sizes)
+{
+	int retVal;
+
+	retVal = SSPIEm_initHeader(algoID);
+	if(retVal <= 0)
+		return retVal;
+	retVal = SSPIEm_walk(0, 0, sizes);
+	if(retVal <= 0)
+		return retVal;
+	if(bufferReq > sizes->bodyBytes)
+		sizes->bodyBytes = bufferReq;
+	if(stackReq > sizes->depth)
+		sizes->depth = stackReq;
+	if(maskReq > sizes->maskBytes)
+		sizes->maskBytes = maskReq;
+	return retVal;
+}
+
+/**************************************************************************
+* Function SSPIEm_scan
+* Walk the preset algorithm without touching the hardware and report
+* every data phase of every transmission to the callback.
+*
+* The callback gets the opcode of the phase (TRANSOUT or TRANSIN), its
+* size in bits, where the data comes from (ALGODATA, PROGDATA or
+* PROGDATAEH) and, for ALGODATA, the bytes from the algorithm together
+* with the mask that applies to them (0 if none).
+*
+* LOOP and REPEAT bodies are reported once, as they appear in the
+* algorithm.  The header is parsed and checked as in SSPIEm_init(), and
+* the buffers come from a session of their own.
+*
+* Return:
+* PROC_OVER		- algorithm scanned up to ENDOFALGO
+* other			- error code
+**************************************************************************/
+int SSPIEm_scan(SSPIEm_scanCallback callback, void *context)
+{
+	SSPIEm_sizes sizes;
+	int retVal;
+
+	retVal = SSPIEm_measure(0xFFFFFFFF, &sizes);
+	if(retVal <= 0)
+		return retVal;
+	if(!SSPIEm_open(&sizes))
+		return ERROR_INIT;
+	retVal = SSPIEm_initHeader(0xFFFFFFFF);
+	if(retVal > 0)
+		retVal = SSPIEm_walk(callback, context, &sizes);
+	SSPIEm_close();
+	return retVal;
+}
+
 /**************************************************************************
 *
 * VME internal functions
@@ -1297,8 +1780,8 @@ int VME_getByte(unsigned char * byteOut, unsigned char * bufAlgo,
 		#ifdef DEBUG_LEVEL_3
 		dbgu_putint(14,1);
 		#endif
-		algoGetByte(byteOut);
-		return 1;
+		/* 0 at the end of the algorithm, so nothing reads on past it */
+		return algoGetByte(byteOut);
 	}
 	else{
 		#ifdef DEBUG_LEVEL_3
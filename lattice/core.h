@@ -17,8 +17,36 @@
 * Processing functions
 *************************************************************************/
 
-int SSPIEm_process(unsigned char *bufAlgo, unsigned int bufAlgoSize);
+int SSPIEm_process();
 int SSPIEm_init(unsigned int algoID);
+int SSPIEm_initHeader(unsigned int algoID);
+
+/* what the buffers of a session are sized for, see SSPIEm_measure() */
+typedef struct {
+	unsigned int bodyBytes;			/* largest LOOP / REPEAT body */
+	unsigned int depth;				/* deepest LOOP / REPEAT nesting */
+	unsigned int maskBytes;			/* largest MASK */
+	unsigned int algoBytes;			/* largest ALGODATA */
+	unsigned int frameBytes;		/* largest data frame */
+} SSPIEm_sizes;
+
+int SSPIEm_measure(unsigned int algoID, SSPIEm_sizes *sizes);
+int SSPIEm_open(const SSPIEm_sizes *sizes);
+void SSPIEm_close();
+
+typedef void (*SSPIEm_scanCallback)(void *context, unsigned char opcode,
+				unsigned int bits, unsigned char type,
+				unsigned char *buffer, unsigned char *mask);
+int SSPIEm_scan(SSPIEm_scanCallback callback, void *context);
+
+/* what a dry run would have done on the bus, see SSPIEm_dryrun() */
+typedef struct {
+	unsigned long long txBits;		/* padded to whole bytes */
+	unsigned long long rxBits;
+	unsigned long long waitMs;		/* WAITs and the reset sequence */
+	unsigned int transactions;		/* chip select cycles */
+	unsigned int transfers;
+} SSPIEm_dryrunStats;
 
 int VME_getByte(unsigned char * byteOut, 
 				unsigned char * bufferedAlgo, unsigned int bufferedAlgoSize, 
@@ -30,12 +58,6 @@ unsigned int VME_getNumber(unsigned char * bufAlgo, unsigned int bufAlgoSize,
 * Function / struct definition
 *************************************************************************/
 
-int proc_TRANS(unsigned char *bufferedAlgo, unsigned int bufferedAlgoSize, 
-			   unsigned int *absBufferedAlgoIndex, unsigned char channel, unsigned char currentByte);
-int proc_REPEAT(unsigned char *bufferedAlgo, unsigned int bufferedAlgoSize, 
-				unsigned int *absBufferedAlgoIndex, unsigned int LoopMax);
-int proc_LOOP(unsigned char *bufferedAlgo, unsigned int bufferedAlgoSize, 
-			  unsigned int *absBufferedAlgoIndex, unsigned int LoopMax);
 int proc_HCOMMENT(unsigned char *bufferedAlgo, unsigned int bufferedAlgoSize, 
 			   unsigned int *absBufferedAlgoIndex, CSU *headerCS);
 
@@ -2,21 +2,25 @@
 
 #include <linux/spi/spi.h>
 #include <linux/slab.h>
+#include <linux/cache.h>
 #include <linux/delay.h>
 
 #include <linux/gpio.h>
-#include <../arch/arm/mach-mx6/board-mx6_ecp5com.h>
+#include <asm/unaligned.h>
 
-extern struct spi_device *current_programming_ecp5;
+#include "../ecp5.h"
+#include "../trace.h"
 
 unsigned char *rx_tx_buff = NULL;
+static unsigned int rxTxSize = 0;
 
-#define KONDOR_SPI_CFG0	IMX_GPIO_NR(1, 6)
-#define KONDOR_SPI_CFG1	IMX_GPIO_NR(1, 7)
-#define KONDOR_SPI_FPGA_DONE	IMX_GPIO_NR(1, 8)
-#define KONDOR_SPI_FPGA_INITN	IMX_GPIO_NR(1, 9)
-#define KONDOR_SPI_FPGA_PROGRAMN	IMX_GPIO_NR(7, 11)
-#define KONDOR_ECSPI2_CS0	IMX_GPIO_NR(5, 12)
+/* pins of the device being programmed, held from probe on, see pins.c */
+#define PIN_CFG0	(current_ecp5()->pins[ECP5_PIN_CFG0])
+#define PIN_CFG1	(current_ecp5()->pins[ECP5_PIN_CFG1])
+#define PIN_DONE	(current_ecp5()->pins[ECP5_PIN_DONE])
+#define PIN_INITN	(current_ecp5()->pins[ECP5_PIN_INITN])
+#define PIN_PROGRAMN	(current_ecp5()->pins[ECP5_PIN_PROGRAMN])
+#define PIN_CS		(current_ecp5()->pins[ECP5_PIN_CS])
 
 #define RESULT_OK	1
 #define RESULT_ERROR	0
@@ -24,6 +28,78 @@ unsigned char *rx_tx_buff = NULL;
 
 int seq = 0;
 
+/* set by SSPIEm_dryrun(), the hardware functions then only count */
+static SSPIEm_dryrunStats *dryRun = NULL;
+
+/* minimum time of the SPI_init() reset sequence in ms: PROGRAMN hold,
+   one INITN poll each way and the settle time */
+#define RESET_MIN_MS	103
+
+/* first command of the last transaction, for the adaptive wait() */
+static unsigned char lastCommand = 0;
+static int commandPending = 0;
+static int inTransaction = 0;
+
+/* short frames held back to go out with the next read, see sendPending() */
+#define PENDING_TX_MAX	32
+
+static unsigned char *txPending = NULL;
+static int pendingBytes = 0;
+
+/* bus_lock of the device, latched by SPI_init(), see busLock() */
+static int busLockMode = ECP5_BUS_LOCK_OFF;
+static int busLocked = 0;
+
+static int sendPending(unsigned char *rcBuffer, int rcBytes);
+static void busLock(void);
+static void busUnlock(void);
+static int SPI_sync(struct spi_message *message);
+
+/* buffers TRANS_transmitList() takes at once */
+#define TRANS_LIST_MAX	16
+
+/* messages of a REPEAT body kept built, see bodySkeleton() */
+#define BODY_MSGS_MAX	8
+#define REPEAT_NEST_MAX	4
+
+/*
+ * A message of txBytes out, then rxBytes in, -1 for none, each as bytes
+ * or 32 bit words as words says.  built is its number of transfers.
+ */
+struct SPI_skeleton
+{
+	struct spi_message message;
+	struct spi_transfer xfers[4];
+	int built;
+	int txBytes;
+	int rxBytes;
+	int words;
+};
+
+/*
+ * Scratch memory of the hardware functions, at the start of the arena of
+ * the device, see ecp5_arena_get().  The session buffers follow it.
+ */
+struct SPI_scratch
+{
+	unsigned char command[L1_CACHE_BYTES];	/* SPI_readRegister() */
+	unsigned char response[L1_CACHE_BYTES];
+	struct spi_transfer xfers[2 * TRANS_LIST_MAX];	/* TRANS_transmitList() */
+	struct SPI_skeleton body[BODY_MSGS_MAX];	/* transferMessage() */
+};
+
+#define SCRATCH_BYTES	SPI_BUFFER_ALIGN(sizeof(struct SPI_scratch))
+
+/* skeletons of the REPEAT bodies being run, see bodySkeleton() */
+static int repeatDepth = 0;
+static int bodyNext = 0;
+static int bodyStart[REPEAT_NEST_MAX];
+
+static struct SPI_scratch *SPI_scratch(void)
+{
+	return ((struct SPI_scratch *) current_ecp5()->arena.buf);
+}
+
 /*********************************************************************
 * Lattice Semiconductor Corp. Copyright 2011
 * hardware.cpp
@@ -148,14 +224,80 @@ void dbgu_putint(int debugCode, int debugCode2)
 *					3 extra clocks after chip-select is pulled high.
 * 
 *
-* In order to use stream transmission, dataBuffer[] is required to 
-* buffer the data.  Please refer to devices' specification for the
-* number of bytes required.  For XP2-40, minimum is 423 bytes.
-* Declare a little bit more than the minimum, just to be safe.
+* In order to use stream transmission, dataBuffer is required to 
+* buffer the data.  It holds the largest data frame of the algorithm,
+* see SPI_setBuffers().
+*
+*
+************************************************************************/
+unsigned char *dataBuffer = NULL;
+static unsigned int dataBufferSize = 0;
+
+/************************************************************************
+* Function SPI_sessionMemory()
+* Purpose: size bytes of session memory from the arena of the device
+* being programmed, after the scratch memory of the hardware functions.
+* The arena is kept between runs and only grows, so a run allocates
+* nothing once its session is open.
 *
+* Return:		the memory, or 0 if the arena could not grow
+************************************************************************/
+unsigned char *SPI_sessionMemory(unsigned int size)
+{
+	unsigned char *buf;
+
+	buf = ecp5_arena_get(&current_ecp5()->arena, SCRATCH_BYTES + size);
+	if (!buf)
+		return (NULL);
+
+	return (buf + SCRATCH_BYTES);
+}
+
+/************************************************************************
+* Function SPI_buffersSize()
+* Purpose: Size of the buffers SPI_setBuffers() takes for a session of
+* up to transferBytes per transfer and dataBytes per data frame.
+************************************************************************/
+unsigned int SPI_buffersSize(unsigned int transferBytes, unsigned int dataBytes)
+{
+	return (SPI_BUFFER_ALIGN(transferBytes) +
+			SPI_BUFFER_ALIGN(PENDING_TX_MAX) + dataBytes);
+}
+
+/************************************************************************
+* Function SPI_setBuffers()
+* Purpose: Take rx_tx_buff, txPending and dataBuffer for a session from
+* buffers, SPI_buffersSize() bytes of the session arena, or drop them if
+* buffers is 0.
 *
+* The arena is cache line aligned.  rx_tx_buff comes first and txPending
+* starts a cache line of its own, the SPI controller may DMA both.
 ************************************************************************/
-unsigned char dataBuffer[1024];
+void SPI_setBuffers(unsigned char *buffers, unsigned int transferBytes,
+		unsigned int dataBytes)
+{
+	pendingBytes = 0;
+	repeatDepth = 0;
+	if (!buffers)
+	{
+		rx_tx_buff = NULL;
+		txPending = NULL;
+		dataBuffer = NULL;
+		rxTxSize = 0;
+		dataBufferSize = 0;
+		return;
+	}
+
+	rx_tx_buff = buffers;
+	txPending = rx_tx_buff + SPI_BUFFER_ALIGN(transferBytes);
+	dataBuffer = txPending + SPI_BUFFER_ALIGN(PENDING_TX_MAX);
+	rxTxSize = transferBytes;
+	dataBufferSize = dataBytes;
+
+	/* the arena may have moved since the skeletons were built */
+	memset(SPI_scratch()->body, 0, sizeof(SPI_scratch()->body));
+}
+
 /************************************************************************
 * Function SPI_init()
 * Purpose: Initialize SPI port
@@ -176,33 +318,36 @@ int SPI_init()
 
 	seq = 0;
 
-	rx_tx_buff = kzalloc(4096, GFP_KERNEL);
+	if (dryRun)
+	{
+		dryRun->waitMs += RESET_MIN_MS;
+		return RESULT_OK;
+	}
+
+	/* the buffers come with the session, see SSPIEm_open() */
+	pendingBytes = 0;
 	if (!rx_tx_buff)
 	{
-		pr_err("can't allocate enough memory for rx_tx_buf\n");
+		pr_err("ECP5: SPI_init without session buffers\n");
 		return (0);
 	}
+	busLockMode = current_ecp5()->bus_lock;
 
-	gpio_request(KONDOR_SPI_CFG0,"sysfs");
-	gpio_request(KONDOR_SPI_CFG1,"sysfs");
-	gpio_request(KONDOR_SPI_FPGA_DONE,"sysfs");
-	gpio_request(KONDOR_SPI_FPGA_INITN,"sysfs");
-	gpio_request(KONDOR_SPI_FPGA_PROGRAMN,"sysfs");
-	gpio_request(KONDOR_ECSPI2_CS0,"sysfs");
-	gpio_direction_output(KONDOR_ECSPI2_CS0, 1);
+	gpio_direction_output(PIN_CS, 1);
 
 	// set FPGA SPI slave mode, set SPI mux to redirect FPGA to ECSPI2 ARM pins instead of SPI flash
-	gpio_direction_output(KONDOR_SPI_CFG0, true);
-	gpio_direction_output(KONDOR_SPI_CFG1, false);
+	gpio_direction_output(PIN_CFG0, true);
+	gpio_direction_output(PIN_CFG1, false);
 
 	// programn low
-	gpio_direction_output(KONDOR_SPI_FPGA_PROGRAMN, false);
+	gpio_direction_output(PIN_PROGRAMN, false);
+	trace_ecp5_init_phase(ECP5_TRACE_PROGRAMN_LOW, 0);
 
 	// hold it...
 	msleep(1);	// min 55 ns
 
 	// wait until initn goes low
-	gpio_direction_input(KONDOR_SPI_FPGA_INITN);
+	gpio_direction_input(PIN_INITN);
 
 	n_retries = 0;
 	while (n_retries < 100)
@@ -210,16 +355,18 @@ int SPI_init()
 		char initn =	0;
 
 		msleep(1);
-		initn = gpio_get_value(KONDOR_SPI_FPGA_INITN);
+		initn = gpio_get_value(PIN_INITN);
 		if (!initn)
 		{
 			break;
 		}
 		++n_retries;
 	}
+	trace_ecp5_init_phase(ECP5_TRACE_INITN_LOW, n_retries);
 
 	// programn high
-	gpio_set_value(KONDOR_SPI_FPGA_PROGRAMN, true);
+	gpio_set_value(PIN_PROGRAMN, true);
+	trace_ecp5_init_phase(ECP5_TRACE_PROGRAMN_HIGH, 0);
 
 	// wait until initn goes high
 	n_retries = 0;
@@ -228,22 +375,25 @@ int SPI_init()
 		char initn =	0;
 
 		msleep(1);
-		initn = gpio_get_value(KONDOR_SPI_FPGA_INITN);
+		initn = gpio_get_value(PIN_INITN);
 		if (initn)
 		{
 			break;
 		}
 		++n_retries;
 	}
+	trace_ecp5_init_phase(ECP5_TRACE_INITN_HIGH, n_retries);
 
 	// wait at least 50 ms after toggling programn
 	msleep(100);
+	trace_ecp5_init_phase(ECP5_TRACE_READY, 0);
+	ecp5_record_add(current_ecp5()->record, ECP5_REC_RESET, NULL, 0);
+	ecp5_txcache_add(&current_ecp5()->txcache, ECP5_TXOP_RESET, NULL, 0, 0);
 
-	return RESULT_OK;
+	if (busLockMode == ECP5_BUS_LOCK_RUN)
+		busLock();
 
-error_return:
-	SPI_final();
-	return RESULT_ERROR;
+	return RESULT_OK;
 }
 /************************************************************************
 * Function SPI_final()
@@ -261,25 +411,187 @@ error_return:
 ************************************************************************/
 int SPI_final()
 {
-	kfree(rx_tx_buff);
-
-	gpio_export(KONDOR_SPI_CFG0, 1);
-	gpio_export(KONDOR_SPI_CFG1, 1);
-	gpio_export(KONDOR_SPI_FPGA_DONE, 1);
-	gpio_export(KONDOR_SPI_FPGA_INITN, 1);
-	gpio_export(KONDOR_SPI_FPGA_PROGRAMN, 1);
-	gpio_export(KONDOR_ECSPI2_CS0, 1);
+	if (dryRun)
+		return (RESULT_OK);
 
-	gpio_free(KONDOR_SPI_CFG0);
-	gpio_free(KONDOR_SPI_CFG1);
-	gpio_free(KONDOR_SPI_FPGA_DONE);
-	gpio_free(KONDOR_SPI_FPGA_INITN);
-	gpio_free(KONDOR_SPI_FPGA_PROGRAMN);
-	gpio_free(KONDOR_ECSPI2_CS0);
+	/* the pins stay requested, see ecp5_pins_request() */
+	pendingBytes = 0;
+	busUnlock();
 
 	return (RESULT_OK);
 }
 
+/************************************************************************
+* Function SPI_readDeviceState()
+* Purpose: Read IDCODE, USERCODE and status register of the device
+* without resetting it, so a configured FPGA keeps running.
+*
+* Each value is 4 bytes in wire order.  *done is the level of the DONE
+* pin.  The FPGA only answers if its slave SPI port stays enabled after
+* configuration (SLAVE_SPI_PORT=ENABLE in the design), otherwise the
+* values are garbage and will not match anything.
+*
+* Return:		1 - succeed
+*				0 - fail
+************************************************************************/
+#define ECP5_READ_ID		0xE0
+#define ECP5_USERCODE		0xC0
+#define ECP5_LSC_READ_STATUS	0x3C
+#define ECP5_ISC_ERASE		0x0E
+#define ECP5_ISC_PROGRAM_USERCODE	0xC2
+#define ECP5_ISC_PROGRAM_DONE	0x5E
+
+/* status register bits, in the third byte in wire order */
+#define ECP5_STATUS_DONE	0x01	/* bit 8 */
+#define ECP5_STATUS_BUSY	0x10	/* bit 12 */
+#define ECP5_STATUS_FAIL	0x20	/* bit 13 */
+
+/* command and response go through the arena, the controller may DMA them */
+static int SPI_readRegister(unsigned char command, unsigned char *value)
+{
+	struct SPI_scratch *scratch = SPI_scratch();
+	struct spi_transfer xfers[2];
+	struct spi_message message;
+	int res = 0;
+
+	memset(scratch->command, 0, 4);
+	scratch->command[0] = command;
+
+	spi_message_init(&message);
+	memset(xfers, 0, sizeof(xfers));
+	xfers[0].tx_buf = scratch->command;
+	xfers[0].len = 4;
+	spi_message_add_tail(&xfers[0], &message);
+	xfers[1].rx_buf = scratch->response;
+	xfers[1].len = 4;
+	spi_message_add_tail(&xfers[1], &message);
+
+	gpio_set_value(PIN_CS, 0);
+	res = SPI_sync(&message);
+	gpio_set_value(PIN_CS, 1);
+
+	if (!res)
+		memcpy(value, scratch->response, 4);
+
+	return (!res);
+}
+
+int SPI_readDeviceState(unsigned char *idcode, unsigned char *usercode,
+			unsigned char *status, int *done)
+{
+	int res = RESULT_OK;
+
+	gpio_direction_output(PIN_CS, 1);
+
+	// set SPI mux to redirect FPGA to ECSPI2 ARM pins, PROGRAMN is left alone
+	gpio_direction_output(PIN_CFG0, true);
+	gpio_direction_output(PIN_CFG1, false);
+	gpio_direction_input(PIN_DONE);
+
+	if (!SPI_readRegister(ECP5_READ_ID, idcode) ||
+			!SPI_readRegister(ECP5_USERCODE, usercode) ||
+			!SPI_readRegister(ECP5_LSC_READ_STATUS, status))
+		res = RESULT_ERROR;
+
+	*done = gpio_get_value(PIN_DONE);
+
+	return res;
+}
+
+/************************************************************************
+* Function SPI_readIdcodes(unsigned char *idcodes, int count)
+* Purpose: Read IDCODE count times in a row at the current SPI clock,
+* without resetting the device, to check the clock is reliable.
+*
+* idcodes receives count values of 4 bytes in wire order.
+*
+* Return:		1 - succeed
+*				0 - fail
+************************************************************************/
+int SPI_readIdcodes(unsigned char *idcodes, int count)
+{
+	int res = RESULT_OK;
+	int i;
+
+	gpio_direction_output(PIN_CS, 1);
+
+	// set SPI mux to redirect FPGA to ECSPI2 ARM pins, PROGRAMN is left alone
+	gpio_direction_output(PIN_CFG0, true);
+	gpio_direction_output(PIN_CFG1, false);
+
+	for (i = 0; i < count && res == RESULT_OK; ++i)
+	{
+		if (!SPI_readRegister(ECP5_READ_ID, idcodes + 4 * i))
+			res = RESULT_ERROR;
+	}
+
+	return res;
+}
+
+/************************************************************************
+* Adaptive wait
+*
+* ECP5 algorithms pad erase and program steps with WAITs long enough for
+* the slowest device.  With adaptive_wait set on the device, a WAIT that
+* directly follows ISC_ERASE, ISC_PROGRAM_USERCODE or ISC_PROGRAM_DONE
+* polls the status register instead and ends once the device is ready.
+* The WAIT time stays the upper bound.
+************************************************************************/
+/* first and longest sleep between status polls of the adaptive wait() */
+#define WAIT_POLL_FIRST_US	100
+#define WAIT_POLL_MAX_US	2000
+
+static int isBusyCommand(unsigned char command)
+{
+	return command == ECP5_ISC_ERASE ||
+		command == ECP5_ISC_PROGRAM_USERCODE ||
+		command == ECP5_ISC_PROGRAM_DONE;
+}
+
+/*
+ * Poll the status register with growing intervals until the device is
+ * no longer busy (and, after ISC_PROGRAM_DONE, reports DONE) or fails,
+ * for at most a_msTimeDelay.
+ */
+static void waitReady(int a_msTimeDelay, unsigned char command)
+{
+	unsigned long budget = a_msTimeDelay * 1000UL;
+	unsigned long waited = 0;
+	unsigned long step = WAIT_POLL_FIRST_US;
+	unsigned char status[4];
+	int polls = 0;
+
+	while (waited < budget)
+	{
+		if (step > budget - waited)
+			step = budget - waited;
+		usleep_range(step, step + step / 4);
+		waited += step;
+
+		if (waited >= budget)
+			break;
+
+		++polls;
+		if (!SPI_readRegister(ECP5_LSC_READ_STATUS, status))
+		{
+			/* can't tell, sleep the rest */
+			msleep(DIV_ROUND_UP(budget - waited, 1000));
+			waited = budget;
+			break;
+		}
+		if (status[2] & ECP5_STATUS_FAIL)
+			break;
+		if (!(status[2] & ECP5_STATUS_BUSY) &&
+				(command != ECP5_ISC_PROGRAM_DONE ||
+				 (status[2] & ECP5_STATUS_DONE)))
+			break;
+
+		step = min_t(unsigned long, step * 2, WAIT_POLL_MAX_US);
+	}
+
+	trace_ecp5_wait_poll(a_msTimeDelay, waited, polls);
+}
+
 /************************************************************************
 * Function wait(int ms)
 * Purpose: Hold the process for some time (unit millisecond)
@@ -326,12 +638,321 @@ int SPI_final()
 * Users only need to enter the speed of the cpu.
 *
 ************************************************************************/
+
 int wait(int a_msTimeDelay)
 {
+	unsigned char command = lastCommand;
+
+	if (dryRun)
+	{
+		dryRun->waitMs += a_msTimeDelay;
+		return (RESULT_OK);
+	}
+
+	if (pendingBytes && sendPending(NULL, 0))
+		return (RESULT_ERROR);
+
+	trace_ecp5_wait(a_msTimeDelay);
+	ecp5_record_add(current_ecp5()->record, ECP5_REC_WAIT, NULL,
+			a_msTimeDelay);
+	ecp5_txcache_add(&current_ecp5()->txcache, ECP5_TXOP_WAIT, NULL, 0,
+			a_msTimeDelay);
+
+	/* only the first WAIT after the command stands for its busy time */
+	lastCommand = 0;
+	if (current_ecp5()->adaptive_wait && !inTransaction &&
+			isBusyCommand(command))
+	{
+		waitReady(a_msTimeDelay, command);
+		return (RESULT_OK);
+	}
+
 	msleep(a_msTimeDelay);
 	return (RESULT_OK);
 }
 
+/************************************************************************
+* Bus ownership
+*
+* With bus_lock set on the device, a run keeps other devices on the SPI
+* bus from slipping messages in between its own: ECP5_BUS_LOCK_TRANS
+* takes the bus with spi_bus_lock() from STARTTRAN to ENDTRAN, while
+* chip select is low, ECP5_BUS_LOCK_RUN from SPI_init() to SPI_final().
+* Messages then go out with spi_sync_locked().  Reads of the device
+* state outside a run never lock the bus.
+************************************************************************/
+static void busLock(void)
+{
+	if (busLocked)
+		return;
+	spi_bus_lock(current_programming_ecp5->master);
+	busLocked = 1;
+}
+
+static void busUnlock(void)
+{
+	if (!busLocked)
+		return;
+	spi_bus_unlock(current_programming_ecp5->master);
+	busLocked = 0;
+}
+
+static int SPI_sync(struct spi_message *message)
+{
+	if (busLocked)
+		return spi_sync_locked(current_programming_ecp5, message);
+	return spi_sync(current_programming_ecp5, message);
+}
+
+/************************************************************************
+* Word transfers
+*
+* With bulk_words set on the device, transfers of WORD_MIN_BYTES or more
+* move as 32 bit SPI words, a quarter of the FIFO entries of 8 bit
+* words.  The controller shifts a word out MSB first, so every 4 bytes
+* are reordered on their way to or from the transfer buffer.  The bytes
+* past the last whole word follow as 8 bit words in the same message.
+************************************************************************/
+#define WORD_MIN_BYTES	16
+
+static int useWords(int n_bytes)
+{
+	return current_ecp5()->bulk_words && n_bytes >= WORD_MIN_BYTES;
+}
+
+/* wire order to 32 bit words, dst must be word aligned */
+static void toWords(unsigned char *dst, const unsigned char *src, int n_bytes)
+{
+	int i = 0;
+
+	for (; i + 4 <= n_bytes; i += 4)
+		*(u32 *)(dst + i) = get_unaligned_be32(src + i);
+	for (; i < n_bytes; ++i)
+		dst[i] = src[i];
+}
+
+/* 32 bit words to wire order, src must be word aligned */
+static void fromWords(unsigned char *dst, const unsigned char *src, int n_bytes)
+{
+	int i = 0;
+
+	for (; i + 4 <= n_bytes; i += 4)
+		put_unaligned_be32(*(const u32 *)(src + i), dst + i);
+	for (; i < n_bytes; ++i)
+		dst[i] = src[i];
+}
+
+/* add n_bytes of words as up to 2 transfers, returns the count */
+static int addWordTransfers(struct spi_message *message,
+		struct spi_transfer *xfers, const unsigned char *tx,
+		unsigned char *rx, int n_bytes)
+{
+	int n_words = n_bytes & ~3;
+	int n = 0;
+
+	if (n_words)
+	{
+		xfers[n].tx_buf = tx;
+		xfers[n].rx_buf = rx;
+		xfers[n].len = n_words;
+		xfers[n].bits_per_word = 32;
+		spi_message_add_tail(&xfers[n], message);
+		++n;
+	}
+	if (n_bytes > n_words)
+	{
+		xfers[n].tx_buf = tx ? tx + n_words : NULL;
+		xfers[n].rx_buf = rx ? rx + n_words : NULL;
+		xfers[n].len = n_bytes - n_words;
+		xfers[n].bits_per_word = 8;
+		spi_message_add_tail(&xfers[n], message);
+		++n;
+	}
+	return n;
+}
+
+/************************************************************************
+* Message skeletons
+*
+* A REPEAT body sends the same messages on every pass, only the data
+* changes: the row loops of an algorithm run thousands of times.  In a
+* body each message takes the next skeleton of the scratch memory.  One
+* built for the same bytes out and in is sent again as it is, with its
+* transfers pointed at the buffers; any other is rebuilt.  The
+* skeletons of a body start over at each pass, see TRANS_repeat().
+* Outside a body, or past BODY_MSGS_MAX messages in one, a message is
+* built on the stack for each transfer.  The controller does not change
+* the transfers of a message it is given.
+************************************************************************/
+#define WORDS_TX	1
+#define WORDS_RX	2
+
+/* the next skeleton of the body, 0 outside a body or past the last */
+static struct SPI_skeleton *bodySkeleton(void)
+{
+	if (!repeatDepth || repeatDepth > REPEAT_NEST_MAX ||
+			bodyNext >= BODY_MSGS_MAX)
+		return (NULL);
+	return (&SPI_scratch()->body[bodyNext++]);
+}
+
+static void buildSkeleton(struct SPI_skeleton *skeleton,
+		const unsigned char *tx, int txBytes,
+		unsigned char *rx, int rxBytes, int words)
+{
+	struct spi_message *message = &skeleton->message;
+	struct spi_transfer *xfers = skeleton->xfers;
+	int n = 0;
+
+	spi_message_init(message);
+	memset(xfers, 0, sizeof(skeleton->xfers));
+	if (tx && (words & WORDS_TX))
+	{
+		n += addWordTransfers(message, &xfers[n], tx, NULL, txBytes);
+	}
+	else if (tx)
+	{
+		xfers[n].tx_buf = tx;
+		xfers[n].len = txBytes;
+		spi_message_add_tail(&xfers[n], message);
+		++n;
+	}
+	if (rx && (words & WORDS_RX))
+	{
+		n += addWordTransfers(message, &xfers[n], NULL, rx, rxBytes);
+	}
+	else if (rx)
+	{
+		xfers[n].rx_buf = rx;
+		xfers[n].len = rxBytes;
+		spi_message_add_tail(&xfers[n], message);
+		++n;
+	}
+
+	skeleton->built = n;
+	skeleton->txBytes = tx ? txBytes : -1;
+	skeleton->rxBytes = rx ? rxBytes : -1;
+	skeleton->words = words;
+}
+
+/* point the transfers of a built skeleton at tx and rx */
+static void setSkeletonBuffers(struct SPI_skeleton *skeleton,
+		const unsigned char *tx, unsigned char *rx)
+{
+	struct spi_transfer *xfer;
+	int i = 0;
+
+	for (i = 0; i < skeleton->built; ++i)
+	{
+		xfer = &skeleton->xfers[i];
+		if (xfer->tx_buf)
+		{
+			xfer->tx_buf = tx;
+			tx += xfer->len;
+		}
+		else
+		{
+			xfer->rx_buf = rx;
+			rx += xfer->len;
+		}
+	}
+	skeleton->message.actual_length = 0;
+}
+
+/*
+ * Send txBytes from tx, then read rxBytes into rx, in one message.
+ * Either buffer may be NULL; words says which go as 32 bit words.
+ */
+static int transferMessage(const unsigned char *tx, int txBytes,
+		unsigned char *rx, int rxBytes, int words)
+{
+	struct SPI_skeleton local;
+	struct SPI_skeleton *skeleton = bodySkeleton();
+
+	if (!skeleton)
+	{
+		skeleton = &local;
+		skeleton->built = 0;
+	}
+
+	if (skeleton->built && skeleton->words == words &&
+			skeleton->txBytes == (tx ? txBytes : -1) &&
+			skeleton->rxBytes == (rx ? rxBytes : -1))
+		setSkeletonBuffers(skeleton, tx, rx);
+	else
+		buildSkeleton(skeleton, tx, txBytes, rx, rxBytes, words);
+
+	return SPI_sync(&skeleton->message);
+}
+
+/* account n_bytes sent from or received into buffer, in wire order */
+static void txDone(const unsigned char *buffer, int n_bytes)
+{
+	ecp5_progress_tx(&current_ecp5()->progress, n_bytes);
+	ecp5_record_add(current_ecp5()->record, ECP5_REC_TX, buffer, n_bytes);
+	ecp5_txcache_add(&current_ecp5()->txcache, ECP5_TXOP_TX,
+			buffer, n_bytes, 0);
+}
+
+static void rxDone(const unsigned char *buffer, int n_bytes)
+{
+	ecp5_progress_rx(&current_ecp5()->progress, n_bytes);
+	ecp5_record_add(current_ecp5()->record, ECP5_REC_RX, buffer, n_bytes);
+	ecp5_txcache_add(&current_ecp5()->txcache, ECP5_TXOP_RX,
+			NULL, n_bytes, 0);
+}
+
+/************************************************************************
+* Deferred frames
+*
+* Inside a transaction TRANS_transmitBytes() keeps frames of up to
+* PENDING_TX_MAX bytes in txPending instead of sending them.  The next
+* TRANS_receiveBytes() sends them and reads in one spi_message, so a
+* command and its response share one controller round trip: status
+* polls, IDCODE and USERCODE checks.  Anything else that uses the bus,
+* a WAIT and the end of the transaction send the pending bytes first.
+************************************************************************/
+/* send the pending bytes, then read rcBytes into rcBuffer if rcBytes */
+static int sendPending(unsigned char *rcBuffer, int rcBytes)
+{
+	int n_bytes = pendingBytes;
+	int i = 0;
+	int res = 0;
+
+	pendingBytes = 0;
+
+	trace_ecp5_trans_start(ECP5_TRACE_TX, n_bytes * 8, 0);
+	if (rcBytes)
+		trace_ecp5_trans_start(ECP5_TRACE_RX, rcBytes * 8, 0);
+	res = transferMessage(txPending, n_bytes,
+			rcBytes ? rx_tx_buff : NULL, rcBytes,
+			useWords(rcBytes) ? WORDS_RX : 0);
+	trace_ecp5_trans_end(ECP5_TRACE_TX, n_bytes * 8, res);
+	if (rcBytes)
+		trace_ecp5_trans_end(ECP5_TRACE_RX, rcBytes * 8, res);
+	if (res)
+		return (res);
+
+	txDone(txPending, n_bytes);
+	if (!rcBytes)
+		return (0);
+
+	if (useWords(rcBytes))
+	{
+		fromWords(rcBuffer, rx_tx_buff, rcBytes);
+	}
+	else
+	{
+		for (i = 0; i < rcBytes; ++i)
+		{
+			rcBuffer[i] = rx_tx_buff[i];
+		}
+	}
+	rxDone(rcBuffer, rcBytes);
+
+	return (0);
+}
+
 /************************************************************************
 * Function TRANS_transmitBytes(unsigned char *trBuffer, int trCount)
 * Purpose: To transmit certain number of bits, indicating by trCount,
@@ -352,11 +973,51 @@ int TRANS_transmitBytes(unsigned char *trBuffer, int trCount)
 	int res = 0;
 	int n_bytes = trCount >> 3;
 
-	for (i = 0; i < n_bytes; ++i)
+	if (commandPending && n_bytes)
+	{
+		lastCommand = trBuffer[0];
+		commandPending = 0;
+	}
+
+	if (dryRun)
+	{
+		dryRun->txBits += trCount;
+		dryRun->transfers++;
+		return (1);
+	}
+
+	/* held back for the next read, see sendPending() */
+	if (inTransaction && n_bytes <= PENDING_TX_MAX - pendingBytes)
+	{
+		for (i = 0; i < n_bytes; ++i)
+		{
+			txPending[pendingBytes + i] = trBuffer[i];
+		}
+		pendingBytes += n_bytes;
+		return (1);
+	}
+	if (pendingBytes && sendPending(NULL, 0))
+		return (0);
+	if (n_bytes > rxTxSize)
+		return (0);
+
+	trace_ecp5_trans_start(ECP5_TRACE_TX, trCount, 0);
+	if (useWords(n_bytes))
 	{
-		rx_tx_buff[i] = trBuffer[i];
+		toWords(rx_tx_buff, trBuffer, n_bytes);
+		res = transferMessage(rx_tx_buff, n_bytes, NULL, 0, WORDS_TX);
 	}
-	res = spi_write(current_programming_ecp5, rx_tx_buff, n_bytes);
+	else
+	{
+		for (i = 0; i < n_bytes; ++i)
+		{
+			rx_tx_buff[i] = trBuffer[i];
+		}
+		res = transferMessage(rx_tx_buff, n_bytes, NULL, 0, 0);
+	}
+	trace_ecp5_trans_end(ECP5_TRACE_TX, trCount, res);
+	if (!res)
+		txDone(trBuffer, n_bytes);
 
 	return (!res);
 }
@@ -381,17 +1042,142 @@ int TRANS_receiveBytes(unsigned char *rcBuffer, int rcCount)
 	int res = 0;
 	int n_bytes = rcCount >> 3;
 
-	res = spi_read(current_programming_ecp5, rx_tx_buff, n_bytes);
+	if (dryRun)
+	{
+		dryRun->rxBits += rcCount;
+		dryRun->transfers++;
+		return (1);
+	}
 
+	if (n_bytes > rxTxSize)
+		return (0);
+	if (pendingBytes)
+		return (!sendPending(rcBuffer, n_bytes));
 
-	for (i = 0; i < n_bytes; ++i)
+	trace_ecp5_trans_start(ECP5_TRACE_RX, rcCount, 0);
+	if (useWords(n_bytes))
+	{
+		res = transferMessage(NULL, 0, rx_tx_buff, n_bytes, WORDS_RX);
+		fromWords(rcBuffer, rx_tx_buff, n_bytes);
+	}
+	else
 	{
-		rcBuffer[i] = rx_tx_buff[i];
+		res = transferMessage(NULL, 0, rx_tx_buff, n_bytes, 0);
+		for (i = 0; i < n_bytes; ++i)
+		{
+			rcBuffer[i] = rx_tx_buff[i];
+		}
 	}
+	trace_ecp5_trans_end(ECP5_TRACE_RX, rcCount, res);
+	if (!res)
+		rxDone(rcBuffer, n_bytes);
 
 	return (!res);
 }
 
+/************************************************************************
+* Function TRANS_transmitList(unsigned char **buffers, int *counts, int n)
+* Purpose: To transmit n buffers back to back in one SPI message.
+*
+* counts are in bytes.  The buffers are handed to the SPI controller as
+* they are, so they must be DMA capable (kmalloc) and word aligned.  The
+* transaction cache replays long frames this way instead of copying them
+* through rx_tx_buff.  Buffers sent as 32 bit words are reordered in
+* place for the transfer and restored afterwards.  The transfers are
+* described in the scratch memory of the arena.
+* The function returns 1 if success, or 0 if fail.
+*************************************************************************/
+int TRANS_transmitList(unsigned char **buffers, int *counts, int n)
+{
+	struct spi_transfer *xfers = SPI_scratch()->xfers;
+	struct spi_message message;
+	int n_xfers = 0;
+	int n_bytes = 0;
+	int i = 0;
+	int res = 0;
+
+	if (n <= 0 || n > TRANS_LIST_MAX)
+		return (0);
+
+	if (commandPending && counts[0])
+	{
+		lastCommand = buffers[0][0];
+		commandPending = 0;
+	}
+
+	if (pendingBytes && sendPending(NULL, 0))
+		return (0);
+
+	spi_message_init(&message);
+	memset(xfers, 0, sizeof(SPI_scratch()->xfers));
+	for (i = 0; i < n; ++i)
+	{
+		if (useWords(counts[i]))
+		{
+			toWords(buffers[i], buffers[i], counts[i]);
+			n_xfers += addWordTransfers(&message, &xfers[n_xfers],
+					buffers[i], NULL, counts[i]);
+		}
+		else
+		{
+			xfers[n_xfers].tx_buf = buffers[i];
+			xfers[n_xfers].len = counts[i];
+			spi_message_add_tail(&xfers[n_xfers], &message);
+			++n_xfers;
+		}
+		n_bytes += counts[i];
+	}
+
+	trace_ecp5_trans_start(ECP5_TRACE_TX, n_bytes * 8, 0);
+	res = SPI_sync(&message);
+	trace_ecp5_trans_end(ECP5_TRACE_TX, n_bytes * 8, res);
+
+	for (i = 0; i < n; ++i)
+		if (useWords(counts[i]))
+			fromWords(buffers[i], buffers[i], counts[i]);
+	if (!res)
+	{
+		ecp5_progress_tx(&current_ecp5()->progress, n_bytes);
+		for (i = 0; i < n; ++i)
+			ecp5_record_add(current_ecp5()->record, ECP5_REC_TX,
+					buffers[i], counts[i]);
+	}
+
+	return (!res);
+}
+
+/************************************************************************
+* Function TRANS_repeat(int event)
+* Purpose: Follow the REPEAT bodies being run for the message skeletons.
+*
+* The engine reports the start of a REPEAT with its first pass
+* (TRANS_REPEAT_BEGIN), each pass after it (TRANS_REPEAT_PASS) and the
+* end (TRANS_REPEAT_END).  A pass takes the skeletons from where its
+* body took them on the first pass, so the messages of the innermost
+* REPEATs, up to REPEAT_NEST_MAX deep, are built once.
+*************************************************************************/
+void TRANS_repeat(int event)
+{
+	switch (event)
+	{
+	case TRANS_REPEAT_BEGIN:
+		if (!repeatDepth)
+			bodyNext = 0;
+		if (repeatDepth < REPEAT_NEST_MAX)
+			bodyStart[repeatDepth] = bodyNext;
+		repeatDepth++;
+		break;
+	case TRANS_REPEAT_PASS:
+		if (repeatDepth && repeatDepth <= REPEAT_NEST_MAX)
+			bodyNext = bodyStart[repeatDepth - 1];
+		break;
+	case TRANS_REPEAT_END:
+		if (repeatDepth)
+			repeatDepth--;
+		break;
+	}
+}
+
 /************************************************************************
 * Function TRANS_starttranx(unsigned char channel)
 * Purpose: To start an SPI transmission
@@ -408,7 +1194,21 @@ int TRANS_receiveBytes(unsigned char *rcBuffer, int rcCount)
 **********************************************************************/	
 int TRANS_starttranx(unsigned char channel)
 {
-	gpio_set_value(KONDOR_ECSPI2_CS0, 0);
+	inTransaction = 1;
+	commandPending = 1;
+
+	if (dryRun)
+	{
+		dryRun->transactions++;
+		return 1;
+	}
+
+	if (busLockMode == ECP5_BUS_LOCK_TRANS)
+		busLock();
+	gpio_set_value(PIN_CS, 0);
+	trace_ecp5_cs(1);
+	ecp5_record_add(current_ecp5()->record, ECP5_REC_CS, NULL, 1);
+	ecp5_txcache_add(&current_ecp5()->txcache, ECP5_TXOP_CS, NULL, 0, 1);
 	return 1;
 }
 /************************************************************************
@@ -427,8 +1227,24 @@ int TRANS_starttranx(unsigned char channel)
 **********************************************************************/
 int TRANS_endtranx()
 {
-	gpio_set_value(KONDOR_ECSPI2_CS0, 1);
-	return 1;
+	int res = 0;
+
+	inTransaction = 0;
+	commandPending = 0;
+
+	if (dryRun)
+		return 1;
+
+	if (pendingBytes)
+		res = sendPending(NULL, 0);
+
+	gpio_set_value(PIN_CS, 1);
+	if (busLockMode == ECP5_BUS_LOCK_TRANS)
+		busUnlock();
+	trace_ecp5_cs(0);
+	ecp5_record_add(current_ecp5()->record, ECP5_REC_CS, NULL, 0);
+	ecp5_txcache_add(&current_ecp5()->txcache, ECP5_TXOP_CS, NULL, 0, 0);
+	return !res;
 }
 
 /************************************************************************
@@ -476,6 +1292,77 @@ int TRANS_runClk()
 {
 	return 1;
 }
+/************************************************************************
+* Function SPI_setDryRun(SSPIEm_dryrunStats *stats)
+* Purpose: Enter (stats != 0) or leave (stats == 0) dry run mode.
+*
+* In dry run mode SPI_init(), SPI_final(), wait() and the TRANS_
+* functions add to stats instead of touching the hardware, and read
+* back data is not compared.  SPI_isDryRun() tells the engine to take
+* read back data as matching.
+*************************************************************************/
+void SPI_setDryRun(SSPIEm_dryrunStats *stats)
+{
+	dryRun = stats;
+}
+
+int SPI_isDryRun()
+{
+	return dryRun != NULL;
+}
+
+/************************************************************************
+* Function PROF_begin()
+* Purpose: Start timing an opcode for the driver's profiler.
+*
+* Return:		start time in ns, 0 if profiling is off
+*
+* PROF_end() counts the opcode and adds the time since start to it at
+* the given level (PROF_PROCESS or PROF_TRANS).  It does nothing if
+* start is 0, so with profiling off each opcode costs one check.
+* PROF_iterations() adds the number of passes of a LOOP or REPEAT and
+* emits them as the ecp5_loop tracepoint.
+*************************************************************************/
+unsigned long long PROF_begin()
+{
+	return ecp5_profile_now(current_ecp5()->profile);
+}
+
+void PROF_end(int level, unsigned char opcode, unsigned long long start)
+{
+	ecp5_profile_op(current_ecp5()->profile, level, opcode, start);
+}
+
+void PROF_iterations(unsigned char opcode, unsigned int iterations)
+{
+	ecp5_profile_iterations(current_ecp5()->profile, opcode, iterations);
+	trace_ecp5_loop(opcode, iterations);
+}
+
+/************************************************************************
+* Function CACHE_expect()
+* Purpose: Tell the transaction cache what the last read must return.
+*
+* Byte index of the read matches if (byte & mask) == expected.  error is
+* what the engine returns on a mismatch, see ecp5_txcache_expect(), and
+* verify marks the read back of a data set.
+*
+* CACHE_loop() reports the start (CACHE_LOOP_BEGIN), each pass
+* (CACHE_LOOP_PASS) and the end (CACHE_LOOP_END) of a LOOP, so only the
+* last pass is kept.  Both do nothing unless the run is being rendered.
+*************************************************************************/
+void CACHE_expect(int index, unsigned char expected, unsigned char mask,
+		int error, int verify)
+{
+	ecp5_txcache_expect(&current_ecp5()->txcache, index, expected, mask,
+			error, verify);
+}
+
+void CACHE_loop(int event, unsigned int loopMax)
+{
+	ecp5_txcache_loop(&current_ecp5()->txcache, event, loopMax);
+}
+
 /************************************************************************
 * Function TRANS_transceive_stream(int trCount, unsigned char *trBuffer, 
 * 					int trCount2, int flag, unsigned char *trBuffer2
@@ -502,21 +1389,57 @@ int TRANS_runClk()
 #define DATA_TX		3
 #define DATA_RX		4
 
+/************************************************************************
+* Function shiftFrame(unsigned char *buffer, int n_bytes, int shift)
+* Purpose: Shift a decoded frame right by shift bits (1 to 7), in place.
+*
+* The frame is padded with 1's at the beginning and the last shift bits
+* fall off the end.  It is done a 32 bit word at a time, from the end so
+* every byte is read before it is overwritten; each word only needs the
+* byte before it.
+*************************************************************************/
+static void shiftFrame(unsigned char *buffer, int n_bytes, int shift)
+{
+	int i = n_bytes;
+	u32 word = 0;
+	u32 carry = 0;
+
+	/* bytes past the last whole word */
+	while (i % 4)
+	{
+		--i;
+		carry = i ? buffer[i - 1] : 0xFF;
+		buffer[i] = (unsigned char)((buffer[i] >> shift) |
+				(carry << (8 - shift)));
+	}
+
+	while (i > 0)
+	{
+		i -= 4;
+		word = get_unaligned_be32(buffer + i);
+		carry = i ? buffer[i - 1] : 0xFF;
+		put_unaligned_be32((word >> shift) | (carry << (32 - shift)),
+				buffer + i);
+	}
+}
+
 int TRANS_transceive_stream(int trCount, unsigned char *trBuffer, 
 							int trCount2, int flag, unsigned char *trBuffer2,
 							int mask_flag, unsigned char *maskBuffer)
 {
 	int i                         = 0;
-	unsigned short int tranxByte  = 0;
+	unsigned int tranxByte        = 0;
 	unsigned char trByte          = 0;
 	unsigned char dataByte        = 0;
 	int mismatch                  = 0;
 	unsigned char dataID          = 0;
+	unsigned char cmpMask         = 0;
+	int cacheError                = 0;
 
 	if(trCount > 0)
 	{
 		/* calculate # of bytes being transmitted */
-		tranxByte = (unsigned short int) (trCount / 8);
+		tranxByte = (unsigned int) (trCount / 8);
 		if(trCount % 8 != 0){
 			tranxByte ++;
 			trCount += (8 - (trCount % 8));
@@ -530,7 +1453,7 @@ int TRANS_transceive_stream(int trCount, unsigned char *trBuffer,
 		return 1;
 		break;
 	case BUFFER_TX:
-		tranxByte = (unsigned short int) (trCount2 / 8);
+		tranxByte = (unsigned int) (trCount2 / 8);
 		if(trCount2 % 8 != 0){
 			tranxByte ++;
 			trCount2 += (8 - (trCount2 % 8));
@@ -542,7 +1465,7 @@ int TRANS_transceive_stream(int trCount, unsigned char *trBuffer,
 		return 1;
 		break;
 	case BUFFER_RX:
-		tranxByte = (unsigned short int)(trCount2 / 8);
+		tranxByte = (unsigned int)(trCount2 / 8);
 		if(trCount2 % 8 != 0){
 			tranxByte ++;
 			trCount2 += (8 - (trCount2 % 8));
@@ -554,57 +1477,68 @@ int TRANS_transceive_stream(int trCount, unsigned char *trBuffer,
 		return 1; 
 		break;
 	case DATA_TX:
-		tranxByte = (unsigned short int)((trCount2 + 7) / 8);
-		if(trCount2 % 8 != 0){
-			trByte = (unsigned char)(0xFF << (trCount2 % 8));
-		}
-		else
-			trByte = 0;
+		tranxByte = (unsigned int)((trCount2 + 7) / 8);
+		if(tranxByte > dataBufferSize)
+			return ERROR_PROC_ALGO;
 
 		if(trBuffer2 != 0)
 			dataID = *trBuffer2;
 		else
 			dataID = 0x04;
+		if(!dryRun)
+			ecp5_progress_data_set(&current_ecp5()->progress, dataID);
 
+		/* decode the whole frame first, byte bounded frames go out as
+		   they are */
 		for (i=0; i<tranxByte; i++){
 			if(i == 0){
-				if( !HLDataGetByte(dataID, &dataByte, trCount2) )
+				if( !HLDataGetByte(dataID, &dataBuffer[i], trCount2) )
 					return ERROR_INIT_DATA;
 			}
 			else{
-				if( !HLDataGetByte(dataID, &dataByte, 0) )
+				if( !HLDataGetByte(dataID, &dataBuffer[i], 0) )
 					return ERROR_INIT_DATA;
 			}
-			if(trCount2 % 8 != 0)
-				trByte += (unsigned char) (dataByte >> (8- (trCount2 % 8)));
-			else
-				trByte = dataByte;
-
-			dataBuffer[i] = trByte;
-
-			/* do not remove the line below!  It handles the padding for 
-			   non-byte-bounded data */
-			if(trCount2 % 8 != 0)
-				trByte = (unsigned char)(dataByte << (trCount2 % 8));
 		}
+
+		/* do not remove the lines below!  They handle the padding for 
+		   non-byte-bounded data */
 		if(trCount2 % 8 != 0){
+			shiftFrame(dataBuffer, tranxByte, 8 - (trCount2 % 8));
 			trCount2 += (8 - (trCount2 % 8));
 		}
 		if(!TRANS_transmitBytes(dataBuffer, trCount2))
 			return ERROR_PROC_HARDWARE;
+		ecp5_profile_data(current_ecp5()->profile, dataID, tranxByte, 0);
 		return 1;
 		break;
 	case DATA_RX:
-		tranxByte = (unsigned short int)(trCount2 / 8);
+		tranxByte = (unsigned int)(trCount2 / 8);
 		if(trCount2 % 8 != 0){
 			tranxByte ++;
 		}
+		if(tranxByte > dataBufferSize)
+			return ERROR_PROC_ALGO;
 		if(trBuffer2 != 0)
 			dataID = *trBuffer2;
 		else
 			dataID = 0x04;
+		if(!dryRun)
+			ecp5_progress_data_set(&current_ecp5()->progress, dataID);
 		if(!TRANS_receiveBytes(dataBuffer, (tranxByte * 8) ))
 			return ERROR_PROC_HARDWARE;
+		if(!dryRun)
+			ecp5_progress_verified(&current_ecp5()->progress, tranxByte);
+		ecp5_profile_data(current_ecp5()->profile, dataID, 0, tranxByte);
+		/* what a mismatch returns below, ERROR_VERIFICATION is ignored */
+		if(dataID == 0x01 && a_uiRowCount == 0)
+			cacheError = ERROR_IDCODE;
+		else if(dataID == 0x05)
+			cacheError = ERROR_USERCODE;
+		else if(dataID == 0x06)
+			cacheError = ERROR_SED;
+		else if(dataID == 0x07)
+			cacheError = ERROR_TAG;
 		for(i=0; i<tranxByte; i++){
 			if(i == 0){
 				if( !HLDataGetByte(dataID, &dataByte, trCount2) )
@@ -616,11 +1550,16 @@ int TRANS_transceive_stream(int trCount, unsigned char *trBuffer,
 			}
 
 			trByte = dataBuffer[i];
+			cmpMask = 0xFF;
 			if(mask_flag)
 			{
 				trByte = trByte & maskBuffer[i];
 				dataByte = dataByte & maskBuffer[i];
+				cmpMask = maskBuffer[i];
 			}
+			if(i == tranxByte - 1)
+				cmpMask &= (unsigned char)(0xFF << (8 - (trCount2 % 8)));
+			CACHE_expect(i, dataByte & cmpMask, cmpMask, cacheError, 1);
 			if(i == tranxByte - 1){
 				trByte = (unsigned char)(trByte ^ dataByte) & 
 					(unsigned char)(0xFF << (8 - (trCount2 % 8)));
@@ -628,7 +1567,7 @@ int TRANS_transceive_stream(int trCount, unsigned char *trBuffer,
 			else
 				trByte = (unsigned char)(trByte ^ dataByte);
 			
-			if(trByte)
+			if(trByte && !dryRun)
 				mismatch ++;
 		}
 		if(mismatch == 0)
@@ -2,6 +2,8 @@
 
 #define _HARDWARE_H_
 
+#include "core.h"
+
 /************************************************************************
 * 
 * Function Definition
@@ -14,8 +16,25 @@
 *************************************************************************/
 int SPI_init();
 int SPI_final();
+int SPI_readDeviceState(unsigned char *idcode, unsigned char *usercode,
+			unsigned char *status, int *done);
+int SPI_readIdcodes(unsigned char *idcodes, int count);
 int wait(int ms);
 
+/************************************************************************
+* Session buffers, see SSPIEm_open()
+*************************************************************************/
+/* whole cache lines, so DMA of one buffer does not touch the next */
+#define SPI_BUFFER_ALIGN(n)	(((n) + L1_CACHE_BYTES - 1) & ~(L1_CACHE_BYTES - 1))
+
+extern unsigned char *dataBuffer;	/* largest data frame */
+
+unsigned char *SPI_sessionMemory(unsigned int size);
+
+unsigned int SPI_buffersSize(unsigned int transferBytes, unsigned int dataBytes);
+void SPI_setBuffers(unsigned char *buffers, unsigned int transferBytes,
+			unsigned int dataBytes);
+
 /************************************************************************
 * SPI transmission functions
 *************************************************************************/
@@ -25,11 +44,45 @@ int TRANS_cstoggle(unsigned char channel);
 int TRANS_runClk();
 int TRANS_transmitBytes(unsigned char *trBuffer, int trCount);
 int TRANS_receiveBytes(unsigned char *rcBuffer, int rcCount);
+int TRANS_transmitList(unsigned char **buffers, int *counts, int n);
+
+#define TRANS_REPEAT_BEGIN	0
+#define TRANS_REPEAT_PASS	1
+#define TRANS_REPEAT_END	2
+
+void TRANS_repeat(int event);
 
 int TRANS_transceive_stream(int trCount, unsigned char *trBuffer, 
 							int trCount2, int flag, unsigned char *trBuffer2,
 							int mask_flag, unsigned char *maskBuffer);
 
+/************************************************************************
+* Dry run functions
+*************************************************************************/
+void SPI_setDryRun(SSPIEm_dryrunStats *stats);
+int SPI_isDryRun();
+
+/************************************************************************
+* Profiling functions
+*************************************************************************/
+#define PROF_PROCESS	0
+#define PROF_TRANS		1
+
+unsigned long long PROF_begin();
+void PROF_end(int level, unsigned char opcode, unsigned long long start);
+void PROF_iterations(unsigned char opcode, unsigned int iterations);
+
+/************************************************************************
+* Transaction cache functions
+*************************************************************************/
+#define CACHE_LOOP_BEGIN	0
+#define CACHE_LOOP_PASS		1
+#define CACHE_LOOP_END		2
+
+void CACHE_expect(int index, unsigned char expected, unsigned char mask,
+		int error, int verify);
+void CACHE_loop(int event, unsigned int loopMax);
+
 
 /************************************************************************
 * debug utility functions
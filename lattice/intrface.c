@@ -19,6 +19,7 @@
 extern unsigned char *data_mem;
 
 #include "opcode.h"
+#include "../trace.h"
 
 /************************************************************************
 *
@@ -283,6 +284,9 @@ extern unsigned char *data_mem;
 	* dataGetByte() - This function is responsible to get a byte from
 	*					data.
 	*
+	* dataSeek()	  - This function moves the data stream to an address
+	*					of the data sets, as reading up to it would.
+	*
 	* dataFinal()	  - This function allows you to finalize the data.  If
 	*					the embedded system has a file system, you may 
 	*					implement closing the file here.
@@ -318,8 +322,8 @@ extern unsigned char *data_mem;
 		/********************************************************************
 		* End of design-dependent implementation
 		*********************************************************************/
-		int i,j;
-
+//		int i,j;
+//
 //		pr_info("lattice_impl_set_deta_ptr:\n");
 //		for (i = 0; i < 1024;){
 //			char buf[1024];
@@ -512,6 +516,34 @@ extern unsigned char *data_mem;
 		return PROC_COMPLETE;
 	}
 
+	/*
+	* The data image is in memory, so moving dataIndex replaces rewinding
+	* and reading through the image.  The bytes skipped are not added to
+	* d_CSU, which is never checked.
+	*/
+	int dataSeek(unsigned int address)
+	{
+		unsigned int base;
+
+		/********************************************************************
+		* Start of design-dependent implementation
+		*
+		* You may put your code here.
+		*********************************************************************/
+
+		base = dataIndex - d_currentAddress;
+		if(address > dataSize - base)
+			return PROC_FAIL;
+		dataIndex = base + address;
+
+		/********************************************************************
+		* End of design-dependent implementation
+		*********************************************************************/
+
+		d_currentAddress = address;
+		return PROC_COMPLETE;
+	}
+
 	int dataFinal(){
 
 		/********************************************************************
@@ -573,8 +605,15 @@ extern unsigned char *data_mem;
 							break;
 						}
 					}
-					for(i = 0; i < bufferSize; i ++)
-						HLDataGetByte(dataSet, &tempChar, uncomp_bitsize);
+					/* an uncompressed set goes on where it was left */
+					if(bufferSize && !get_compression()){
+						if( !dataSeek(d_currentAddress + bufferSize) )
+							return PROC_FAIL;
+						d_currentSize = bufferSize;
+					}
+					else
+						for(i = 0; i < bufferSize; i ++)
+							HLDataGetByte(dataSet, &tempChar, uncomp_bitsize);
 				}
 
 				if(d_toc[d_currentDataSetIndex].uncomp_size == 0){
@@ -722,6 +761,8 @@ extern unsigned char *data_mem;
 		{
 			int i                      = 0;
 			unsigned char currentByte  = 0;
+			int rewound                = 0;
+			unsigned int skipFrom      = d_currentAddress;
 			for(i = 0; i < d_tocNumber; i++){
 				if(d_toc[i].ID == dataSet){
 					d_currentDataSetIndex = i;
@@ -733,27 +774,24 @@ extern unsigned char *data_mem;
 
 			/******************************************************************
 			* prepare data for reading
-			* for streaming data, ignore data prior to the address
-			* if the current address is bigger than requested address, reset
-			* the stream
+			* move straight to the address of the data set, backwards too,
+			* see dataSeek()
 			******************************************************************/
 			if(d_currentAddress > d_toc[d_currentDataSetIndex].address){
-				i = d_currentDataSetIndex;
-				dataReset(0);
-				d_currentDataSetIndex = i;
+				rewound = 1;
+				skipFrom = 0;
 			}
 			set_compression(d_toc[d_currentDataSetIndex].compression);
-			/* move currentAddress to requestAddress */
-			while(d_currentAddress < d_toc[d_currentDataSetIndex].address){
-				if( !dataGetByte( &currentByte, 1, NULL ) )
-					return PROC_FAIL;
-			}
+			if( !dataSeek(d_toc[d_currentDataSetIndex].address) )
+				return PROC_FAIL;
 			/* read BEGIN_OF_DATA */
 			if( !dataGetByte( &currentByte, 1, &d_CSU ) )
 				return PROC_FAIL;
 			if( !dataGetByte( &currentByte, 1, &d_CSU ) )
 				return PROC_FAIL;
 			d_requestNewData = 0;
+			trace_ecp5_data_set(dataSet, d_toc[d_currentDataSetIndex].address,
+					rewound, d_toc[d_currentDataSetIndex].address - skipFrom);
 			return PROC_COMPLETE;
 		}
 
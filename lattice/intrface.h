@@ -34,6 +34,7 @@ int dataPreset(unsigned char *setDataPtr, unsigned int setDataSize);
 int dataInit();			// initialize data
 int dataGetByte(unsigned char *byteOut, short int incCurrentAddr, CSU *checksumUnit);	// get one byte from current column
 int dataReset(unsigned char isResetBuffer);							// reset data pointer
+int dataSeek(unsigned int address);						// move to a data set address
 int dataFinal();
 
 int HLDataGetByte(unsigned char dataSet, unsigned char *dataByte, unsigned int uncomp_bitsize);
@@ -5,6 +5,14 @@
 #include <linux/slab.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/bitops.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+#include <linux/pm_runtime.h>
+#include <linux/ctype.h>
+#include <linux/kref.h>
 
 #include <asm/uaccess.h>
 #include <asm-generic/errno-base.h>
@@ -13,28 +21,48 @@
 #include <linux/spi/spi.h>
 
 #include "lattice/SSPIEm.h"
+#include "ecp5.h"
+#include "ecp5_sspi.h"
+#include "trace.h"
 
-struct ecp5
-{
-	struct spi_device *spi;
-	int programming_result;
+struct spi_device *current_programming_ecp5;
 
-	int algo_size;
-	unsigned char *algo_mem;
-	struct mutex algo_lock;
-	struct miscdevice algo_char_device;
+static int ecp5_program(struct ecp5 *dev_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size, int ensure, int prio);
+static void ecp5_program_begin(struct ecp5 *dev_info);
+static void ecp5_program_done(struct ecp5 *dev_info, int result);
+static void ecp5_program_result(struct ecp5 *dev_info,
+		struct ecp5_program_result *out, int result);
 
-	int data_size;
-	unsigned char *data_mem;
-	struct mutex data_lock;
-	struct miscdevice data_char_device;
-};
+/*
+ * Free the device once remove and every open file dropped it.  The
+ * pins and the run scratch memory are gone already, see ecp5_remove().
+ */
+static void ecp5_free(struct kref *ref)
+{
+	struct ecp5 *ecp5_info = container_of(ref, struct ecp5, ref);
 
-static DEFINE_MUTEX(programming_lock);
-struct spi_device *current_programming_ecp5;
+	kzfree(ecp5_info->algo_char_device.name);
+	kzfree(ecp5_info->data_char_device.name);
+	kzfree(ecp5_info->ctl_char_device.name);
+	mutex_destroy(&ecp5_info->algo_lock);
+	mutex_destroy(&ecp5_info->data_lock);
+
+	kzfree(ecp5_info->algo_mem);
+	kzfree(ecp5_info->data_mem);
+	ecp5_slots_free(ecp5_info);
+	ecp5_txcache_free(ecp5_info);
+	mutex_destroy(&ecp5_info->lock);
+	kfree(ecp5_info);
+}
 
 /*
  * File operations
+ *
+ * misc_open() calls open under the lock misc_deregister() takes, so an
+ * open either takes its reference before remove deregisters the device
+ * or doesn't find the device at all.
  */
 int ecp5_sspi_algo_open(struct inode *inode, struct file *fp)
 {
@@ -46,6 +74,7 @@ int ecp5_sspi_algo_open(struct inode *inode, struct file *fp)
 		return(-EBUSY);
 	}
 
+	kref_get(&ecp5_info->ref);
 	fp->private_data = ecp5_info;
 
 	return (0);
@@ -57,6 +86,7 @@ int ecp5_sspi_algo_release(struct inode *inode, struct file *fp)
 	struct ecp5 *ecp5_info = fp->private_data;
 
 	mutex_unlock(&ecp5_info->algo_lock);
+	kref_put(&ecp5_info->ref, ecp5_free);
 
 	return (0);
 }
@@ -71,6 +101,7 @@ int ecp5_sspi_data_open(struct inode *inode, struct file *fp)
 		return(-EBUSY);
 	}
 
+	kref_get(&ecp5_info->ref);
 	fp->private_data = ecp5_info;
 
 	return (0);
@@ -82,6 +113,7 @@ int ecp5_sspi_data_release(struct inode *inode, struct file *fp)
 	struct ecp5 *ecp5_info = fp->private_data;
 
 	mutex_unlock(&ecp5_info->data_lock);
+	kref_put(&ecp5_info->ref, ecp5_free);
 
 	return (0);
 }
@@ -129,29 +161,37 @@ ssize_t ecp5_sspi_algo_write(struct file *fp, const char __user *ubuf, size_t le
 {
 	struct ecp5 *ecp5_info = fp->private_data;
 	ssize_t size = max_t(ssize_t, len + *offp, ecp5_info->algo_size);
+	unsigned char *mem;
 
-	ecp5_info->algo_size = len + *offp;
-	ecp5_info->algo_mem = krealloc(ecp5_info->algo_mem, size, GFP_KERNEL);
-	if (!ecp5_info->algo_mem)
-	{
-		pr_err("ECP5: can't allocate enough memory\n");
-		return (-EFAULT);
-	}
+	mutex_lock(&ecp5_info->lock);
 
-	if (!mutex_trylock(&programming_lock))
+	if (test_bit(ECP5_PROGRAMMING, &ecp5_info->flags))
 	{
+		mutex_unlock(&ecp5_info->lock);
 		pr_err("ECP5: can't write to algo device while programming");
 		return(-EBUSY);
 	}
 
+	mem = krealloc(ecp5_info->algo_mem, size, GFP_KERNEL);
+	if (!mem)
+	{
+		mutex_unlock(&ecp5_info->lock);
+		pr_err("ECP5: can't allocate enough memory\n");
+		return (-ENOMEM);
+	}
+	ecp5_info->algo_mem = mem;
+
 	if (copy_from_user(ecp5_info->algo_mem + *offp, ubuf, len) != 0)
+	{
+		mutex_unlock(&ecp5_info->lock);
 		return (-EFAULT);
-
-	mutex_unlock(&programming_lock);
+	}
 
 	ecp5_info->algo_size = size;
 	*offp += len;
 
+	mutex_unlock(&ecp5_info->lock);
+
 	return (len);
 }
 
@@ -160,29 +200,37 @@ ssize_t ecp5_sspi_data_write(struct file *fp, const char __user *ubuf, size_t le
 {
 	struct ecp5 *ecp5_info = fp->private_data;
 	ssize_t size = max_t(ssize_t, len + *offp, ecp5_info->data_size);
+	unsigned char *mem;
 
-	ecp5_info->data_mem = krealloc(ecp5_info->data_mem, size, GFP_KERNEL);
-	if (!ecp5_info->data_mem)
-	{
-		pr_err("ECP5: can't allocate enough memory\n");
-		return (-EFAULT);
-	}
+	mutex_lock(&ecp5_info->lock);
 
-	if (!mutex_trylock(&programming_lock))
+	if (test_bit(ECP5_PROGRAMMING, &ecp5_info->flags))
 	{
+		mutex_unlock(&ecp5_info->lock);
 		pr_err("ECP5: can't write to data device while programming");
 		return(-EBUSY);
 	}
 
+	mem = krealloc(ecp5_info->data_mem, size, GFP_KERNEL);
+	if (!mem)
+	{
+		mutex_unlock(&ecp5_info->lock);
+		pr_err("ECP5: can't allocate enough memory\n");
+		return (-ENOMEM);
+	}
+	ecp5_info->data_mem = mem;
+
 	if (copy_from_user(ecp5_info->data_mem + *offp, ubuf, len) != 0)
+	{
+		mutex_unlock(&ecp5_info->lock);
 		return (-EFAULT);
-
-	mutex_unlock(&programming_lock);
-
+	}
 
 	ecp5_info->data_size = size;
 	*offp += len;
 
+	mutex_unlock(&ecp5_info->lock);
+
 	return (len);
 }
 
@@ -262,6 +310,223 @@ loff_t ecp5_sspi_data_lseek(struct file *fp, loff_t off, int whence)
         return (newpos);
 }
 
+/*
+ * Control device, programs images straight from pinned user memory
+ */
+struct ecp5_pinned
+{
+	struct page **pages;
+	int nr_pages;
+	void *vaddr;
+};
+
+/*
+ * Pin len bytes of user memory at uaddr and map them contiguously into
+ * the kernel, the engine reads images through plain pointers.
+ */
+static unsigned char *ecp5_pin_user(struct ecp5_pinned *pin,
+		unsigned long uaddr, size_t len)
+{
+	unsigned long first = uaddr >> PAGE_SHIFT;
+	unsigned long last = (uaddr + len - 1) >> PAGE_SHIFT;
+	int pinned;
+	int i;
+
+	memset(pin, 0, sizeof(*pin));
+	if (len == 0)
+		return (NULL);
+
+	pin->nr_pages = last - first + 1;
+	pin->pages = kcalloc(pin->nr_pages, sizeof(*pin->pages), GFP_KERNEL);
+	if (!pin->pages)
+		return (ERR_PTR(-ENOMEM));
+
+	pinned = get_user_pages_fast(uaddr & PAGE_MASK, pin->nr_pages, 0,
+			pin->pages);
+	if (pinned < pin->nr_pages)
+	{
+		for (i = 0; i < pinned; ++i)
+			put_page(pin->pages[i]);
+		kfree(pin->pages);
+		pin->pages = NULL;
+		return (ERR_PTR(pinned < 0 ? pinned : -EFAULT));
+	}
+
+	pin->vaddr = vmap(pin->pages, pin->nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!pin->vaddr)
+	{
+		for (i = 0; i < pin->nr_pages; ++i)
+			put_page(pin->pages[i]);
+		kfree(pin->pages);
+		pin->pages = NULL;
+		return (ERR_PTR(-ENOMEM));
+	}
+
+	return ((unsigned char *)pin->vaddr + offset_in_page(uaddr));
+}
+
+static void ecp5_unpin_user(struct ecp5_pinned *pin)
+{
+	int i;
+
+	if (!pin->pages)
+		return;
+
+	vunmap(pin->vaddr);
+	for (i = 0; i < pin->nr_pages; ++i)
+		put_page(pin->pages[i]);
+	kfree(pin->pages);
+	pin->pages = NULL;
+}
+
+static int ecp5_req_prio(u32 flags)
+{
+	return (flags & ECP5_PROGRAM_RECOVERY ? ECP5_PRIO_RECOVERY :
+			ECP5_PRIO_BULK);
+}
+
+static long ecp5_sspi_ctl_program(struct ecp5 *ecp5_info,
+		struct ecp5_program_req __user *ureq)
+{
+	struct ecp5_program_req req;
+	struct ecp5_pinned algo_pin, data_pin;
+	unsigned char *algo, *data;
+	long ret = 0;
+
+	if (copy_from_user(&req, ureq, sizeof(req)) != 0)
+		return (-EFAULT);
+
+	if ((req.flags & ~(ECP5_PROGRAM_ENSURE | ECP5_PROGRAM_RECOVERY)) ||
+			req.algo_size == 0 ||
+			req.algo_size > INT_MAX || req.data_size > INT_MAX)
+		return (-EINVAL);
+
+	mutex_lock(&ecp5_info->lock);
+	if (test_bit(ECP5_REMOVED, &ecp5_info->flags))
+	{
+		mutex_unlock(&ecp5_info->lock);
+		return (-ENODEV);
+	}
+	/* counted in like a queued job, ecp5_program() waits for the engine */
+	ecp5_program_begin(ecp5_info);
+	mutex_unlock(&ecp5_info->lock);
+
+	algo = ecp5_pin_user(&algo_pin, (unsigned long)req.algo_ptr,
+			req.algo_size);
+	if (IS_ERR(algo))
+	{
+		ret = PTR_ERR(algo);
+		ecp5_program_done(ecp5_info, ret);
+		return (ret);
+	}
+
+	data = ecp5_pin_user(&data_pin, (unsigned long)req.data_ptr,
+			req.data_size);
+	if (IS_ERR(data))
+	{
+		ret = PTR_ERR(data);
+		ecp5_unpin_user(&algo_pin);
+		ecp5_program_done(ecp5_info, ret);
+		return (ret);
+	}
+
+	ret = ecp5_program(ecp5_info, algo, req.algo_size,
+			data, req.data_size,
+			ecp5_info->ensure || (req.flags & ECP5_PROGRAM_ENSURE),
+			ecp5_req_prio(req.flags));
+
+	ecp5_unpin_user(&data_pin);
+	ecp5_unpin_user(&algo_pin);
+
+	ecp5_program_result(ecp5_info, &req.out, ret);
+	ecp5_program_done(ecp5_info, ret);
+
+	if (copy_to_user(ureq, &req, sizeof(req)) != 0)
+		return (-EFAULT);
+
+	return (0);
+}
+
+static long ecp5_sspi_ctl_program_slot(struct ecp5 *ecp5_info,
+		struct ecp5_slot_req __user *ureq)
+{
+	struct ecp5_slot_req req;
+	struct ecp5_slot *slot;
+	int result;
+
+	if (copy_from_user(&req, ureq, sizeof(req)) != 0)
+		return (-EFAULT);
+
+	req.name[ECP5_SLOT_NAME_LEN - 1] = '\0';
+	if (req.flags & ~(ECP5_PROGRAM_ENSURE | ECP5_PROGRAM_RECOVERY))
+		return (-EINVAL);
+
+	mutex_lock(&ecp5_info->lock);
+	slot = ecp5_slot_find(ecp5_info, req.name);
+	if (!slot)
+	{
+		mutex_unlock(&ecp5_info->lock);
+		return (-ENOENT);
+	}
+	if (test_bit(ECP5_REMOVED, &ecp5_info->flags))
+	{
+		mutex_unlock(&ecp5_info->lock);
+		return (-ENODEV);
+	}
+	ecp5_program_begin(ecp5_info);
+	mutex_unlock(&ecp5_info->lock);
+
+	/* slots can't change while ECP5_PROGRAMMING is set */
+	result = ecp5_program(ecp5_info, slot->algo_mem, slot->algo_size,
+			slot->data_mem, slot->data_size,
+			ecp5_info->ensure || (req.flags & ECP5_PROGRAM_ENSURE),
+			ecp5_req_prio(req.flags));
+
+	ecp5_program_result(ecp5_info, &req.out, result);
+	ecp5_program_done(ecp5_info, result);
+
+	if (copy_to_user(ureq, &req, sizeof(req)) != 0)
+		return (-EFAULT);
+
+	return (0);
+}
+
+int ecp5_sspi_ctl_open(struct inode *inode, struct file *fp)
+{
+	struct ecp5 *ecp5_info = container_of(fp->private_data, struct ecp5, ctl_char_device);
+
+	kref_get(&ecp5_info->ref);
+	fp->private_data = ecp5_info;
+
+	return (0);
+}
+
+int ecp5_sspi_ctl_release(struct inode *inode, struct file *fp)
+{
+	struct ecp5 *ecp5_info = fp->private_data;
+
+	kref_put(&ecp5_info->ref, ecp5_free);
+
+	return (0);
+}
+
+long ecp5_sspi_ctl_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
+{
+	struct ecp5 *ecp5_info = fp->private_data;
+
+	switch (cmd) {
+
+	case ECP5_IOC_PROGRAM:
+		return (ecp5_sspi_ctl_program(ecp5_info, (void __user *)arg));
+
+	case ECP5_IOC_PROGRAM_SLOT:
+		return (ecp5_sspi_ctl_program_slot(ecp5_info, (void __user *)arg));
+
+	default:
+		return (-ENOTTY);
+	}
+}
+
 struct file_operations algo_fops = {
 	.owner = THIS_MODULE,
 	.read = ecp5_sspi_algo_read,
@@ -280,6 +545,15 @@ struct file_operations data_fops = {
 	.llseek = ecp5_sspi_data_lseek,
 };
 
+struct file_operations ctl_fops = {
+	.owner = THIS_MODULE,
+	.open = ecp5_sspi_ctl_open,
+	.release = ecp5_sspi_ctl_release,
+	.unlocked_ioctl = ecp5_sspi_ctl_ioctl,
+	.compat_ioctl = ecp5_sspi_ctl_ioctl,
+	.llseek = noop_llseek,
+};
+
 
 ssize_t algo_size_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
@@ -306,46 +580,724 @@ static ssize_t data_size_store(struct device *dev, struct device_attribute *attr
 ssize_t program_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
 	struct ecp5 *dev_info = dev_get_drvdata(dev);
-	return (sprintf(buf, "%d\n", dev_info->programming_result));
+	ssize_t len;
+
+	mutex_lock(&dev_info->lock);
+	len = sprintf(buf, "%d\n", dev_info->programming_result);
+	/* a failure shown once is not latched any more */
+	if (!dev_info->nr_runs)
+		dev_info->failed_result = 0;
+	mutex_unlock(&dev_info->lock);
+
+	return (len);
 }
 
+/*
+ * Keep the SPI controller resumed while the engine uses the bus, so it
+ * is not suspended and resumed between the messages of a run.  Without
+ * runtime PM on the controller this only counts.
+ */
+static void ecp5_bus_get(struct ecp5 *dev_info)
+{
+	pm_runtime_get_sync(dev_info->spi->master->dev.parent);
+}
+
+static void ecp5_bus_put(struct ecp5 *dev_info)
+{
+	pm_runtime_put(dev_info->spi->master->dev.parent);
+}
+
+/*
+ * Run the lattice engine on the given images.
+ * The runs of the device take turns by prio, then wait for the lattice
+ * engine, which runs one device at a time, see sched.c.
+ * With ensure set the run is skipped, and reported successful, if the
+ * FPGA already runs the image.  A run failing verification or the
+ * IDCODE check is repeated at a lower SPI clock, see clock.c.
+ */
+static int ecp5_program(struct ecp5 *dev_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size, int ensure, int prio)
+{
+	int result;
+
+	ecp5_turn_get(dev_info, prio);
+	/* runs still waiting for their turn at remove don't start */
+	if (test_bit(ECP5_REMOVED, &dev_info->flags))
+	{
+		ecp5_turn_put(dev_info);
+		return (-ECANCELED);
+	}
+	ecp5_engine_get();
+	ecp5_bus_get(dev_info);
+
+	current_programming_ecp5 = dev_info->spi;
+	ecp5_progress_start(dev_info, algo_size, data_size);
+	ecp5_profile_start(dev_info);
+	ecp5_record_start(dev_info);
+	trace_ecp5_program_start(dev_name(&dev_info->spi->dev),
+			algo_size, data_size);
+
+	if (ensure && ecp5_ensure_check(dev_info, algo, algo_size,
+				data, data_size))
+	{
+		atomic_set(&dev_info->progress.skipped, 1);
+		ecp5_record_finish(dev_info);
+		ecp5_profile_finish(dev_info);
+		ecp5_progress_finish(dev_info, ECP5_RESULT_OK);
+		trace_ecp5_program_end(dev_name(&dev_info->spi->dev),
+				ECP5_RESULT_OK, 1);
+		current_programming_ecp5 = NULL;
+
+		ecp5_bus_put(dev_info);
+		ecp5_engine_put();
+		ecp5_turn_put(dev_info);
+
+		pr_info("ECP5: FPGA already runs the image, programming skipped\n");
+		return (ECP5_RESULT_OK);
+	}
+
+	/* a failure that a too fast SPI clock may cause is retried slower */
+	ecp5_clock_start(dev_info);
+	do
+	{
+		/* a known image is replayed from the transaction cache */
+		result = ecp5_txcache_run(dev_info, algo, algo_size,
+				data, data_size);
+		if (!result)
+		{
+			/* here we call lattice programming code */
+			/* 1 - preparing data*/
+			result = SSPIEm_preset(algo, algo_size, data, data_size);
+			pr_debug("ECP5: SSPIEm_preset result %d\n", result);
+			/* 2 - programming here */
+			result = SSPIEm(0xFFFFFFFF);
+		}
+		ecp5_txcache_finish(dev_info, result);
+	} while (ecp5_clock_retry(dev_info, result));
+
+	ecp5_record_finish(dev_info);
+	ecp5_profile_finish(dev_info);
+	ecp5_progress_finish(dev_info, result);
+	trace_ecp5_program_end(dev_name(&dev_info->spi->dev), result, 0);
+	current_programming_ecp5 = NULL;
+
+	ecp5_bus_put(dev_info);
+	ecp5_engine_put();
+	ecp5_turn_put(dev_info);
+
+	if (result != ECP5_RESULT_OK)
+		pr_err("ECP5: FPGA programming failed with code %d\n", result);
+	else
+		pr_info("ECP5: FPGA programming success\n");
+
+	return (result);
+}
+
+/*
+ * Check images without programming, see SSPIEm_validate()
+ */
+int ecp5_validate_images(unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size)
+{
+	int result;
+
+	ecp5_engine_get();
+	result = SSPIEm_validate(algo, algo_size, data, data_size);
+	ecp5_engine_put();
+
+	return (result);
+}
+
+/*
+ * Run the algorithm without touching the FPGA, see SSPIEm_dryrun(), and
+ * estimate the programming time at spi_hz.
+ */
+int ecp5_dry_run_images(struct ecp5 *ecp5_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size,
+		u32 spi_hz, struct ecp5_dry_run *out)
+{
+	SSPIEm_dryrunStats stats;
+	int result;
+
+	ecp5_engine_get();
+	/* the hardware hooks still look up the device */
+	current_programming_ecp5 = ecp5_info->spi;
+	result = SSPIEm_dryrun(algo, algo_size, data, data_size, &stats);
+	current_programming_ecp5 = NULL;
+	ecp5_engine_put();
+
+	out->result = result;
+	out->spi_hz = spi_hz;
+	out->tx_bits = stats.txBits;
+	out->rx_bits = stats.rxBits;
+	out->wait_ms = stats.waitMs;
+	out->transactions = stats.transactions;
+	out->transfers = stats.transfers;
+	out->estimate_us = div_u64((stats.txBits + stats.rxBits) * 1000000,
+			spi_hz) + stats.waitMs * 1000;
+
+	return (result);
+}
+
+/*
+ * Set the SPI clock of the device, or calibrate it if spi_hz is 0, see
+ * clock.c.  Returns the clock or a negative errno.
+ */
+static int ecp5_spi_clock(struct ecp5 *ecp5_info, u32 spi_hz)
+{
+	int ret;
+
+	ecp5_engine_get();
+	if (spi_hz)
+		ret = ecp5_clock_set(ecp5_info, spi_hz);
+	else
+	{
+		ecp5_bus_get(ecp5_info);
+		ret = ecp5_clock_calibrate(ecp5_info);
+		ecp5_bus_put(ecp5_info);
+	}
+	ecp5_engine_put();
+
+	return (ret < 0 ? ret : ecp5_info->spi->max_speed_hz);
+}
+
+/*
+ * Fill the ioctl result from the statistics of the last run
+ */
+static void ecp5_program_result(struct ecp5 *dev_info,
+		struct ecp5_program_result *out, int result)
+{
+	struct ecp5_progress *progress = &dev_info->progress;
+
+	out->result = result;
+	out->last_data_set = atomic_read(&progress->data_set);
+	out->elapsed_ns = ktime_to_ns(ktime_sub(progress->finish, progress->start));
+	out->tx_bytes = atomic_long_read(&progress->tx_bytes);
+	out->rx_bytes = atomic_long_read(&progress->rx_bytes);
+	out->verified_bytes = atomic_long_read(&progress->verified_bytes);
+	out->flags = atomic_read(&progress->skipped) ? ECP5_RESULT_SKIPPED : 0;
+	if (atomic_read(&progress->cached))
+		out->flags |= ECP5_RESULT_CACHED;
+	if (atomic_read(&progress->retries))
+		out->flags |= ECP5_RESULT_SLOWED;
+	out->spi_hz = dev_info->spi->max_speed_hz;
+}
+
+/*
+ * Count a queued or running run in, with dev_info->lock held.
+ * ECP5_PROGRAMMING stays set until every run is done, so the images
+ * they program can't change.
+ */
+static void ecp5_program_begin(struct ecp5 *dev_info)
+{
+	set_bit(ECP5_PROGRAMMING, &dev_info->flags);
+	dev_info->nr_runs++;
+	dev_info->programming_result = -EINPROGRESS;
+}
+
+/*
+ * Publish the result of a run counted in by ecp5_program_begin(), the
+ * result shows once no more runs are queued.  The first run that failed
+ * is latched until "program" is read, so a later successful run can't
+ * hide it.  Completion of every run is signalled by sysfs_notify() on
+ * the "program" attribute, so userspace can poll() it.
+ */
+static void ecp5_program_done(struct ecp5 *dev_info, int result)
+{
+	mutex_lock(&dev_info->lock);
+	if (result != PROC_OVER && !dev_info->failed_result)
+		dev_info->failed_result = result;
+	if (!--dev_info->nr_runs)
+	{
+		dev_info->programming_result = dev_info->failed_result ?
+				dev_info->failed_result : result;
+		clear_bit(ECP5_PROGRAMMING, &dev_info->flags);
+		wake_up(&dev_info->runs_done);
+	}
+	mutex_unlock(&dev_info->lock);
+
+	sysfs_notify(&dev_info->spi->dev.kobj, NULL, "program");
+}
+
+/*
+ * Programming jobs, run on the device's ordered workqueue until its
+ * queue is empty.
+ */
+static void ecp5_program_work(struct work_struct *work)
+{
+	struct ecp5 *dev_info = container_of(work, struct ecp5, program_work);
+	struct ecp5_job job;
+	int result;
+
+	for (;;)
+	{
+		mutex_lock(&dev_info->lock);
+		if (!ecp5_job_next(dev_info, &job))
+		{
+			mutex_unlock(&dev_info->lock);
+			break;
+		}
+		mutex_unlock(&dev_info->lock);
+
+		if (job.slot == ECP5_SLOT_STAGING)
+		{
+			result = ecp5_program(dev_info,
+					dev_info->algo_mem, dev_info->algo_size,
+					dev_info->data_mem, dev_info->data_size,
+					dev_info->ensure, job.prio);
+		}
+		else
+		{
+			struct ecp5_slot *slot = &dev_info->slots[job.slot];
+
+			result = ecp5_program(dev_info,
+					slot->algo_mem, slot->algo_size,
+					slot->data_mem, slot->data_size,
+					dev_info->ensure, job.prio);
+		}
+
+		ecp5_program_done(dev_info, result);
+	}
+}
+
+/*
+ * Queue a job for slot, with dev_info->lock held
+ */
+static int ecp5_program_queue(struct ecp5 *dev_info, int slot, int prio)
+{
+	int ret;
+
+	ret = ecp5_job_queue(dev_info, slot, prio);
+	if (ret < 0)
+	{
+		pr_warn("ECP5: programming queue of spi%d.%d is full\n",
+				dev_info->spi->master->bus_num,
+				dev_info->spi->chip_select);
+		return (ret);
+	}
+
+	ecp5_program_begin(dev_info);
+	queue_work(dev_info->program_wq, &dev_info->program_work);
+
+	return (0);
+}
+
+/*
+ * A trailing "recovery" word asks for a recovery job, it is cut off
+ * count.  Anything else is a bulk job.
+ */
+static int ecp5_parse_prio(const char *buf, size_t *count)
+{
+	static const char word[] = "recovery";
+	size_t len = *count;
+
+	while (len > 0 && isspace(buf[len - 1]))
+		--len;
+	if (len < sizeof(word) - 1 ||
+			strncmp(buf + len - (sizeof(word) - 1), word,
+				sizeof(word) - 1))
+		return (ECP5_PRIO_BULK);
+
+	len -= sizeof(word) - 1;
+	if (len > 0 && !isspace(buf[len - 1]))
+		return (ECP5_PRIO_BULK);
+
+	*count = len;
+	return (ECP5_PRIO_RECOVERY);
+}
+
+/*
+ * Writing anything to "program" queues a programming job and returns
+ * immediately, "recovery" queues it ahead of bulk jobs.  Until the
+ * queue is empty "program" reads -EINPROGRESS, afterwards it reads the
+ * SSPIEm() result of the first job that failed since it was last read,
+ * else of the last job (2 means success).
+ */
 static ssize_t program_store(struct device *dev, struct device_attribute *attr,
 		const char *buf, size_t count)
 {
 	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	size_t len = count;
+	int prio = ecp5_parse_prio(buf, &len);
+	int ret;
 
-	if (!mutex_trylock(&programming_lock))
+	mutex_lock(&dev_info->lock);
+	ret = ecp5_program_queue(dev_info, ECP5_SLOT_STAGING, prio);
+	mutex_unlock(&dev_info->lock);
+	if (ret < 0)
+		return (ret);
+
+	sysfs_notify(&dev->kobj, NULL, "program");
+
+	return (count);
+}
+
+ssize_t slots_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	ssize_t len;
+
+	mutex_lock(&dev_info->lock);
+	len = ecp5_slots_show(dev_info, buf);
+	mutex_unlock(&dev_info->lock);
+
+	return (len);
+}
+
+/*
+ * Writing a name to "slot_save" validates the uploaded images and keeps
+ * them resident under that name.
+ */
+static ssize_t slot_save_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	char name[ECP5_SLOT_NAME_LEN];
+	int ret;
+
+	ret = ecp5_slot_parse_name(name, buf, count);
+	if (ret)
+		return (ret);
+
+	mutex_lock(&dev_info->lock);
+	ret = ecp5_slot_save(dev_info, name);
+	mutex_unlock(&dev_info->lock);
+
+	if (ret == 0)
+		sysfs_notify(&dev->kobj, NULL, "slots");
+
+	return (ret ? ret : count);
+}
+
+static ssize_t slot_delete_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	char name[ECP5_SLOT_NAME_LEN];
+	int ret;
+
+	ret = ecp5_slot_parse_name(name, buf, count);
+	if (ret)
+		return (ret);
+
+	mutex_lock(&dev_info->lock);
+	ret = ecp5_slot_delete(dev_info, name);
+	mutex_unlock(&dev_info->lock);
+
+	if (ret == 0)
+		sysfs_notify(&dev->kobj, NULL, "slots");
+
+	return (ret ? ret : count);
+}
+
+/*
+ * Writing a slot name to "program_slot" queues programming of that slot,
+ * "name recovery" ahead of bulk jobs.  The result is reported through
+ * "program" as for program_store().
+ */
+static ssize_t program_slot_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	struct ecp5_slot *slot;
+	char name[ECP5_SLOT_NAME_LEN];
+	size_t len = count;
+	int prio = ecp5_parse_prio(buf, &len);
+	int ret;
+
+	ret = ecp5_slot_parse_name(name, buf, len);
+	if (ret)
+		return (ret);
+
+	mutex_lock(&dev_info->lock);
+
+	slot = ecp5_slot_find(dev_info, name);
+	if (!slot)
 	{
-		pr_warn("ECP5: can't lock programming mutex \n");
-		pr_info("ECP5: (maybe someone already programming your chip?)");
-		return (count);
+		mutex_unlock(&dev_info->lock);
+		return (-ENOENT);
 	}
 
-	current_programming_ecp5 = dev_info->spi;
+	ret = ecp5_program_queue(dev_info, slot - dev_info->slots, prio);
+	mutex_unlock(&dev_info->lock);
+	if (ret < 0)
+		return (ret);
+
+	sysfs_notify(&dev->kobj, NULL, "program");
 
-	if (dev_info->spi != to_spi_device(dev)) {
-		pr_err("ECP5: Mystical error occurred\n");
+	return (count);
+}
+
+ssize_t ensure_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	return (sprintf(buf, "%d\n", dev_info->ensure));
+}
+
+static ssize_t ensure_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	unsigned long value;
+
+	if (kstrtoul(buf, 0, &value))
+		return (-EINVAL);
+
+	dev_info->ensure = !!value;
+
+	return (count);
+}
+
+ssize_t expected_usercode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+
+	if (!dev_info->has_expected_usercode)
+		return (sprintf(buf, "none\n"));
+
+	return (sprintf(buf, "0x%08x\n", dev_info->expected_usercode));
+}
+
+/*
+ * USERCODE ensure compares against when the algorithm does not check it,
+ * "none" clears it
+ */
+static ssize_t expected_usercode_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	u32 value;
+
+	if (sysfs_streq(buf, "none"))
+	{
+		dev_info->has_expected_usercode = 0;
+		return (count);
 	}
 
-	/* here we call lattice programming code */
-	/* 1 - preparing data*/
-	dev_info->programming_result = SSPIEm_preset(dev_info->algo_mem,
-			dev_info->algo_size, dev_info->data_mem,
-			dev_info->data_size);
-	pr_debug("ECP5: SSPIEm_preset result %d\n",
-					dev_info->programming_result);
-	/* 2 - programming here */
-	dev_info->programming_result = SSPIEm(0xFFFFFFFF);
+	if (kstrtou32(buf, 16, &value))
+		return (-EINVAL);
+
+	dev_info->expected_usercode = value;
+	dev_info->has_expected_usercode = 1;
+
+	return (count);
+}
 
-	mutex_unlock(&programming_lock);
+ssize_t dry_run_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	struct ecp5_dry_run *dry_run = &dev_info->dry_run;
+	ssize_t len;
 
-	if (dev_info->programming_result != 2)
-		pr_err("ECP5: FPGA programming failed with code %d\n",
-				dev_info->programming_result);
+	mutex_lock(&dev_info->lock);
+	if (!dry_run->spi_hz)
+		len = sprintf(buf, "none\n");
 	else
-		pr_info("ECP5: FPGA programming success\n");
+		len = sprintf(buf,
+				"result %d\n"
+				"spi_hz %u\n"
+				"tx_bits %llu\n"
+				"rx_bits %llu\n"
+				"wait_ms %llu\n"
+				"transactions %u\n"
+				"transfers %u\n"
+				"estimate_us %llu\n",
+				dry_run->result, dry_run->spi_hz,
+				dry_run->tx_bits, dry_run->rx_bits,
+				dry_run->wait_ms, dry_run->transactions,
+				dry_run->transfers, dry_run->estimate_us);
+	mutex_unlock(&dev_info->lock);
+
+	return (len);
+}
+
+/*
+ * Writing an SPI clock in Hz to "dry_run" runs the uploaded images
+ * without touching the FPGA and estimates the programming time at that
+ * clock, 0 means the clock of the device.  "dry_run" shows the outcome.
+ */
+static ssize_t dry_run_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	struct ecp5_dry_run dry_run;
+	u32 spi_hz;
+	int ret = 0;
+
+	if (kstrtou32(buf, 0, &spi_hz))
+		return (-EINVAL);
+	if (!spi_hz)
+		spi_hz = dev_info->spi->max_speed_hz;
+	if (!spi_hz)
+		return (-EINVAL);
+
+	mutex_lock(&dev_info->lock);
+
+	if (test_bit(ECP5_PROGRAMMING, &dev_info->flags))
+	{
+		ret = -EBUSY;
+		goto out;
+	}
+	if (!dev_info->algo_mem || dev_info->algo_size == 0)
+	{
+		ret = -ENODATA;
+		goto out;
+	}
+
+	/* nobody may be writing the images */
+	if (!mutex_trylock(&dev_info->algo_lock))
+	{
+		ret = -EBUSY;
+		goto out;
+	}
+	if (!mutex_trylock(&dev_info->data_lock))
+	{
+		mutex_unlock(&dev_info->algo_lock);
+		ret = -EBUSY;
+		goto out;
+	}
+
+	/*
+	 * Holding the image locks keeps the images and marks the dry run
+	 * busy, so lock is dropped before waiting for the engine.
+	 */
+	mutex_unlock(&dev_info->lock);
+
+	ecp5_dry_run_images(dev_info, dev_info->algo_mem, dev_info->algo_size,
+			dev_info->data_mem, dev_info->data_size,
+			spi_hz, &dry_run);
+
+	mutex_lock(&dev_info->lock);
+	dev_info->dry_run = dry_run;
+	mutex_unlock(&dev_info->lock);
+
+	mutex_unlock(&dev_info->data_lock);
+	mutex_unlock(&dev_info->algo_lock);
 
 	return (count);
+
+out:
+	mutex_unlock(&dev_info->lock);
+
+	return (ret);
+}
+
+ssize_t adaptive_wait_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	return (sprintf(buf, "%d\n", dev_info->adaptive_wait));
+}
+
+static ssize_t adaptive_wait_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	unsigned long value;
+
+	if (kstrtoul(buf, 0, &value))
+		return (-EINVAL);
+
+	dev_info->adaptive_wait = !!value;
+
+	return (count);
+}
+
+ssize_t bus_lock_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	return (sprintf(buf, "%d\n", dev_info->bus_lock));
+}
+
+/* taken by the next run, see lattice/hardware.c */
+static ssize_t bus_lock_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	unsigned long value;
+
+	if (kstrtoul(buf, 0, &value) || value > ECP5_BUS_LOCK_RUN)
+		return (-EINVAL);
+
+	dev_info->bus_lock = value;
+
+	return (count);
+}
+
+ssize_t bulk_words_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	return (sprintf(buf, "%d\n", dev_info->bulk_words));
+}
+
+/* 32 bit words can only be turned on if the controller took them at probe */
+static ssize_t bulk_words_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	unsigned long value;
+
+	if (kstrtoul(buf, 0, &value))
+		return (-EINVAL);
+
+	if (value && !dev_info->has_bulk_words)
+		return (-EOPNOTSUPP);
+
+	dev_info->bulk_words = !!value;
+
+	return (count);
+}
+
+ssize_t tx_cache_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	return (sprintf(buf, "%d\n", dev_info->txcache.enabled));
+}
+
+/*
+ * 1 enables the transaction cache, 0 disables it and drops the cached
+ * images
+ */
+static ssize_t tx_cache_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	unsigned long value;
+
+	if (kstrtoul(buf, 0, &value))
+		return (-EINVAL);
+
+	dev_info->txcache.enabled = !!value;
+	if (!value)
+		ecp5_txcache_free(dev_info);
+
+	return (count);
+}
+
+ssize_t spi_clock_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	return (sprintf(buf, "%u\n", dev_info->spi->max_speed_hz));
+}
+
+/*
+ * Writing a clock in Hz sets the SPI clock, "auto" sets the fastest one
+ * at which the FPGA reads back its IDCODE reliably
+ */
+static ssize_t spi_clock_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct ecp5 *dev_info = dev_get_drvdata(dev);
+	u32 spi_hz = 0;
+	int ret;
+
+	if (!sysfs_streq(buf, "auto") && (kstrtou32(buf, 0, &spi_hz) || !spi_hz))
+		return (-EINVAL);
+
+	ret = ecp5_spi_clock(dev_info, spi_hz);
+
+	return (ret < 0 ? ret : count);
 }
 
 struct device_attribute ecp5_algo_size_attr =
@@ -357,10 +1309,58 @@ __ATTR(data_size, 0666, data_size_show, data_size_store);
 struct device_attribute ecp5_program_attr =
 __ATTR(program, 0666, program_show, program_store);
 
+struct device_attribute ecp5_slots_attr =
+__ATTR(slots, 0444, slots_show, NULL);
+
+struct device_attribute ecp5_slot_save_attr =
+__ATTR(slot_save, 0200, NULL, slot_save_store);
+
+struct device_attribute ecp5_slot_delete_attr =
+__ATTR(slot_delete, 0200, NULL, slot_delete_store);
+
+struct device_attribute ecp5_program_slot_attr =
+__ATTR(program_slot, 0200, NULL, program_slot_store);
+
+struct device_attribute ecp5_ensure_attr =
+__ATTR(ensure, 0644, ensure_show, ensure_store);
+
+struct device_attribute ecp5_expected_usercode_attr =
+__ATTR(expected_usercode, 0644, expected_usercode_show, expected_usercode_store);
+
+struct device_attribute ecp5_adaptive_wait_attr =
+__ATTR(adaptive_wait, 0644, adaptive_wait_show, adaptive_wait_store);
+
+struct device_attribute ecp5_bus_lock_attr =
+__ATTR(bus_lock, 0644, bus_lock_show, bus_lock_store);
+
+struct device_attribute ecp5_spi_clock_attr =
+__ATTR(spi_clock, 0644, spi_clock_show, spi_clock_store);
+
+struct device_attribute ecp5_bulk_words_attr =
+__ATTR(bulk_words, 0644, bulk_words_show, bulk_words_store);
+
+struct device_attribute ecp5_tx_cache_attr =
+__ATTR(tx_cache, 0644, tx_cache_show, tx_cache_store);
+
+struct device_attribute ecp5_dry_run_attr =
+__ATTR(dry_run, 0644, dry_run_show, dry_run_store);
+
 struct attribute *ecp5_attrs[] = {
 	&ecp5_algo_size_attr.attr,
 	&ecp5_data_size_attr.attr,
 	&ecp5_program_attr.attr,
+	&ecp5_slots_attr.attr,
+	&ecp5_slot_save_attr.attr,
+	&ecp5_slot_delete_attr.attr,
+	&ecp5_program_slot_attr.attr,
+	&ecp5_ensure_attr.attr,
+	&ecp5_expected_usercode_attr.attr,
+	&ecp5_dry_run_attr.attr,
+	&ecp5_adaptive_wait_attr.attr,
+	&ecp5_bus_lock_attr.attr,
+	&ecp5_spi_clock_attr.attr,
+	&ecp5_bulk_words_attr.attr,
+	&ecp5_tx_cache_attr.attr,
 	NULL,
 };
 
@@ -374,6 +1374,7 @@ static int __devinit ecp5_probe(struct spi_device *spi)
 	struct ecp5 *ecp5_info = NULL;
 	unsigned char *algo_cdev_name = NULL;
 	unsigned char *data_cdev_name = NULL;
+	unsigned char *ctl_cdev_name = NULL;
 
 	pr_info("ECP5: device spi%d.%d probing\n", spi->master->bus_num, spi->chip_select);
 
@@ -384,85 +1385,180 @@ static int __devinit ecp5_probe(struct spi_device *spi)
 	if (ret < 0)
 		return (ret);
 
-	ecp5_info = devm_kzalloc(&spi->dev, sizeof(*ecp5_info), GFP_KERNEL);
+	ecp5_info = kzalloc(sizeof(*ecp5_info), GFP_KERNEL);
 	if (!ecp5_info)
 		return (-ENOMEM);
 
+	/* set up first what ecp5_free() tears down */
+	kref_init(&ecp5_info->ref);
+	mutex_init(&ecp5_info->lock);
+	mutex_init(&ecp5_info->algo_lock);
+	mutex_init(&ecp5_info->data_lock);
+	ecp5_turn_init(ecp5_info);
+	init_waitqueue_head(&ecp5_info->runs_done);
+	ecp5_txcache_init(ecp5_info);
+	INIT_WORK(&ecp5_info->program_work, ecp5_program_work);
+
 	spi_set_drvdata(spi, ecp5_info);
 	ecp5_info->spi = spi;
 	ecp5_info->programming_result = 0;
 
+	/*
+	 * Bulk data goes out as 32 bit words if the controller takes them,
+	 * commands stay 8 bit, the device default.
+	 */
+	spi->bits_per_word = 32;
+	ecp5_info->has_bulk_words = !spi_setup(spi);
+	ecp5_info->bulk_words = ecp5_info->has_bulk_words;
+	spi->bits_per_word = 8;
+	ret = spi_setup(spi);
+	if (ret < 0)
+		goto error_put;
+
+	snprintf(ecp5_info->program_wq_name, sizeof(ecp5_info->program_wq_name),
+			"ecp5-spi%d.%d", spi->master->bus_num, spi->chip_select);
+	/* ordered: one job at a time, in the order queued */
+	ecp5_info->program_wq = alloc_workqueue(ecp5_info->program_wq_name,
+			WQ_UNBOUND, 1);
+	if (!ecp5_info->program_wq)
+	{
+		ret = -ENOMEM;
+		goto error_put;
+	}
+
+	/* scratch memory of the runs, allocated once, see arena.c */
+	ret = ecp5_arena_init(&ecp5_info->arena);
+	if (ret < 0)
+		goto error_wq;
+
+	/* the configuration pins are held until remove, see pins.c */
+	ret = ecp5_pins_request(ecp5_info, spi->dev.platform_data);
+	if (ret < 0)
+		goto error_arena;
+
+	/* the names are freed by ecp5_free() */
+	ret = -ENOMEM;
 	ecp5_info->algo_char_device.minor = MISC_DYNAMIC_MINOR;
 	algo_cdev_name = kzalloc(64, GFP_KERNEL);
-	if (!algo_cdev_name) return (-ENOMEM);
+	if (!algo_cdev_name) goto error_pins;
 	sprintf(algo_cdev_name, "ecp5-spi%d.%d-algo", spi->master->bus_num, spi->chip_select);
 	ecp5_info->algo_char_device.name = algo_cdev_name;
 	ecp5_info->algo_char_device.fops = &algo_fops;
 	ret = misc_register(&ecp5_info->algo_char_device);
 	if (ret) {
 		pr_err("ECP5: can't register firmware algo image device\n");
-		goto error_return;
+		goto error_pins;
 	}
-	mutex_init(&ecp5_info->algo_lock);
 
+	ret = -ENOMEM;
 	ecp5_info->data_char_device.minor = MISC_DYNAMIC_MINOR;
 	data_cdev_name = kzalloc(64, GFP_KERNEL);
-	if (!data_cdev_name) return (-ENOMEM);
+	if (!data_cdev_name) goto error_algo;
 	sprintf(data_cdev_name, "ecp5-spi%d.%d-data", spi->master->bus_num, spi->chip_select);
 	ecp5_info->data_char_device.name = data_cdev_name;
 	ecp5_info->data_char_device.fops = &data_fops;
 	ret = misc_register(&ecp5_info->data_char_device);
 	if (ret) {
 		pr_err("ECP5: can't register firmware data image device\n");
-		goto error_return;
+		goto error_algo;
+	}
+
+	ret = -ENOMEM;
+	ecp5_info->ctl_char_device.minor = MISC_DYNAMIC_MINOR;
+	ctl_cdev_name = kzalloc(64, GFP_KERNEL);
+	if (!ctl_cdev_name) goto error_data;
+	sprintf(ctl_cdev_name, "ecp5-spi%d.%d", spi->master->bus_num, spi->chip_select);
+	ecp5_info->ctl_char_device.name = ctl_cdev_name;
+	ecp5_info->ctl_char_device.fops = &ctl_fops;
+	ret = misc_register(&ecp5_info->ctl_char_device);
+	if (ret) {
+		pr_err("ECP5: can't register control device\n");
+		goto error_data;
 	}
-	mutex_init(&ecp5_info->data_lock);
 
 	ret = sysfs_create_group(&spi->dev.kobj, &ecp5_attr_group);
 	if (ret)
 	{
 		pr_err("ECP5: failed to create attribute files\n");
-		goto error_return;
+		goto error_ctl;
 	}
 
+	ecp5_debugfs_init(ecp5_info);
+
 	pr_info("ECP5: device spi%d.%d probed\n", spi->master->bus_num, spi->chip_select);
 
 	return (0);
 
-error_return:
-	kzfree(algo_cdev_name);
-	kzfree(data_cdev_name);
-	return (-ENOMEM);
+	/* reverse order of the setup, files opened meanwhile keep a ref */
+error_ctl:
+	misc_deregister(&ecp5_info->ctl_char_device);
+	/* an ioctl may have started a run already, as in ecp5_remove() */
+	mutex_lock(&ecp5_info->lock);
+	set_bit(ECP5_REMOVED, &ecp5_info->flags);
+	mutex_unlock(&ecp5_info->lock);
+	wait_event(ecp5_info->runs_done, !ecp5_info->nr_runs);
+error_data:
+	misc_deregister(&ecp5_info->data_char_device);
+error_algo:
+	misc_deregister(&ecp5_info->algo_char_device);
+error_pins:
+	ecp5_pins_free(ecp5_info);
+error_arena:
+	ecp5_arena_free(&ecp5_info->arena);
+error_wq:
+	destroy_workqueue(ecp5_info->program_wq);
+error_put:
+	spi_set_drvdata(spi, NULL);
+	kref_put(&ecp5_info->ref, ecp5_free);
+	return (ret);
 }
 
 
 static int __devexit ecp5_remove(struct spi_device *spi)
 {
 	int err_code;
+	int canceled = 0;
+	struct ecp5_job job;
 	struct ecp5 *ecp5_info = spi_get_drvdata(spi);
 
 	pr_info("ECP5: device spi%d.%d removing\n", spi->master->bus_num, spi->chip_select);
 
+	/* no new jobs or ioctls: attributes first, then the devices */
+	sysfs_remove_group(&spi->dev.kobj, &ecp5_attr_group);
+	ecp5_debugfs_exit(ecp5_info);
+
 	err_code = misc_deregister(&ecp5_info->algo_char_device);
-	if(err_code) {
+	if(err_code)
 		pr_err("ECP5: can't unregister firmware image device\n");
-		return (err_code);
-	}
-	kzfree(ecp5_info->algo_char_device.name);
-	mutex_destroy(&ecp5_info->algo_lock);
 
 	err_code = misc_deregister(&ecp5_info->data_char_device);
-	if(err_code) {
+	if(err_code)
 		pr_err("ECP5: can't unregister firmware image device\n");
-		return (err_code);
-	}
-	kzfree(ecp5_info->data_char_device.name);
-	mutex_destroy(&ecp5_info->data_lock);
 
-	sysfs_remove_group(&spi->dev.kobj, &ecp5_attr_group);
-
-	kzfree(ecp5_info->algo_mem);
-	kzfree(ecp5_info->data_mem);
+	err_code = misc_deregister(&ecp5_info->ctl_char_device);
+	if(err_code)
+		pr_err("ECP5: can't unregister control device\n");
+
+	/* queued jobs are dropped, runs waiting for their turn cancel */
+	mutex_lock(&ecp5_info->lock);
+	set_bit(ECP5_REMOVED, &ecp5_info->flags);
+	while (ecp5_job_next(ecp5_info, &job))
+		++canceled;
+	mutex_unlock(&ecp5_info->lock);
+	while (canceled--)
+		ecp5_program_done(ecp5_info, -ECANCELED);
+
+	/* only the run already on the bus finishes */
+	flush_workqueue(ecp5_info->program_wq);
+	destroy_workqueue(ecp5_info->program_wq);
+	wait_event(ecp5_info->runs_done, !ecp5_info->nr_runs);
+
+	ecp5_arena_free(&ecp5_info->arena);
+	ecp5_pins_free(ecp5_info);
+
+	/* open files keep the rest, see ecp5_free() */
+	spi_set_drvdata(spi, NULL);
+	kref_put(&ecp5_info->ref, ecp5_free);
 
 	pr_info("ECP5: device spi%d.%d removed\n", spi->master->bus_num, spi->chip_select);
 	return (0);
@@ -0,0 +1,57 @@
+#include <linux/kernel.h>
+#include <linux/gpio.h>
+
+#include "ecp5.h"
+
+static const char * const ecp5_pin_names[ECP5_NR_PINS] = {
+	[ECP5_PIN_CFG0]		= "ecp5-cfg0",
+	[ECP5_PIN_CFG1]		= "ecp5-cfg1",
+	[ECP5_PIN_DONE]		= "ecp5-done",
+	[ECP5_PIN_INITN]	= "ecp5-initn",
+	[ECP5_PIN_PROGRAMN]	= "ecp5-programn",
+	[ECP5_PIN_CS]		= "ecp5-cs",
+};
+
+/*
+ * Request the configuration pins of the device for its lifetime, from
+ * the platform data the board file gives the SPI device.  Each FPGA has
+ * pins of its own, so there are no defaults.  The pins are not exported
+ * to sysfs, userspace must not drive them under a run.  Directions and
+ * levels are left to the runs, which set the SPI mux each time.
+ */
+int ecp5_pins_request(struct ecp5 *ecp5_info,
+		const struct ecp5_platform_data *pdata)
+{
+	int ret;
+	int i;
+
+	if (!pdata)
+	{
+		pr_err("ECP5: no platform data with the configuration GPIOs\n");
+		return (-EINVAL);
+	}
+
+	for (i = 0; i < ECP5_NR_PINS; ++i)
+	{
+		ecp5_info->pins[i] = pdata->gpios[i];
+		ret = gpio_request(ecp5_info->pins[i], ecp5_pin_names[i]);
+		if (ret < 0)
+		{
+			pr_err("ECP5: can't request GPIO %d (%s)\n",
+					ecp5_info->pins[i], ecp5_pin_names[i]);
+			while (--i >= 0)
+				gpio_free(ecp5_info->pins[i]);
+			return (ret);
+		}
+	}
+
+	return (0);
+}
+
+void ecp5_pins_free(struct ecp5 *ecp5_info)
+{
+	int i;
+
+	for (i = 0; i < ECP5_NR_PINS; ++i)
+		gpio_free(ecp5_info->pins[i]);
+}
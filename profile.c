@@ -0,0 +1,193 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+
+#include "ecp5.h"
+#include "lattice/opcode.h"
+
+static const char * const ecp5_opcode_names[256] = {
+	[STARTTRAN] = "STARTTRAN",
+	[CSTOGGLE] = "CSTOGGLE",
+	[TRANSOUT] = "TRANSOUT",
+	[TRANSIN] = "TRANSIN",
+	[RUNCLOCK] = "RUNCLOCK",
+	[ENDTRAN] = "ENDTRAN",
+	[MASK] = "MASK",
+	[ALGODATA] = "ALGODATA",
+	[PROGDATA] = "PROGDATA",
+	[RESETDATA] = "RESETDATA",
+	[PROGDATAEH] = "PROGDATAEH",
+	[WAIT] = "WAIT",
+	[REPEAT] = "REPEAT",
+	[ENDREPEAT] = "ENDREPEAT",
+	[LOOP] = "LOOP",
+	[ENDLOOP] = "ENDLOOP",
+	[ENDOFALGO] = "ENDOFALGO",
+	[HCOMMENT] = "HCOMMENT",
+};
+
+struct ecp5_profile *ecp5_profile_alloc(void)
+{
+	return (kzalloc(sizeof(struct ecp5_profile), GFP_KERNEL));
+}
+
+void ecp5_profile_free(struct ecp5_profile *profile)
+{
+	kfree(profile);
+}
+
+void ecp5_profile_start(struct ecp5 *ecp5_info)
+{
+	struct ecp5_profile *profile = ecp5_info->profile;
+
+	if (!profile)
+		return;
+
+	profile->active = 0;
+	if (!profile->enabled)
+		return;
+
+	memset(profile->ops, 0, sizeof(profile->ops));
+	memset(profile->sets, 0, sizeof(profile->sets));
+	profile->loop_iterations = 0;
+	profile->repeat_iterations = 0;
+	profile->finish = ktime_set(0, 0);
+	profile->start = ktime_get();
+	profile->active = 1;
+}
+
+void ecp5_profile_finish(struct ecp5 *ecp5_info)
+{
+	struct ecp5_profile *profile = ecp5_info->profile;
+
+	if (!profile || !profile->active)
+		return;
+
+	profile->finish = ktime_get();
+	profile->active = 0;
+}
+
+/* start time of an opcode, 0 while not profiling */
+u64 ecp5_profile_now(struct ecp5_profile *profile)
+{
+	if (!profile || !profile->active)
+		return (0);
+
+	return (ktime_to_ns(ktime_get()));
+}
+
+void ecp5_profile_op(struct ecp5_profile *profile, int level,
+		unsigned char opcode, u64 start)
+{
+	struct ecp5_profile_op *op;
+
+	if (!start)
+		return;
+
+	op = &profile->ops[level][opcode];
+	op->count++;
+	op->ns += ktime_to_ns(ktime_get()) - start;
+}
+
+void ecp5_profile_iterations(struct ecp5_profile *profile,
+		unsigned char opcode, unsigned int iterations)
+{
+	if (!profile || !profile->active)
+		return;
+
+	if (opcode == LOOP)
+		profile->loop_iterations += iterations;
+	else
+		profile->repeat_iterations += iterations;
+}
+
+void ecp5_profile_data(struct ecp5_profile *profile, unsigned char data_set,
+		int tx_bytes, int rx_bytes)
+{
+	struct ecp5_profile_set *set;
+
+	if (!profile || !profile->active)
+		return;
+
+	set = &profile->sets[data_set];
+	set->frames++;
+	set->tx_bytes += tx_bytes;
+	set->rx_bytes += rx_bytes;
+}
+
+static void ecp5_profile_show_ops(struct seq_file *s,
+		struct ecp5_profile *profile, int level, const char *name)
+{
+	int i;
+
+	seq_printf(s, "%s:\n", name);
+	for (i = 0; i < 256; i++)
+	{
+		struct ecp5_profile_op *op = &profile->ops[level][i];
+
+		if (!op->count)
+			continue;
+
+		if (ecp5_opcode_names[i])
+			seq_printf(s, "  %-12s", ecp5_opcode_names[i]);
+		else
+			seq_printf(s, "  0x%02x        ", i);
+		seq_printf(s, " %10u %12llu %10llu\n", op->count,
+				div_u64(op->ns, 1000),
+				div_u64(op->ns, (u64)op->count * 1000));
+	}
+}
+
+static int ecp5_profile_show(struct seq_file *s, void *unused)
+{
+	struct ecp5 *ecp5_info = s->private;
+	struct ecp5_profile *profile = ecp5_info->profile;
+	s64 elapsed_us = 0;
+	int i;
+
+	if (ktime_to_ns(profile->finish))
+		elapsed_us = ktime_us_delta(profile->finish, profile->start);
+	else if (ktime_to_ns(profile->start))
+		elapsed_us = ktime_us_delta(ktime_get(), profile->start);
+
+	seq_printf(s, "enabled:    %u\n", profile->enabled);
+	seq_printf(s, "running:    %d\n", profile->active);
+	seq_printf(s, "elapsed_us: %lld\n", elapsed_us);
+	seq_printf(s, "loop_iterations:   %llu\n", profile->loop_iterations);
+	seq_printf(s, "repeat_iterations: %llu\n", profile->repeat_iterations);
+
+	seq_printf(s, "\n  %-12s %10s %12s %10s\n",
+			"opcode", "count", "total_us", "avg_us");
+	ecp5_profile_show_ops(s, profile, ECP5_PROFILE_PROCESS, "process");
+	ecp5_profile_show_ops(s, profile, ECP5_PROFILE_TRANS, "trans");
+
+	seq_printf(s, "\n  %-12s %10s %12s %12s\n",
+			"data_set", "frames", "tx_bytes", "rx_bytes");
+	for (i = 0; i < 256; i++)
+	{
+		struct ecp5_profile_set *set = &profile->sets[i];
+
+		if (!set->frames)
+			continue;
+
+		seq_printf(s, "  0x%02x         %10u %12llu %12llu\n",
+				i, set->frames, set->tx_bytes, set->rx_bytes);
+	}
+
+	return (0);
+}
+
+static int ecp5_profile_open(struct inode *inode, struct file *fp)
+{
+	return (single_open(fp, ecp5_profile_show, inode->i_private));
+}
+
+const struct file_operations ecp5_profile_fops = {
+	.owner = THIS_MODULE,
+	.open = ecp5_profile_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
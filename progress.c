@@ -0,0 +1,173 @@
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+
+#include "ecp5.h"
+#include "ecp5_sspi.h"
+
+/* throughput is averaged over windows of this length */
+#define ECP5_RATE_WINDOW	(HZ / 10)
+
+void ecp5_progress_start(struct ecp5 *ecp5_info, int algo_size, int data_size)
+{
+	struct ecp5_progress *progress = &ecp5_info->progress;
+
+	atomic_long_set(&progress->tx_bytes, 0);
+	atomic_long_set(&progress->rx_bytes, 0);
+	atomic_long_set(&progress->verified_bytes, 0);
+	atomic_long_set(&progress->rate, 0);
+	atomic_set(&progress->data_set, 0);
+	atomic_set(&progress->skipped, 0);
+	atomic_set(&progress->cached, 0);
+	atomic_set(&progress->retries, 0);
+
+	progress->window_start = jiffies;
+	progress->window_bytes = 0;
+
+	/* an ETA is only meaningful when the images did not change */
+	if (progress->expected_algo_size != algo_size ||
+			progress->expected_data_size != data_size)
+		progress->expected_bytes = 0;
+	progress->algo_size = algo_size;
+	progress->data_size = data_size;
+
+	progress->start = ktime_get();
+	smp_wmb();
+	atomic_set(&progress->running, 1);
+}
+
+void ecp5_progress_finish(struct ecp5 *ecp5_info, int result)
+{
+	struct ecp5_progress *progress = &ecp5_info->progress;
+
+	progress->finish = ktime_get();
+	smp_wmb();
+	atomic_set(&progress->running, 0);
+
+	/* a repeated run moved the bytes of more than one */
+	if (result == ECP5_RESULT_OK && !atomic_read(&progress->retries))
+	{
+		progress->expected_bytes = atomic_long_read(&progress->tx_bytes) +
+				atomic_long_read(&progress->rx_bytes);
+		progress->expected_algo_size = progress->algo_size;
+		progress->expected_data_size = progress->data_size;
+	}
+}
+
+static void ecp5_progress_account(struct ecp5_progress *progress, int n_bytes)
+{
+	unsigned long now = jiffies;
+	unsigned long delta = now - progress->window_start;
+
+	progress->window_bytes += n_bytes;
+	if (delta < ECP5_RATE_WINDOW)
+		return;
+
+	atomic_long_set(&progress->rate,
+			progress->window_bytes * HZ / delta);
+	/* a reader that sees the new window_bytes sees the new start */
+	progress->window_start = now;
+	smp_wmb();
+	progress->window_bytes = 0;
+}
+
+/*
+ * Throughput of the last window.  Once the current window has run
+ * longer than that with no bytes to close it, through a WAIT or an
+ * erase, its own rate so far is shown instead, which decays to 0.
+ */
+static long ecp5_progress_rate(struct ecp5_progress *progress)
+{
+	long bytes = ACCESS_ONCE(progress->window_bytes);
+	unsigned long delta;
+
+	smp_rmb();
+	delta = jiffies - ACCESS_ONCE(progress->window_start);
+	if (delta < ECP5_RATE_WINDOW)
+		return (atomic_long_read(&progress->rate));
+
+	return (bytes * HZ / delta);
+}
+
+void ecp5_progress_tx(struct ecp5_progress *progress, int n_bytes)
+{
+	atomic_long_add(n_bytes, &progress->tx_bytes);
+	ecp5_progress_account(progress, n_bytes);
+}
+
+void ecp5_progress_rx(struct ecp5_progress *progress, int n_bytes)
+{
+	atomic_long_add(n_bytes, &progress->rx_bytes);
+	ecp5_progress_account(progress, n_bytes);
+}
+
+void ecp5_progress_verified(struct ecp5_progress *progress, int n_bytes)
+{
+	atomic_long_add(n_bytes, &progress->verified_bytes);
+}
+
+void ecp5_progress_data_set(struct ecp5_progress *progress, int data_set)
+{
+	atomic_set(&progress->data_set, data_set);
+}
+
+static int ecp5_progress_show(struct seq_file *s, void *unused)
+{
+	struct ecp5 *ecp5_info = s->private;
+	struct ecp5_progress *progress = &ecp5_info->progress;
+	int running = atomic_read(&progress->running);
+	long tx, rx, done, expected;
+	s64 elapsed_us;
+	long long eta_ms = -1;
+
+	smp_rmb();
+	tx = atomic_long_read(&progress->tx_bytes);
+	rx = atomic_long_read(&progress->rx_bytes);
+	done = tx + rx;
+	expected = progress->expected_bytes;
+
+	if (ktime_to_ns(progress->start) == 0)
+		elapsed_us = 0;
+	else if (running)
+		elapsed_us = ktime_us_delta(ktime_get(), progress->start);
+	else
+		elapsed_us = ktime_us_delta(progress->finish, progress->start);
+
+	if (!running)
+		eta_ms = 0;
+	else if (expected > done && done > 0 && elapsed_us > 0)
+		eta_ms = div64_s64((s64)(expected - done) * elapsed_us,
+				(s64)done * 1000);
+
+	seq_printf(s, "running:        %d\n", running);
+	seq_printf(s, "result:         %d\n", ecp5_info->programming_result);
+	seq_printf(s, "skipped:        %d\n", atomic_read(&progress->skipped));
+	seq_printf(s, "cached:         %d\n", atomic_read(&progress->cached));
+	seq_printf(s, "retries:        %d\n", atomic_read(&progress->retries));
+	seq_printf(s, "bytes_sent:     %ld\n", tx);
+	seq_printf(s, "bytes_received: %ld\n", rx);
+	seq_printf(s, "bytes_verified: %ld\n",
+			atomic_long_read(&progress->verified_bytes));
+	seq_printf(s, "data_set:       0x%02x\n", atomic_read(&progress->data_set));
+	seq_printf(s, "elapsed_ms:     %lld\n", div_s64(elapsed_us, 1000));
+	seq_printf(s, "throughput_Bps: %ld\n",
+			running ? ecp5_progress_rate(progress) : 0);
+	seq_printf(s, "expected_bytes: %ld\n", expected);
+	seq_printf(s, "eta_ms:         %lld\n", eta_ms);
+
+	return (0);
+}
+
+static int ecp5_progress_open(struct inode *inode, struct file *fp)
+{
+	return (single_open(fp, ecp5_progress_show, inode->i_private));
+}
+
+const struct file_operations ecp5_progress_fops = {
+	.owner = THIS_MODULE,
+	.open = ecp5_progress_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
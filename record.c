@@ -0,0 +1,226 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/errno.h>
+
+#include "ecp5.h"
+#include "ecp5_sspi.h"
+
+struct ecp5_record_snapshot
+{
+	size_t size;
+	unsigned char data[0];
+};
+
+struct ecp5_record *ecp5_record_alloc(void)
+{
+	struct ecp5_record *record;
+
+	record = kzalloc(sizeof(*record), GFP_KERNEL);
+	if (record)
+		mutex_init(&record->lock);
+	return (record);
+}
+
+void ecp5_record_free(struct ecp5_record *record)
+{
+	if (!record)
+		return;
+
+	vfree(record->buf);
+	mutex_destroy(&record->lock);
+	kfree(record);
+}
+
+void ecp5_record_start(struct ecp5 *ecp5_info)
+{
+	struct ecp5_record *record = ecp5_info->record;
+
+	if (!record)
+		return;
+
+	mutex_lock(&record->lock);
+	record->active = 0;
+	if (!record->enabled)
+	{
+		mutex_unlock(&record->lock);
+		return;
+	}
+
+	if (!record->buf)
+	{
+		record->buf = vmalloc(ECP5_RECORD_SIZE);
+		if (!record->buf)
+		{
+			mutex_unlock(&record->lock);
+			pr_err("ECP5: can't allocate the SPI record buffer\n");
+			return;
+		}
+	}
+
+	record->head = 0;
+	record->tail = 0;
+	record->used = 0;
+	record->records = 0;
+	record->dropped = 0;
+	record->start = ktime_get();
+	record->active = 1;
+	mutex_unlock(&record->lock);
+}
+
+void ecp5_record_finish(struct ecp5 *ecp5_info)
+{
+	struct ecp5_record *record = ecp5_info->record;
+
+	if (!record)
+		return;
+
+	mutex_lock(&record->lock);
+	record->active = 0;
+	mutex_unlock(&record->lock);
+}
+
+/* copy in or out of the ring at pos, wrapping at the end */
+static void ecp5_record_copy_in(struct ecp5_record *record, size_t pos,
+		const void *src, size_t len)
+{
+	size_t first = min_t(size_t, len, ECP5_RECORD_SIZE - pos);
+
+	memcpy(record->buf + pos, src, first);
+	memcpy(record->buf, (const unsigned char *)src + first, len - first);
+}
+
+static void ecp5_record_copy_out(struct ecp5_record *record, size_t pos,
+		void *dst, size_t len)
+{
+	size_t first = min_t(size_t, len, ECP5_RECORD_SIZE - pos);
+
+	memcpy(dst, record->buf + pos, first);
+	memcpy((unsigned char *)dst + first, record->buf, len - first);
+}
+
+static size_t ecp5_record_entry_size(const struct ecp5_record_entry *entry)
+{
+	size_t size = sizeof(*entry);
+
+	if (entry->type == ECP5_REC_TX || entry->type == ECP5_REC_RX)
+		size += entry->len;
+	return (size);
+}
+
+/*
+ * Append a record.  data is the payload of ECP5_REC_TX/ECP5_REC_RX and
+ * NULL for the other types, whose value is in len.  Only the run calls
+ * it, between ecp5_record_start() and ecp5_record_finish(), so the ring
+ * isn't locked here.
+ */
+void ecp5_record_add(struct ecp5_record *record, u32 type,
+		const void *data, u32 len)
+{
+	struct ecp5_record_entry entry;
+	size_t size;
+
+	if (!record || !record->active)
+		return;
+
+	entry.ns = ktime_to_ns(ktime_sub(ktime_get(), record->start));
+	entry.type = type;
+	entry.len = len;
+	size = ecp5_record_entry_size(&entry);
+
+	if (size > ECP5_RECORD_SIZE)
+	{
+		record->dropped++;
+		return;
+	}
+
+	/* make room by dropping the oldest records */
+	while (ECP5_RECORD_SIZE - record->used < size)
+	{
+		struct ecp5_record_entry old;
+		size_t old_size;
+
+		ecp5_record_copy_out(record, record->tail, &old, sizeof(old));
+		old_size = ecp5_record_entry_size(&old);
+		record->tail = (record->tail + old_size) % ECP5_RECORD_SIZE;
+		record->used -= old_size;
+		record->records--;
+		record->dropped++;
+	}
+
+	ecp5_record_copy_in(record, record->head, &entry, sizeof(entry));
+	if (data)
+		ecp5_record_copy_in(record,
+				(record->head + sizeof(entry)) % ECP5_RECORD_SIZE,
+				data, len);
+	record->head = (record->head + size) % ECP5_RECORD_SIZE;
+	record->used += size;
+	record->records++;
+}
+
+/*
+ * The debugfs "record" file reads a snapshot of the ring taken at open,
+ * so it is refused while a run is being recorded.  A run starting
+ * meanwhile waits in ecp5_record_start() until the copy is done.
+ */
+static int ecp5_record_open(struct inode *inode, struct file *fp)
+{
+	struct ecp5 *ecp5_info = inode->i_private;
+	struct ecp5_record *record = ecp5_info->record;
+	struct ecp5_record_snapshot *snapshot;
+	struct ecp5_record_header header;
+
+	mutex_lock(&record->lock);
+	if (record->active)
+	{
+		mutex_unlock(&record->lock);
+		return (-EBUSY);
+	}
+
+	snapshot = vmalloc(sizeof(*snapshot) + sizeof(header) + record->used);
+	if (!snapshot)
+	{
+		mutex_unlock(&record->lock);
+		return (-ENOMEM);
+	}
+
+	header.magic = ECP5_RECORD_MAGIC;
+	header.version = ECP5_RECORD_VERSION;
+	header.records = record->records;
+	header.dropped = record->dropped;
+
+	snapshot->size = sizeof(header) + record->used;
+	memcpy(snapshot->data, &header, sizeof(header));
+	if (record->used)
+		ecp5_record_copy_out(record, record->tail,
+				snapshot->data + sizeof(header), record->used);
+	mutex_unlock(&record->lock);
+
+	fp->private_data = snapshot;
+	return (0);
+}
+
+static ssize_t ecp5_record_read(struct file *fp, char __user *ubuf,
+		size_t len, loff_t *off)
+{
+	struct ecp5_record_snapshot *snapshot = fp->private_data;
+
+	return (simple_read_from_buffer(ubuf, len, off,
+				snapshot->data, snapshot->size));
+}
+
+static int ecp5_record_release(struct inode *inode, struct file *fp)
+{
+	vfree(fp->private_data);
+	return (0);
+}
+
+const struct file_operations ecp5_record_fops = {
+	.owner = THIS_MODULE,
+	.open = ecp5_record_open,
+	.read = ecp5_record_read,
+	.llseek = default_llseek,
+	.release = ecp5_record_release,
+};
@@ -0,0 +1,130 @@
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/completion.h>
+#include <linux/errno.h>
+
+#include "ecp5.h"
+
+/*
+ * The lattice engine keeps its state in globals, so it runs for one
+ * device at a time, whatever bus the device is on: runs on different
+ * SPI buses do not program in parallel.  The engine is a plain lock.
+ */
+static DEFINE_MUTEX(ecp5_engine_lock);
+
+void ecp5_engine_get(void)
+{
+	mutex_lock(&ecp5_engine_lock);
+}
+
+void ecp5_engine_put(void)
+{
+	mutex_unlock(&ecp5_engine_lock);
+}
+
+/*
+ * The runs of one device, its queued jobs and ioctls, take turns by
+ * priority before they wait for the engine, in arrival order within
+ * one, so a recovery run goes before the bulk runs of the device.
+ */
+struct ecp5_turn_waiter
+{
+	struct list_head node;
+	int prio;
+	struct completion granted;
+};
+
+void ecp5_turn_init(struct ecp5 *ecp5_info)
+{
+	spin_lock_init(&ecp5_info->turn_lock);
+	INIT_LIST_HEAD(&ecp5_info->turn_waiters);
+	ecp5_info->turn_busy = 0;
+}
+
+void ecp5_turn_get(struct ecp5 *ecp5_info, int prio)
+{
+	struct ecp5_turn_waiter waiter;
+	struct ecp5_turn_waiter *pos;
+
+	spin_lock(&ecp5_info->turn_lock);
+	if (!ecp5_info->turn_busy)
+	{
+		ecp5_info->turn_busy = 1;
+		spin_unlock(&ecp5_info->turn_lock);
+		return;
+	}
+
+	waiter.prio = prio;
+	init_completion(&waiter.granted);
+	list_for_each_entry(pos, &ecp5_info->turn_waiters, node)
+		if (pos->prio < prio)
+			break;
+	/* before pos, or last if the walk ended at the head */
+	list_add_tail(&waiter.node, &pos->node);
+	spin_unlock(&ecp5_info->turn_lock);
+
+	wait_for_completion(&waiter.granted);
+}
+
+void ecp5_turn_put(struct ecp5 *ecp5_info)
+{
+	struct ecp5_turn_waiter *next;
+
+	spin_lock(&ecp5_info->turn_lock);
+	if (list_empty(&ecp5_info->turn_waiters))
+	{
+		ecp5_info->turn_busy = 0;
+		spin_unlock(&ecp5_info->turn_lock);
+		return;
+	}
+
+	/* the turn stays taken, it is handed over */
+	next = list_first_entry(&ecp5_info->turn_waiters,
+			struct ecp5_turn_waiter, node);
+	list_del(&next->node);
+	complete(&next->granted);
+	spin_unlock(&ecp5_info->turn_lock);
+}
+
+/*
+ * Queue a programming job on the device, called with ecp5->lock held.
+ * Jobs run in priority order, in the order queued within one.
+ */
+int ecp5_job_queue(struct ecp5 *ecp5_info, int slot, int prio)
+{
+	int i;
+
+	if (ecp5_info->nr_jobs == ECP5_JOBS_MAX)
+		return (-EBUSY);
+
+	for (i = ecp5_info->nr_jobs;
+			i > 0 && ecp5_info->jobs[i - 1].prio < prio; --i)
+		ecp5_info->jobs[i] = ecp5_info->jobs[i - 1];
+
+	ecp5_info->jobs[i].slot = slot;
+	ecp5_info->jobs[i].prio = prio;
+	ecp5_info->nr_jobs++;
+
+	return (0);
+}
+
+/*
+ * Take the next job of the device into job, called with ecp5->lock
+ * held.  Returns 0 if there is none.
+ */
+int ecp5_job_next(struct ecp5 *ecp5_info, struct ecp5_job *job)
+{
+	int i;
+
+	if (!ecp5_info->nr_jobs)
+		return (0);
+
+	*job = ecp5_info->jobs[0];
+	ecp5_info->nr_jobs--;
+	for (i = 0; i < ecp5_info->nr_jobs; ++i)
+		ecp5_info->jobs[i] = ecp5_info->jobs[i + 1];
+
+	return (1);
+}
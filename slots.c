@@ -0,0 +1,155 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+
+#include "ecp5.h"
+
+/*
+ * Copy a slot name written to sysfs, dropping the trailing newline.
+ */
+int ecp5_slot_parse_name(char *name, const char *buf, size_t count)
+{
+	while (count > 0 && isspace(buf[count - 1]))
+		--count;
+
+	if (count == 0 || count >= ECP5_SLOT_NAME_LEN)
+		return (-EINVAL);
+
+	memcpy(name, buf, count);
+	name[count] = '\0';
+
+	return (0);
+}
+
+struct ecp5_slot *ecp5_slot_find(struct ecp5 *ecp5_info, const char *name)
+{
+	int i;
+
+	for (i = 0; i < ECP5_NR_SLOTS; ++i)
+	{
+		struct ecp5_slot *slot = &ecp5_info->slots[i];
+
+		if (slot->name[0] && !strcmp(slot->name, name))
+			return (slot);
+	}
+
+	return (NULL);
+}
+
+static void ecp5_slot_release(struct ecp5_slot *slot)
+{
+	kzfree(slot->algo_mem);
+	kzfree(slot->data_mem);
+	memset(slot, 0, sizeof(*slot));
+}
+
+/*
+ * Validate the images uploaded through the algo/data devices and move
+ * them into the slot called name, replacing a slot of the same name.
+ * The upload buffers are handed over, not copied, so the algo/data
+ * devices are empty afterwards.
+ */
+int ecp5_slot_save(struct ecp5 *ecp5_info, const char *name)
+{
+	struct ecp5_slot *slot;
+	int ret;
+	int i;
+
+	if (test_bit(ECP5_PROGRAMMING, &ecp5_info->flags))
+		return (-EBUSY);
+
+	if (!ecp5_info->algo_mem || ecp5_info->algo_size == 0)
+		return (-ENODATA);
+
+	/* nobody may be writing the images we take over */
+	if (!mutex_trylock(&ecp5_info->algo_lock))
+		return (-EBUSY);
+	if (!mutex_trylock(&ecp5_info->data_lock))
+	{
+		mutex_unlock(&ecp5_info->algo_lock);
+		return (-EBUSY);
+	}
+
+	ret = ecp5_validate_images(ecp5_info->algo_mem, ecp5_info->algo_size,
+			ecp5_info->data_mem, ecp5_info->data_size);
+	if (ret != 1)
+	{
+		pr_err("ECP5: image validation failed with code %d\n", ret);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	slot = ecp5_slot_find(ecp5_info, name);
+	for (i = 0; !slot && i < ECP5_NR_SLOTS; ++i)
+		if (!ecp5_info->slots[i].name[0])
+			slot = &ecp5_info->slots[i];
+	if (!slot)
+	{
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	ecp5_slot_release(slot);
+	strlcpy(slot->name, name, sizeof(slot->name));
+	slot->algo_mem = ecp5_info->algo_mem;
+	slot->algo_size = ecp5_info->algo_size;
+	slot->data_mem = ecp5_info->data_mem;
+	slot->data_size = ecp5_info->data_size;
+
+	ecp5_info->algo_mem = NULL;
+	ecp5_info->algo_size = 0;
+	ecp5_info->data_mem = NULL;
+	ecp5_info->data_size = 0;
+	ret = 0;
+
+	pr_info("ECP5: image slot \"%s\" saved\n", name);
+
+out:
+	mutex_unlock(&ecp5_info->data_lock);
+	mutex_unlock(&ecp5_info->algo_lock);
+	return (ret);
+}
+
+int ecp5_slot_delete(struct ecp5 *ecp5_info, const char *name)
+{
+	struct ecp5_slot *slot;
+
+	if (test_bit(ECP5_PROGRAMMING, &ecp5_info->flags))
+		return (-EBUSY);
+
+	slot = ecp5_slot_find(ecp5_info, name);
+	if (!slot)
+		return (-ENOENT);
+
+	ecp5_slot_release(slot);
+
+	return (0);
+}
+
+ssize_t ecp5_slots_show(struct ecp5 *ecp5_info, char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < ECP5_NR_SLOTS; ++i)
+	{
+		struct ecp5_slot *slot = &ecp5_info->slots[i];
+
+		if (!slot->name[0])
+			continue;
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %d %d\n",
+				slot->name, slot->algo_size, slot->data_size);
+	}
+
+	return (len);
+}
+
+void ecp5_slots_free(struct ecp5 *ecp5_info)
+{
+	int i;
+
+	for (i = 0; i < ECP5_NR_SLOTS; ++i)
+		ecp5_slot_release(&ecp5_info->slots[i]);
+}
@@ -0,0 +1,5 @@
+/*
+ * Tracepoint definitions, see trace.h
+ */
+#define CREATE_TRACE_POINTS
+#include "trace.h"
@@ -0,0 +1,248 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ecp5_sspi
+
+#if !defined(_ECP5_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _ECP5_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/*
+ * Tracepoints of a programming run, under events/ecp5_sspi/ in ftrace
+ * and perf.  Disabled events cost a not taken branch.
+ *
+ * SPI transfers are traced as ecp5_trans_start/ecp5_trans_end pairs,
+ * the duration of a transfer is the time between the two.
+ */
+
+#define ECP5_TRACE_TX	0
+#define ECP5_TRACE_RX	1
+
+/* SPI_init reset sequence */
+#define ECP5_TRACE_PROGRAMN_LOW		0
+#define ECP5_TRACE_INITN_LOW		1
+#define ECP5_TRACE_PROGRAMN_HIGH	2
+#define ECP5_TRACE_INITN_HIGH		3
+#define ECP5_TRACE_READY		4
+
+#define show_ecp5_dir(dir)					\
+	__print_symbolic(dir,					\
+		{ ECP5_TRACE_TX,	"tx" },			\
+		{ ECP5_TRACE_RX,	"rx" })
+
+#define show_ecp5_init_phase(phase)				\
+	__print_symbolic(phase,					\
+		{ ECP5_TRACE_PROGRAMN_LOW,	"programn_low" },	\
+		{ ECP5_TRACE_INITN_LOW,		"initn_low" },	\
+		{ ECP5_TRACE_PROGRAMN_HIGH,	"programn_high" },	\
+		{ ECP5_TRACE_INITN_HIGH,	"initn_high" },	\
+		{ ECP5_TRACE_READY,		"ready" })
+
+TRACE_EVENT(ecp5_program_start,
+
+	TP_PROTO(const char *dev, int algo_size, int data_size),
+
+	TP_ARGS(dev, algo_size, data_size),
+
+	TP_STRUCT__entry(
+		__string(dev, dev)
+		__field(int, algo_size)
+		__field(int, data_size)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev);
+		__entry->algo_size = algo_size;
+		__entry->data_size = data_size;
+	),
+
+	TP_printk("%s algo_size=%d data_size=%d",
+		__get_str(dev), __entry->algo_size, __entry->data_size)
+);
+
+TRACE_EVENT(ecp5_program_end,
+
+	TP_PROTO(const char *dev, int result, int skipped),
+
+	TP_ARGS(dev, result, skipped),
+
+	TP_STRUCT__entry(
+		__string(dev, dev)
+		__field(int, result)
+		__field(int, skipped)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev);
+		__entry->result = result;
+		__entry->skipped = skipped;
+	),
+
+	TP_printk("%s result=%d skipped=%d",
+		__get_str(dev), __entry->result, __entry->skipped)
+);
+
+TRACE_EVENT(ecp5_init_phase,
+
+	TP_PROTO(int phase, int retries),
+
+	TP_ARGS(phase, retries),
+
+	TP_STRUCT__entry(
+		__field(int, phase)
+		__field(int, retries)
+	),
+
+	TP_fast_assign(
+		__entry->phase = phase;
+		__entry->retries = retries;
+	),
+
+	TP_printk("%s retries=%d",
+		show_ecp5_init_phase(__entry->phase), __entry->retries)
+);
+
+DECLARE_EVENT_CLASS(ecp5_trans,
+
+	TP_PROTO(int dir, int bits, int result),
+
+	TP_ARGS(dir, bits, result),
+
+	TP_STRUCT__entry(
+		__field(int, dir)
+		__field(int, bits)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->dir = dir;
+		__entry->bits = bits;
+		__entry->result = result;
+	),
+
+	TP_printk("%s bits=%d result=%d",
+		show_ecp5_dir(__entry->dir), __entry->bits, __entry->result)
+);
+
+DEFINE_EVENT(ecp5_trans, ecp5_trans_start,
+
+	TP_PROTO(int dir, int bits, int result),
+
+	TP_ARGS(dir, bits, result)
+);
+
+DEFINE_EVENT(ecp5_trans, ecp5_trans_end,
+
+	TP_PROTO(int dir, int bits, int result),
+
+	TP_ARGS(dir, bits, result)
+);
+
+TRACE_EVENT(ecp5_cs,
+
+	TP_PROTO(int active),
+
+	TP_ARGS(active),
+
+	TP_STRUCT__entry(
+		__field(int, active)
+	),
+
+	TP_fast_assign(
+		__entry->active = active;
+	),
+
+	TP_printk("%s", __entry->active ? "select" : "deselect")
+);
+
+TRACE_EVENT(ecp5_wait,
+
+	TP_PROTO(int ms),
+
+	TP_ARGS(ms),
+
+	TP_STRUCT__entry(
+		__field(int, ms)
+	),
+
+	TP_fast_assign(
+		__entry->ms = ms;
+	),
+
+	TP_printk("ms=%d", __entry->ms)
+);
+
+TRACE_EVENT(ecp5_wait_poll,
+
+	TP_PROTO(int ms, unsigned long waited_us, int polls),
+
+	TP_ARGS(ms, waited_us, polls),
+
+	TP_STRUCT__entry(
+		__field(int, ms)
+		__field(unsigned long, waited_us)
+		__field(int, polls)
+	),
+
+	TP_fast_assign(
+		__entry->ms = ms;
+		__entry->waited_us = waited_us;
+		__entry->polls = polls;
+	),
+
+	TP_printk("ms=%d waited_us=%lu polls=%d",
+		__entry->ms, __entry->waited_us, __entry->polls)
+);
+
+TRACE_EVENT(ecp5_loop,
+
+	TP_PROTO(unsigned char opcode, unsigned int iterations),
+
+	TP_ARGS(opcode, iterations),
+
+	TP_STRUCT__entry(
+		__field(unsigned char, opcode)
+		__field(unsigned int, iterations)
+	),
+
+	TP_fast_assign(
+		__entry->opcode = opcode;
+		__entry->iterations = iterations;
+	),
+
+	TP_printk("opcode=0x%02x iterations=%u",
+		__entry->opcode, __entry->iterations)
+);
+
+TRACE_EVENT(ecp5_data_set,
+
+	TP_PROTO(unsigned char id, unsigned int address, int rewound,
+		unsigned int skipped),
+
+	TP_ARGS(id, address, rewound, skipped),
+
+	TP_STRUCT__entry(
+		__field(unsigned char, id)
+		__field(unsigned int, address)
+		__field(int, rewound)
+		__field(unsigned int, skipped)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->address = address;
+		__entry->rewound = rewound;
+		__entry->skipped = skipped;
+	),
+
+	TP_printk("id=0x%02x address=%u rewound=%d skipped=%u",
+		__entry->id, __entry->address, __entry->rewound,
+		__entry->skipped)
+);
+
+#endif /* _ECP5_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
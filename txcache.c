@@ -0,0 +1,659 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/crc32.h>
+#include <linux/seq_file.h>
+
+#include "ecp5.h"
+#include "ecp5_sspi.h"
+#include "lattice/hardware.h"
+#include "lattice/debug.h"
+
+/*
+ * A rendering is a list of ops packed into chunks.  An op never spans
+ * two chunks, so TX payloads can be handed to the SPI controller as they
+ * are; long TX ops are split at chunk ends and the pieces are sent as
+ * one message again.
+ */
+struct ecp5_txcache_op
+{
+	u8 type;
+	u8 flags;
+	u16 reserved;
+	u32 len;		/* payload bytes, RX: expected and mask each */
+	s32 arg;		/* CS level, WAIT ms, LOOP passes, RX error */
+};
+
+#define ECP5_TXCACHE_DATA	(ECP5_TXCACHE_CHUNK - \
+		sizeof(struct ecp5_txcache_chunk))
+
+/* a TX op is started in a new chunk if less room than this is left */
+#define ECP5_TXCACHE_MIN_TX	256
+
+/* TX ops sent in one spi_message */
+#define ECP5_TXCACHE_BATCH	16
+
+static inline unsigned char *ecp5_txcache_payload(struct ecp5_txcache_op *op)
+{
+	return ((unsigned char *)(op + 1));
+}
+
+static inline size_t ecp5_txcache_op_size(u32 len)
+{
+	return ((sizeof(struct ecp5_txcache_op) + len + 3) & ~(size_t)3);
+}
+
+static void ecp5_txcache_free_chunks(struct ecp5_txcache_chunk *chunk)
+{
+	while (chunk)
+	{
+		struct ecp5_txcache_chunk *next = chunk->next;
+
+		kfree(chunk);
+		chunk = next;
+	}
+}
+
+static void ecp5_txcache_drop(struct ecp5_txcache_entry *entry)
+{
+	ecp5_txcache_free_chunks(entry->chunks);
+	kfree(entry->algo);
+	kfree(entry->data);
+	memset(entry, 0, sizeof(*entry));
+}
+
+void ecp5_txcache_init(struct ecp5 *ecp5_info)
+{
+	mutex_init(&ecp5_info->txcache.lock);
+}
+
+/* drop all cached images */
+void ecp5_txcache_free(struct ecp5 *ecp5_info)
+{
+	struct ecp5_txcache *cache = &ecp5_info->txcache;
+	int i;
+
+	mutex_lock(&cache->lock);
+	for (i = 0; i < ECP5_TXCACHE_ENTRIES; i++)
+		ecp5_txcache_drop(&cache->entries[i]);
+	mutex_unlock(&cache->lock);
+}
+
+/*
+ * Rendering
+ */
+static struct ecp5_txcache_chunk *ecp5_txcache_new_chunk(
+		struct ecp5_txcache *cache)
+{
+	struct ecp5_txcache_chunk *chunk;
+
+	if (cache->render.size + ECP5_TXCACHE_CHUNK > ECP5_TXCACHE_MAX)
+	{
+		cache->overflow = 1;
+		return (NULL);
+	}
+
+	chunk = kmalloc(ECP5_TXCACHE_CHUNK, GFP_KERNEL);
+	if (!chunk)
+	{
+		cache->overflow = 1;
+		return (NULL);
+	}
+	chunk->next = NULL;
+	chunk->used = 0;
+
+	if (cache->tail)
+		cache->tail->next = chunk;
+	else
+		cache->render.chunks = chunk;
+	cache->tail = chunk;
+	cache->last = NULL;
+	cache->render.size += ECP5_TXCACHE_CHUNK;
+
+	return (chunk);
+}
+
+static struct ecp5_txcache_op *ecp5_txcache_append(struct ecp5_txcache *cache,
+		u8 type, u32 len, s32 arg)
+{
+	struct ecp5_txcache_chunk *chunk = cache->tail;
+	size_t size = ecp5_txcache_op_size(len);
+	struct ecp5_txcache_op *op;
+
+	if (cache->overflow)
+		return (NULL);
+	if (size > ECP5_TXCACHE_DATA)
+	{
+		cache->overflow = 1;
+		return (NULL);
+	}
+
+	if (!chunk || ECP5_TXCACHE_DATA - chunk->used < size)
+	{
+		chunk = ecp5_txcache_new_chunk(cache);
+		if (!chunk)
+			return (NULL);
+	}
+
+	op = (struct ecp5_txcache_op *)(chunk->data + chunk->used);
+	chunk->used += size;
+	op->type = type;
+	op->flags = 0;
+	op->reserved = 0;
+	op->len = len;
+	op->arg = arg;
+	cache->last = op;
+
+	return (op);
+}
+
+/* TX bytes go to the previous op if it is a TX, so a frame is one op */
+static void ecp5_txcache_add_tx(struct ecp5_txcache *cache,
+		const unsigned char *data, u32 len)
+{
+	while (len && !cache->overflow)
+	{
+		struct ecp5_txcache_op *op = cache->last;
+		size_t start, room = 0;
+		u32 n;
+
+		if (op && op->type == ECP5_TXOP_TX)
+		{
+			start = (unsigned char *)op - cache->tail->data;
+			room = ECP5_TXCACHE_DATA - start - sizeof(*op) - op->len;
+		}
+
+		if (!room)
+		{
+			if (!cache->tail || ECP5_TXCACHE_DATA - cache->tail->used <
+					sizeof(*op) + ECP5_TXCACHE_MIN_TX)
+				ecp5_txcache_new_chunk(cache);
+			ecp5_txcache_append(cache, ECP5_TXOP_TX, 0, 0);
+			continue;
+		}
+
+		n = min_t(size_t, len, room);
+		memcpy(ecp5_txcache_payload(op) + op->len, data, n);
+		op->len += n;
+		if (op->len > cache->render.max_op)
+			cache->render.max_op = op->len;
+		cache->tail->used = start + ecp5_txcache_op_size(op->len);
+		data += n;
+		len -= n;
+	}
+}
+
+/*
+ * Append an op to the rendering of the running job.  data is the TX
+ * payload; RX ops get len bytes that match anything until
+ * ecp5_txcache_expect() says otherwise.
+ */
+void ecp5_txcache_add(struct ecp5_txcache *cache, u8 type,
+		const void *data, u32 len, s32 arg)
+{
+	struct ecp5_txcache_op *op;
+
+	if (!cache->rendering)
+		return;
+
+	switch (type)
+	{
+	case ECP5_TXOP_TX:
+		ecp5_txcache_add_tx(cache, data, len);
+		break;
+	case ECP5_TXOP_RX:
+		op = ecp5_txcache_append(cache, type, 2 * len, arg);
+		if (op)
+		{
+			memset(ecp5_txcache_payload(op), 0, 2 * len);
+			op->len = len;
+			if (len > cache->render.max_op)
+				cache->render.max_op = len;
+		}
+		break;
+	default:
+		ecp5_txcache_append(cache, type, 0, arg);
+		break;
+	}
+}
+
+/*
+ * Byte index of the last read compares as (byte & mask) == expected.
+ * A mismatch fails the run with error, at the end of the transaction if
+ * error is ERROR_VERIFICATION, at once otherwise; 0 ignores it, as the
+ * engine does for a data set that is not an ID or a code.
+ */
+void ecp5_txcache_expect(struct ecp5_txcache *cache, int index,
+		unsigned char expected, unsigned char mask, int error, int verify)
+{
+	struct ecp5_txcache_op *op = cache->last;
+
+	if (!cache->rendering || !op || op->type != ECP5_TXOP_RX ||
+			index >= op->len)
+		return;
+
+	ecp5_txcache_payload(op)[index] = expected;
+	ecp5_txcache_payload(op)[op->len + index] = mask;
+	op->arg = error;
+	if (verify)
+		op->flags |= ECP5_TXOP_VERIFY;
+}
+
+/* cut the rendering back to mark, a LOOP only keeps its last pass */
+static void ecp5_txcache_rewind(struct ecp5_txcache *cache,
+		struct ecp5_txcache_mark *mark)
+{
+	struct ecp5_txcache_chunk *chunk = mark->chunk->next;
+
+	while (chunk)
+	{
+		struct ecp5_txcache_chunk *next = chunk->next;
+
+		kfree(chunk);
+		cache->render.size -= ECP5_TXCACHE_CHUNK;
+		chunk = next;
+	}
+	mark->chunk->next = NULL;
+	mark->chunk->used = mark->used;
+	cache->tail = mark->chunk;
+	cache->last = NULL;
+}
+
+/* event is CACHE_LOOP_BEGIN, CACHE_LOOP_PASS or CACHE_LOOP_END */
+void ecp5_txcache_loop(struct ecp5_txcache *cache, int event,
+		unsigned int count)
+{
+	if (!cache->rendering || cache->overflow)
+		return;
+
+	switch (event)
+	{
+	case CACHE_LOOP_BEGIN:
+		if (cache->depth == ECP5_TXCACHE_DEPTH ||
+				!ecp5_txcache_append(cache, ECP5_TXOP_LOOP, 0, count))
+		{
+			cache->overflow = 1;
+			return;
+		}
+		cache->loops[cache->depth].chunk = cache->tail;
+		cache->loops[cache->depth].used = cache->tail->used;
+		cache->depth++;
+		break;
+	case CACHE_LOOP_PASS:
+		ecp5_txcache_rewind(cache, &cache->loops[cache->depth - 1]);
+		break;
+	case CACHE_LOOP_END:
+		cache->depth--;
+		ecp5_txcache_append(cache, ECP5_TXOP_ENDLOOP, 0, 0);
+		break;
+	}
+}
+
+/*
+ * Replay
+ */
+struct ecp5_txcache_cursor
+{
+	struct ecp5_txcache_chunk *chunk;
+	size_t pos;
+};
+
+static struct ecp5_txcache_op *ecp5_txcache_peek(
+		struct ecp5_txcache_cursor *cursor)
+{
+	while (cursor->chunk && cursor->pos >= cursor->chunk->used)
+	{
+		cursor->chunk = cursor->chunk->next;
+		cursor->pos = 0;
+	}
+	if (!cursor->chunk)
+		return (NULL);
+
+	return ((struct ecp5_txcache_op *)(cursor->chunk->data + cursor->pos));
+}
+
+static struct ecp5_txcache_op *ecp5_txcache_next(
+		struct ecp5_txcache_cursor *cursor)
+{
+	struct ecp5_txcache_op *op = ecp5_txcache_peek(cursor);
+
+	if (op)
+		cursor->pos += ecp5_txcache_op_size(op->type == ECP5_TXOP_RX ?
+				2 * op->len : op->len);
+	return (op);
+}
+
+/* send op and the TX ops right after it as one message */
+static int ecp5_txcache_replay_tx(struct ecp5_txcache_cursor *cursor,
+		struct ecp5_txcache_op *op)
+{
+	unsigned char *buffers[ECP5_TXCACHE_BATCH];
+	int counts[ECP5_TXCACHE_BATCH];
+	int n = 0;
+
+	for (;;)
+	{
+		buffers[n] = ecp5_txcache_payload(op);
+		counts[n] = op->len;
+		n++;
+
+		op = ecp5_txcache_peek(cursor);
+		if (!op || op->type != ECP5_TXOP_TX || n == ECP5_TXCACHE_BATCH)
+			break;
+		ecp5_txcache_next(cursor);
+	}
+
+	/* a lone command goes out with the read after it */
+	if (n == 1 && op && op->type == ECP5_TXOP_RX)
+		return (TRANS_transmitBytes(buffers[0], counts[0] * 8));
+
+	return (TRANS_transmitList(buffers, counts, n));
+}
+
+static int ecp5_txcache_replay_rx(struct ecp5 *ecp5_info,
+		struct ecp5_txcache_op *op, unsigned char *rx)
+{
+	unsigned char *expected = ecp5_txcache_payload(op);
+	unsigned char *mask = expected + op->len;
+	int i;
+
+	if (!TRANS_receiveBytes(rx, op->len * 8))
+		return (ERROR_PROC_HARDWARE);
+
+	if (op->flags & ECP5_TXOP_VERIFY)
+		ecp5_progress_verified(&ecp5_info->progress, op->len);
+
+	for (i = 0; i < op->len; i++)
+		if ((rx[i] & mask[i]) != expected[i])
+			return (op->arg);
+
+	return (0);
+}
+
+/*
+ * Replay ops up to the end of the rendering or the ENDLOOP of the
+ * current level.  Returns PROC_COMPLETE or the error the lattice engine
+ * returned at the same point, a failing LOOP pass ends there as well.
+ */
+static int ecp5_txcache_replay_ops(struct ecp5 *ecp5_info,
+		struct ecp5_txcache_cursor *cursor, unsigned char *rx)
+{
+	struct ecp5_txcache_op *op;
+	int pending = 0;		/* fails the transaction at its end */
+	int result;
+
+	while ((op = ecp5_txcache_next(cursor)))
+	{
+		switch (op->type)
+		{
+		case ECP5_TXOP_RESET:
+			if (!SPI_init())
+				return (ERROR_INIT_SPI);
+			break;
+		case ECP5_TXOP_CS:
+			if (op->arg)
+			{
+				TRANS_starttranx(0);
+				break;
+			}
+			TRANS_endtranx();
+			if (pending)
+				return (pending);
+			break;
+		case ECP5_TXOP_TX:
+			if (!ecp5_txcache_replay_tx(cursor, op))
+				return (ERROR_PROC_HARDWARE);
+			break;
+		case ECP5_TXOP_RX:
+			result = ecp5_txcache_replay_rx(ecp5_info, op, rx);
+			if (result == ERROR_VERIFICATION)
+				pending = result;
+			else if (result)
+				return (result);
+			break;
+		case ECP5_TXOP_WAIT:
+			wait(op->arg);
+			break;
+		case ECP5_TXOP_LOOP:
+		{
+			struct ecp5_txcache_cursor body = *cursor;
+			int pass;
+
+			/*
+			 * like proc_END(), there is at least one pass and only
+			 * a read that didn't match runs the body again
+			 */
+			result = ERROR_LOOP_COND;
+			for (pass = 0; result <= 0 && (!pass || pass < op->arg);
+					pass++)
+			{
+				*cursor = body;
+				result = ecp5_txcache_replay_ops(ecp5_info,
+						cursor, rx);
+				if (result == ERROR_PROC_HARDWARE ||
+						result == ERROR_INIT_SPI)
+					return (result);
+			}
+			if (result <= 0)
+				return (ERROR_LOOP_COND);
+			break;
+		}
+		case ECP5_TXOP_ENDLOOP:
+			return (pending ? pending : PROC_COMPLETE);
+		}
+	}
+
+	return (pending ? pending : PROC_COMPLETE);
+}
+
+static int ecp5_txcache_replay(struct ecp5 *ecp5_info,
+		struct ecp5_txcache_entry *entry)
+{
+	struct ecp5_txcache_cursor cursor = { entry->chunks, 0 };
+	SSPIEm_sizes sizes;
+	int result;
+
+	/* a session for the largest op, RX ops are read into dataBuffer */
+	memset(&sizes, 0, sizeof(sizes));
+	sizes.frameBytes = entry->max_op;
+	if (!SSPIEm_open(&sizes))
+		return (ERROR_INIT);
+
+	/* the rendering starts with the SPI_init() of SSPIEm_init() */
+	result = ecp5_txcache_replay_ops(ecp5_info, &cursor, dataBuffer);
+	if (result != ERROR_INIT_SPI)
+	{
+		if (!SPI_final())
+			result = ERROR_PROC_HARDWARE;
+		else if (result > 0)
+			result = PROC_OVER;
+	}
+
+	SSPIEm_close();
+	return (result);
+}
+
+static void ecp5_txcache_key(struct ecp5_txcache_key *key,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size)
+{
+	key->algo_crc = crc32_le(~0, algo, algo_size);
+	key->data_crc = data ? crc32_le(~0, data, data_size) : 0;
+	key->algo_size = algo_size;
+	key->data_size = data_size;
+}
+
+/* the CRCs only find the entry, the images must be the same */
+static int ecp5_txcache_match(struct ecp5_txcache_entry *entry,
+		struct ecp5_txcache_key *key,
+		unsigned char *algo, unsigned char *data)
+{
+	if (!entry->chunks || memcmp(&entry->key, key, sizeof(*key)))
+		return (0);
+
+	if (!data != !entry->data)
+		return (0);
+
+	return (!memcmp(entry->algo, algo, key->algo_size) &&
+			(!data || !memcmp(entry->data, data, key->data_size)));
+}
+
+/*
+ * Replay the images if they are cached and return the result, or start
+ * rendering them and return 0 so the caller runs the lattice engine.
+ * ecp5_txcache_finish() must follow in both cases.  Called with the
+ * engine held.
+ */
+int ecp5_txcache_run(struct ecp5 *ecp5_info,
+		unsigned char *algo, int algo_size,
+		unsigned char *data, int data_size)
+{
+	struct ecp5_txcache *cache = &ecp5_info->txcache;
+	struct ecp5_txcache_key key;
+	int i;
+
+	mutex_lock(&cache->lock);
+	cache->replaying = NULL;
+	cache->rendering = 0;
+
+	if (!cache->enabled)
+		return (0);
+
+	ecp5_txcache_key(&key, algo, algo_size, data, data_size);
+	cache->clock++;
+
+	for (i = 0; i < ECP5_TXCACHE_ENTRIES; i++)
+	{
+		struct ecp5_txcache_entry *entry = &cache->entries[i];
+
+		if (!ecp5_txcache_match(entry, &key, algo, data))
+			continue;
+
+		cache->hits++;
+		entry->replays++;
+		entry->last_used = cache->clock;
+		cache->replaying = entry;
+		atomic_set(&ecp5_info->progress.cached, 1);
+		pr_info("ECP5: replaying the image from the transaction cache\n");
+
+		return (ecp5_txcache_replay(ecp5_info, entry));
+	}
+
+	cache->misses++;
+	memset(&cache->render, 0, sizeof(cache->render));
+	cache->render.key = key;
+	cache->render.algo = kmemdup(algo, algo_size, GFP_KERNEL);
+	if (data)
+		cache->render.data = kmemdup(data, data_size, GFP_KERNEL);
+	if (!cache->render.algo || (data && !cache->render.data))
+	{
+		pr_info("ECP5: no memory to keep the image in the transaction cache\n");
+		ecp5_txcache_drop(&cache->render);
+		return (0);
+	}
+	cache->tail = NULL;
+	cache->last = NULL;
+	cache->depth = 0;
+	cache->overflow = 0;
+	cache->rendering = 1;
+
+	return (0);
+}
+
+/*
+ * Keep the rendering of a successful run, in place of the least
+ * recently used entry, and drop an entry whose replay failed.
+ */
+void ecp5_txcache_finish(struct ecp5 *ecp5_info, int result)
+{
+	struct ecp5_txcache *cache = &ecp5_info->txcache;
+	struct ecp5_txcache_entry *victim;
+	int i;
+
+	if (cache->replaying && result != PROC_OVER)
+	{
+		pr_err("ECP5: replay from the transaction cache failed with "
+				"code %d, image dropped\n", result);
+		ecp5_txcache_drop(cache->replaying);
+		cache->dropped++;
+	}
+	cache->replaying = NULL;
+
+	if (cache->rendering)
+	{
+		cache->rendering = 0;
+
+		if (result != PROC_OVER || cache->overflow)
+		{
+			if (cache->overflow)
+				pr_info("ECP5: image too large for the transaction cache\n");
+			ecp5_txcache_drop(&cache->render);
+		}
+		else
+		{
+			victim = &cache->entries[0];
+			for (i = 1; i < ECP5_TXCACHE_ENTRIES; i++)
+				if (!cache->entries[i].chunks ||
+						(victim->chunks &&
+						 cache->entries[i].last_used <
+						 victim->last_used))
+					victim = &cache->entries[i];
+
+			ecp5_txcache_drop(victim);
+			*victim = cache->render;
+			victim->last_used = cache->clock;
+		}
+		memset(&cache->render, 0, sizeof(cache->render));
+		cache->tail = NULL;
+		cache->last = NULL;
+	}
+
+	mutex_unlock(&cache->lock);
+}
+
+static int ecp5_txcache_show(struct seq_file *s, void *unused)
+{
+	struct ecp5 *ecp5_info = s->private;
+	struct ecp5_txcache *cache = &ecp5_info->txcache;
+	int i;
+
+	mutex_lock(&cache->lock);
+
+	seq_printf(s, "enabled: %d\n", cache->enabled);
+	seq_printf(s, "hits:    %u\n", cache->hits);
+	seq_printf(s, "misses:  %u\n", cache->misses);
+	seq_printf(s, "dropped: %u\n", cache->dropped);
+
+	seq_printf(s, "\n  %-10s %10s %-10s %10s %10s %8s\n",
+			"algo_crc", "algo_size", "data_crc", "data_size",
+			"bytes", "replays");
+	for (i = 0; i < ECP5_TXCACHE_ENTRIES; i++)
+	{
+		struct ecp5_txcache_entry *entry = &cache->entries[i];
+
+		if (!entry->chunks)
+			continue;
+
+		seq_printf(s, "  0x%08x %10d 0x%08x %10d %10zu %8u\n",
+				entry->key.algo_crc, entry->key.algo_size,
+				entry->key.data_crc, entry->key.data_size,
+				entry->size, entry->replays);
+	}
+
+	mutex_unlock(&cache->lock);
+
+	return (0);
+}
+
+static int ecp5_txcache_open(struct inode *inode, struct file *fp)
+{
+	return (single_open(fp, ecp5_txcache_show, inode->i_private));
+}
+
+const struct file_operations ecp5_txcache_fops = {
+	.owner = THIS_MODULE,
+	.open = ecp5_txcache_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};